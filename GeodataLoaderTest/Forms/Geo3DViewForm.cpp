@@ -1053,8 +1053,25 @@ void Geo3DViewForm::UpdatePathFindMarkers(void)
 	}
 }
 
+// ground the camera looks at, or ground under the camera if view ray doesn't reach terrain within far plane distance
 bool Geo3DViewForm::GetCurrentGroundCoords(int32_t& WorldX, int32_t& WorldY, int32_t& WorldZ)
 {
+	XMFLOAT3 Target;
+	XMStoreFloat3(&Target, XMLoadFloat3(&CameraPosition) + XMVector3Normalize(TargetVector) * ToScene(1500.0f));
+
+	XMINT3 RayFrom, RayTo, Hit;
+	ToWorld(CameraPosition.x, CameraPosition.y, CameraPosition.z, RayFrom.x, RayFrom.y, RayFrom.z);
+	ToWorld(Target.x, Target.y, Target.z, RayTo.x, RayTo.y, RayTo.z);
+
+	if (L2GeodataRaycast::Raycast(RayFrom, RayTo, Hit)) {
+
+		WorldX = Hit.x;
+		WorldY = Hit.y;
+		WorldZ = Hit.z;
+
+		return true;
+	}
+
 	ToWorld(CameraPosition.x, CameraPosition.y, CameraPosition.z, WorldX, WorldY, WorldZ);
 
 	int16_t GroundSubBlock, GroundLayerIndex;
@@ -1118,6 +1135,8 @@ void Geo3DViewForm::VisualizeWeights(void)
 {
 	const static int VISUALIZATION_SIZE = 150;
 
+	L2Geodata::ReaderGuard Guard;
+
 	int32_t WorldX, WorldY, WorldZ;
 	if (!GetCurrentGroundCoords(WorldX, WorldY, WorldZ))
 		return;
@@ -12,6 +12,7 @@
 #include "Geodata\L2Geodata.h"
 #include "Geodata\L2GeodataModelGenerator.h"
 #include "Geodata\L2GeodataPathFind.h"
+#include "Geodata\L2GeodataRaycast.h"
 
 using namespace DirectX;
 
@@ -1,6 +1,9 @@
 #include "stdafx.h"
 
 #include "L2Geodata.h"
+#include "L2GeodataOverlay.h"
+#include "L2GeodataRaycast.h"
+#include "L2GeodataSpatial.h"
 
 #include <iostream>
 #include <experimental/filesystem>
@@ -12,19 +15,58 @@
 
 #include "TimeUtils.h"
 
+#include <intrin.h>
+#include <immintrin.h>
+
 using namespace experimental::filesystem::v1;
 using namespace string_literals;
 
-int16_t *L2Geodata::FullData;
-int32_t L2Geodata::MultilayerBlockMap[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS][GEO_REGION_SIZE_IN_BLOCKS][GEO_REGION_SIZE_IN_BLOCKS];
-int32_t L2Geodata::MultilayerSubblockMap[MULTILAYER_BLOCK_LIMIT][GEO_BLOCK_SIZE][GEO_BLOCK_SIZE];
-int16_t L2Geodata::LayersTable[LAYERS_COUNT_LIMIT];
+atomic<L2Geodata::GeoRegion*> L2Geodata::Regions[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+
+atomic<uint64_t> L2Geodata::GlobalEpoch(1);
+atomic<uint64_t> L2Geodata::ReaderEpochs[READER_SLOTS_COUNT];
+vector<L2Geodata::RetiredRegion> L2Geodata::RetiredRegions;
+vector<L2Geodata::RetiredMemory> L2Geodata::RetiredMemoryBlocks;
+mutex L2Geodata::RetiredRegionsLock;
+
+static thread_local uint32_t ReaderSlot;
+static thread_local uint32_t ReaderDepth = 0;
+
+thread_local L2GeodataOverlay* L2Geodata::ThreadOverlay = nullptr;
+atomic<L2GeodataOverlay*> L2Geodata::WorldOverlay(nullptr);
+
+bool L2Geodata::LazyLoading = false;
+uint64_t L2Geodata::PagingMemoryBudget;
+L2Geodata::RegionSource L2Geodata::RegionSources[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+atomic<bool> L2Geodata::HasRegionSource[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+mutex L2Geodata::RegionsLock;
+atomic<uint64_t> L2Geodata::ReloadVersion;
+
+atomic<uint64_t> L2Geodata::AccessClock;
+atomic<uint64_t> L2Geodata::RegionLastAccess[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+atomic<uint64_t> L2Geodata::PagedSize;
+atomic<uint64_t> L2Geodata::PagingHits, L2Geodata::PagingMisses, L2Geodata::PagingEvictions;
+
+// hits are counted per thread and added to PagingHits in batches, lookups don't share a counter cache line
+static thread_local uint32_t LocalPagingHits = 0;
+
+GeoLayout L2Geodata::Layout = GEO_LAYOUT_LINEAR;
 
-int32_t L2Geodata::NextMultilayerBlockMapIndex;
-int32_t L2Geodata::NextLayersTableIndex;
+bool L2Geodata::UseLargePages = false;
+SIZE_T L2Geodata::LargePageSize = 0;
+unordered_map<void*, SIZE_T> L2Geodata::LargePageBlocks;
+mutex L2Geodata::LargePageBlocksLock;
+atomic<uint64_t> L2Geodata::LargePageFallbacks;
 
-uint8_t *L2Geodata::NWC_FullData;
-int32_t L2Geodata::NWC_MultilayerBlockMap[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS][GEO_REGION_SIZE_IN_BLOCKS][GEO_REGION_SIZE_IN_BLOCKS];
+HANDLE L2Geodata::EasyGeoFile = INVALID_HANDLE_VALUE;
+HANDLE L2Geodata::EasyGeoMapping;
+uint8_t *L2Geodata::EasyGeoView;
+uint64_t L2Geodata::EasyGeoViewSize;
+
+uint8_t L2Geodata::NWC_EmptyWeight = 0;
+
+L2Geodata::NWCRegion *L2Geodata::NWC_Regions[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+atomic<bool> L2Geodata::NWC_StaleRegions[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
 int32_t L2Geodata::NWC_MultilayerSubblockMap[MULTILAYER_BLOCK_LIMIT][GEO_BLOCK_SIZE][GEO_BLOCK_SIZE];
 uint8_t L2Geodata::NWC_LayersTable[LAYERS_COUNT_LIMIT];
 		
@@ -33,16 +75,50 @@ atomic<int32_t> L2Geodata::NWC_NextLayersTableIndex;
 
 // get
 
-int16_t *L2Geodata::GetGeoSubBlockPtrInternal(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY,
-	uint32_t SubBlockX, uint32_t SubBlockY) {
-	uint32_t Index;
+L2Geodata::GeoBlock *L2Geodata::GetGeoBlockPtrInternal(GeoRegion *Region, uint32_t BlockX, uint32_t BlockY) {
+
+	return &Region->Blocks[GetBlockIndex(Layout, BlockX, BlockY)];
+}
+
+int16_t *L2Geodata::GetRegionSubBlocksInternal(GeoRegion *Region, uint32_t BlockX, uint32_t BlockY, 
+	uint32_t SubBlockX, uint32_t SubBlockY, int16_t& Count) {
+
+	GeoBlock* Block = GetGeoBlockPtrInternal(Region, BlockX, BlockY);
+
+	switch (Block->Type) {
+	case GEO_BLOCK_FLAT:
 
-	Index =
-		RegionY * GEO_ROW_SIZE + RegionX * GEO_REGION_AREA_SIZE +
-		BlockX * GEO_REGION_COLUMN_SIZE + BlockY * GEO_BLOCK_AREA_SIZE +
-		SubBlockX * GEO_BLOCK_COLUMN_SIZE + SubBlockY * 1;
+		Count = 1;
+		return &Block->Data;
+	case GEO_BLOCK_COMPLEX: {
 
-	return &FullData[Index];
+		int16_t* SubBlock = &((int16_t*)Region->GetComplexBlocks()[(uint16_t)Block->Data])[GetCellIndex(Layout, SubBlockX, SubBlockY)];
+		if (*SubBlock == SPECIAL_SUBBLOCK_EMPTY) {
+			Count = 0;
+			return nullptr;
+		}
+
+		Count = 1;
+		return SubBlock;
+	}
+	case GEO_BLOCK_MULTILAYER: {
+
+		int32_t SubBlockLayersIndex = ((int32_t*)Region->GetMultilayerBlocks()[(uint16_t)Block->Data])[GetCellIndex(Layout, SubBlockX, SubBlockY)];
+		if (SubBlockLayersIndex == -1) {
+			Count = 0;
+			return nullptr;
+		}
+
+		int16_t* Layers = Region->GetLayers();
+
+		Count = Layers[SubBlockLayersIndex];
+		return &Layers[SubBlockLayersIndex + 1];
+	}
+	default:
+
+		Count = 0;
+		return nullptr;
+	}
 }
 
 bool L2Geodata::WorldToGeo(int32_t WorldX, int32_t WorldY, uint32_t *GeoX, uint32_t *GeoY) {
@@ -81,43 +157,239 @@ int16_t* L2Geodata::GetSubBlocks(int32_t WorldX, int32_t WorldY, int16_t& Count)
 
 	uint32_t GeoX, GeoY;
 
-	if (WorldToGeo(WorldX, WorldY, &GeoX, &GeoY)) {
-		
-		uint32_t RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY;
+	if (WorldToGeo(WorldX, WorldY, &GeoX, &GeoY))
+		return GetSubBlocksGeo(GeoX, GeoY, Count);
+	else {
+		Count = 0;
+		return nullptr;
+	}
+}
 
-		SplitGeoCoordinates();
+int16_t* L2Geodata::GetSubBlocksGeo(uint32_t GeoX, uint32_t GeoY, int16_t& Count) {
 
-		int16_t* SubBlock = GetGeoSubBlockPtrInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY);
-		if (*SubBlock == SPECIAL_SUBBLOCK_EMPTY) {
-			Count = 0;
-			return nullptr;
+	L2GeodataOverlay* Overlay = GetActiveOverlay();
+	if (Overlay) {
+
+		int16_t* Layers;
+		if (Overlay->FindSubBlocks(GeoX, GeoY, Layers, Count))
+			return Layers;
+	}
+
+	return GetStaticSubBlocks(GeoX, GeoY, Count);
+}
+
+int16_t* L2Geodata::GetStaticSubBlocks(uint32_t GeoX, uint32_t GeoY, int16_t& Count) {
+
+	uint32_t RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY;
+
+	SplitGeoCoordinates();
+
+	GeoRegion* Region = Regions[RegionX][RegionY];
+	if (LazyLoading)
+		Region = AcquireLazyRegion(RegionX, RegionY, Region);
+
+	if (Region == nullptr) {
+		Count = 0;
+		return nullptr;
+	}
+
+	return GetRegionSubBlocksInternal(Region, BlockX, BlockY, SubBlockX, SubBlockY, Count);
+}
+
+// batch
+
+bool L2Geodata::IsAVX2Supported(void)
+{
+	static const bool Supported = [] {
+
+		int Info[4];
+
+		__cpuid(Info, 0);
+		if (Info[0] < 7)
+			return false;
+
+		// AVX and OS saving YMM registers
+		__cpuid(Info, 1);
+		if ((Info[2] & (1 << 27)) == 0 || (Info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+			return false;
+
+		__cpuidex(Info, 7, 0);
+
+		return (Info[1] & (1 << 5)) != 0;
+	}();
+
+	return Supported;
+}
+
+void L2Geodata::GetSubBlocksBatchGeo(const uint32_t* GeoX, const uint32_t* GeoY, uint32_t Count, int16_t* LayersCounts, int16_t** Layers)
+{
+	GeoRegion* Region = nullptr;
+	uint32_t CachedRegionX = UINT32_MAX, CachedRegionY = UINT32_MAX;
+
+	L2GeodataOverlay* Overlay = GetActiveOverlay();
+
+	for (uint32_t Index = 0; Index < Count; Index++) {
+
+		uint32_t RegionX = GeoX[Index] / GEO_REGION_SIZE;
+		uint32_t RegionY = GeoY[Index] / GEO_REGION_SIZE;
+
+		if (RegionX >= GEO_WIDTH_IN_REGIONS || RegionY >= GEO_HEIGHT_IN_REGIONS) {
+			LayersCounts[Index] = 0;
+			Layers[Index] = nullptr;
+			continue;
 		}
-		else if (*SubBlock == SPECIAL_SUBBLOCK_MULTILAYER) {
 
-			int32_t BlockIndex = MultilayerBlockMap[RegionX][RegionY][BlockX][BlockY];
-			if (BlockIndex == -1) {
-				Count = 0;
-				return nullptr;
+		if (Overlay && Overlay->FindSubBlocks(GeoX[Index], GeoY[Index], Layers[Index], LayersCounts[Index]))
+			continue;
+
+		// neighbouring points are almost always in the same region
+		if (RegionX != CachedRegionX || RegionY != CachedRegionY) {
+
+			Region = Regions[RegionX][RegionY];
+			if (LazyLoading)
+				Region = AcquireLazyRegion(RegionX, RegionY, Region);
+
+			CachedRegionX = RegionX;
+			CachedRegionY = RegionY;
+		}
+
+		if (Region == nullptr) {
+			LayersCounts[Index] = 0;
+			Layers[Index] = nullptr;
+			continue;
+		}
+
+		uint32_t BlockX = GeoX[Index] % GEO_REGION_SIZE / GEO_BLOCK_SIZE;
+		uint32_t BlockY = GeoY[Index] % GEO_REGION_SIZE / GEO_BLOCK_SIZE;
+
+		uint32_t SubBlockX = GeoX[Index] % GEO_BLOCK_SIZE;
+		uint32_t SubBlockY = GeoY[Index] % GEO_BLOCK_SIZE;
+
+		Layers[Index] = GetRegionSubBlocksInternal(Region, BlockX, BlockY, SubBlockX, SubBlockY, LayersCounts[Index]);
+	}
+}
+
+void L2Geodata::GetSubBlocksBatch(const int32_t* WorldX, const int32_t* WorldY, uint32_t Count, int16_t* LayersCounts, int16_t** Layers)
+{
+	const static uint32_t CHUNK_SIZE = 256;
+
+	uint32_t GeoX[CHUNK_SIZE], GeoY[CHUNK_SIZE];
+
+	for (uint32_t ChunkStart = 0; ChunkStart < Count; ChunkStart += CHUNK_SIZE) {
+
+		uint32_t ChunkCount = min(CHUNK_SIZE, Count - ChunkStart);
+
+		// points outside of the map get coords that are outside of regions directory
+		for (uint32_t Index = 0; Index < ChunkCount; Index++)
+			if (!WorldToGeo(WorldX[ChunkStart + Index], WorldY[ChunkStart + Index], &GeoX[Index], &GeoY[Index]))
+				GeoX[Index] = GeoY[Index] = UINT32_MAX;
+
+		GetSubBlocksBatchGeo(GeoX, GeoY, ChunkCount, &LayersCounts[ChunkStart], &Layers[ChunkStart]);
+	}
+}
+
+uint32_t L2Geodata::GetDecodedSubBlocksBatch(const int32_t* WorldX, const int32_t* WorldY, uint32_t Count, int16_t* LayersCounts,
+	int16_t* Heights, int16_t* NSWE, uint32_t MaxLayersCount, uint32_t& LayersCount)
+{
+	const static uint32_t CHUNK_SIZE = 256;
+
+	uint32_t GeoX[CHUNK_SIZE], GeoY[CHUNK_SIZE];
+	int16_t* Layers[CHUNK_SIZE];
+
+	LayersCount = 0;
+
+	for (uint32_t ChunkStart = 0; ChunkStart < Count; ChunkStart += CHUNK_SIZE) {
+
+		uint32_t ChunkCount = min(CHUNK_SIZE, Count - ChunkStart);
+
+		for (uint32_t Index = 0; Index < ChunkCount; Index++)
+			if (!WorldToGeo(WorldX[ChunkStart + Index], WorldY[ChunkStart + Index], &GeoX[Index], &GeoY[Index]))
+				GeoX[Index] = GeoY[Index] = UINT32_MAX;
+
+		GetSubBlocksBatchGeo(GeoX, GeoY, ChunkCount, &LayersCounts[ChunkStart], Layers);
+
+		// layers are decoded right from the region, pointers stay in this chunk
+		for (uint32_t Index = 0; Index < ChunkCount; Index++) {
+
+			int16_t PointLayersCount = LayersCounts[ChunkStart + Index];
+			if (LayersCount + PointLayersCount > MaxLayersCount)
+				return ChunkStart + Index;
+
+			for (int16_t LayerIndex = 0; LayerIndex < PointLayersCount; LayerIndex++) {
+				Heights[LayersCount] = GET_GEO_HEIGHT(Layers[Index][LayerIndex]);
+				NSWE[LayersCount] = GET_GEO_NSWE(Layers[Index][LayerIndex]);
+				LayersCount++;
 			}
+		}
+	}
 
-			int32_t SubBlockLayersIndex = MultilayerSubblockMap[BlockIndex][SubBlockX][SubBlockY];
-			if (SubBlockLayersIndex == -1) {
-				Count = 0;
-				return nullptr;
+	return Count;
+}
+
+void L2Geodata::GetGroundSubBlocksBatch(const int32_t* WorldX, const int32_t* WorldY, const int32_t* WorldZ, uint32_t Count,
+	int16_t* GroundSubBlocks, int16_t* GroundLayerIndices)
+{
+	const static uint32_t CHUNK_SIZE = 256;
+
+	int16_t LayersCounts[CHUNK_SIZE];
+	int16_t* Layers[CHUNK_SIZE];
+
+	for (uint32_t ChunkStart = 0; ChunkStart < Count; ChunkStart += CHUNK_SIZE) {
+
+		uint32_t ChunkCount = min(CHUNK_SIZE, Count - ChunkStart);
+
+		GetSubBlocksBatch(&WorldX[ChunkStart], &WorldY[ChunkStart], ChunkCount, LayersCounts, Layers);
+
+		for (uint32_t Index = 0; Index < ChunkCount; Index++) {
+
+			int16_t GroundLayerIndex = -1;
+			int16_t GroundSubBlock = SPECIAL_SUBBLOCK_EMPTY;
+
+			int16_t LayerIndex = CountLayersAbove(Layers[Index], LayersCounts[Index], WorldZ[ChunkStart + Index] + MIN_LAYER_DIFF);
+			if (LayerIndex < LayersCounts[Index]) {
+				GroundSubBlock = Layers[Index][LayerIndex];
+				GroundLayerIndex = LayerIndex;
 			}
 
-			Count = LayersTable[SubBlockLayersIndex];
-			return &LayersTable[SubBlockLayersIndex + 1];
-		}
-		else {
-			Count = 1;
-			return SubBlock;
+			GroundSubBlocks[ChunkStart + Index] = GroundSubBlock;
+			GroundLayerIndices[ChunkStart + Index] = GroundLayerIndex;
 		}
 	}
-	else {
-		Count = 0;
-		return nullptr;
+}
+
+void L2Geodata::DecodeSubBlocks(const int16_t* SubBlocks, uint32_t Count, int16_t* Heights, int16_t* NSWE)
+{
+	uint32_t Index = 0;
+
+	if (IsAVX2Supported())
+		Index = DecodeSubBlocksAVX2(SubBlocks, Count, Heights, NSWE);
+
+	for (; Index < Count; Index++) {
+		Heights[Index] = GET_GEO_HEIGHT(SubBlocks[Index]);
+		NSWE[Index] = GET_GEO_NSWE(SubBlocks[Index]);
+	}
+}
+
+// returns count of decoded subblocks, tail is left for scalar path
+uint32_t L2Geodata::DecodeSubBlocksAVX2(const int16_t* SubBlocks, uint32_t Count, int16_t* Heights, int16_t* NSWE)
+{
+	const __m256i HeightMask = _mm256_set1_epi16((int16_t)0xFFF0);
+	const __m256i NSWEMask = _mm256_set1_epi16(0x0F);
+
+	uint32_t Index = 0;
+
+	for (; Index + 16 <= Count; Index += 16) {
+
+		__m256i Data = _mm256_loadu_si256((const __m256i*)&SubBlocks[Index]);
+
+		__m256i Height = _mm256_srai_epi16(_mm256_and_si256(Data, HeightMask), 1);
+		__m256i Directions = _mm256_and_si256(Data, NSWEMask);
+
+		_mm256_storeu_si256((__m256i*)&Heights[Index], Height);
+		_mm256_storeu_si256((__m256i*)&NSWE[Index], Directions);
 	}
+
+	return Index;
 }
 // set
 
@@ -127,360 +399,2311 @@ inline void L2Geodata::ValidateSubBlock(int16_t SubBlock) {
 		throw new runtime_error("Input subblock have special value, you need to either change geodata subblock or change special values");
 }
 
-inline void L2Geodata::SetGeoSubBlockInternal(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY,
-	uint32_t SubBlockX, uint32_t SubBlockY, int16_t SubBlock) {
+// changing a single subblock rebuilds its region off to the side, so it works for mapped regions too
+void L2Geodata::SetSubBlocks(int32_t WorldX, int32_t WorldY, int16_t Count, ...)
+{
+	if (Count < 0 || Count > LAYERS_PER_SUBBLOCK_LIMIT)
+		throw new runtime_error("Invalid subblock count");
+
+	uint32_t GeoX, GeoY;
 
-	ValidateSubBlock(SubBlock);
+	if (WorldToGeo(WorldX, WorldY, &GeoX, &GeoY)) {
 
-	int16_t* DestSubBlock = GetGeoSubBlockPtrInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY);
-	if (*DestSubBlock != SPECIAL_SUBBLOCK_EMPTY)
-		throw new runtime_error("Subblock override prevention");
+		uint32_t RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY;
+
+		SplitGeoCoordinates();
+
+		lock_guard<mutex> Lock(RegionsLock);
+
+		GeoRegion* OldRegion = Regions[RegionX][RegionY];
+		bool IsPagedIn = false;
+
+		// page region in, edited region is pinned below since its source doesn't have the edit
+		if (OldRegion == nullptr && LazyLoading && HasRegionSource[RegionX][RegionY]) {
+
+			OldRegion = ReadRegion(RegionSources[RegionX][RegionY]);
+			PagedSize += OldRegion->Size;
+			PagingMisses++;
+			IsPagedIn = true;
+		}
+
+		if (Count == 0 && OldRegion == nullptr)
+			return;
+
+		GeoRegionBuilder* Builder = new GeoRegionBuilder(OldRegion);
+
+		Builder->EraseSubBlock(BlockX, BlockY, SubBlockX, SubBlockY);
+
+		if (Count > 0) {
+			int16_t Layers[LAYERS_PER_SUBBLOCK_LIMIT];
+
+			va_list ap;
+			va_start(ap, Count);
+			for (int Index = 0; Index < Count; Index++)
+				Layers[Index] = va_arg(ap, int16_t);
+			va_end(ap);
+
+			sort(begin(Layers), begin(Layers) + Count);
+			reverse(begin(Layers), begin(Layers) + Count);
+
+			if (Count == 1)
+				Builder->SetSubBlock(BlockX, BlockY, SubBlockX, SubBlockY, Layers[0]);
+			else {
+				Builder->SetLayers(BlockX, BlockY, SubBlockX, SubBlockY, Count, Layers);
+			}
+		}
+
+		GeoRegion* Region = Builder->Build();
+		delete Builder;
+
+		if (HasRegionSource[RegionX][RegionY]) {
+
+			if (OldRegion)
+				PagedSize -= OldRegion->Size;
+
+			SetRegionSource(RegionX, RegionY, { });
+		}
+
+		ReplaceRegion(RegionX, RegionY, Region);
 
-	*DestSubBlock = SubBlock;
+		// region paged in just for the edit was never published
+		if (IsPagedIn)
+			FreeRegion(OldRegion);
+	}
 }
 
-inline void L2Geodata::SetGeoLayersInternal(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY,
-	uint32_t SubBlockX, uint32_t SubBlockY, int16_t LayersCount, int16_t* Layers) {
+// region builder
 
-	int16_t* FullGeoSubBlock = GetGeoSubBlockPtrInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY); 
+L2Geodata::GeoRegionBuilder::GeoRegionBuilder(void)
+{
+	memset(Blocks, 0, sizeof(Blocks));
+}
 
-	if (*FullGeoSubBlock != SPECIAL_SUBBLOCK_EMPTY)
-		throw new runtime_error("Geo subblock is not empty");
+L2Geodata::GeoRegionBuilder::GeoRegionBuilder(GeoRegion* Region)
+{
+	if (Region == nullptr) {
+		memset(Blocks, 0, sizeof(Blocks));
+		return;
+	}
 
-	*FullGeoSubBlock = SPECIAL_SUBBLOCK_MULTILAYER;
+	// builder is always linear, region might be in any layout
+	GeoLayout RegionLayout = (GeoLayout)Region->Layout;
 
-	for (int Index = 0; Index < LayersCount; Index++)
-		ValidateSubBlock(Layers[Index]);
+	for (uint32_t BlockX = 0; BlockX < GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+		for (uint32_t BlockY = 0; BlockY < GEO_REGION_SIZE_IN_BLOCKS; BlockY++)
+			Blocks[BlockX * GEO_REGION_SIZE_IN_BLOCKS + BlockY] = Region->Blocks[GetBlockIndex(RegionLayout, BlockX, BlockY)];
 
-	int32_t BlockIndex = MultilayerBlockMap[RegionX][RegionY][BlockX][BlockY];
-	if (BlockIndex == -1) {
+	int16_t* RegionComplexBlocks = (int16_t*)Region->GetComplexBlocks();
+	int32_t* RegionMultilayerBlocks = (int32_t*)Region->GetMultilayerBlocks();
+	int16_t* RegionLayers = Region->GetLayers();
+
+	ComplexBlocks.resize(Region->ComplexBlocksCount * GEO_BLOCK_AREA_SIZE);
+	MultilayerBlocks.resize(Region->MultilayerBlocksCount * GEO_BLOCK_AREA_SIZE);
+
+	for (uint32_t CellIndex = 0; CellIndex < GEO_BLOCK_AREA_SIZE; CellIndex++) {
 
-		BlockIndex = AllocateBlockMapEntry();
-		MultilayerBlockMap[RegionX][RegionY][BlockX][BlockY] = BlockIndex;
+		uint32_t RegionCellIndex = GetCellIndex(RegionLayout, CellIndex / GEO_BLOCK_SIZE, CellIndex % GEO_BLOCK_SIZE);
+
+		for (uint32_t BlockIndex = 0; BlockIndex < Region->ComplexBlocksCount; BlockIndex++)
+			ComplexBlocks[BlockIndex * GEO_BLOCK_AREA_SIZE + CellIndex] = RegionComplexBlocks[BlockIndex * GEO_BLOCK_AREA_SIZE + RegionCellIndex];
+
+		for (uint32_t BlockIndex = 0; BlockIndex < Region->MultilayerBlocksCount; BlockIndex++)
+			MultilayerBlocks[BlockIndex * GEO_BLOCK_AREA_SIZE + CellIndex] = RegionMultilayerBlocks[BlockIndex * GEO_BLOCK_AREA_SIZE + RegionCellIndex];
 	}
 
-	int32_t SubBlockLayersIndex = MultilayerSubblockMap[BlockIndex][SubBlockX][SubBlockY];
-	if (SubBlockLayersIndex != -1)
-		throw new runtime_error("Block layers are already set");
+	Layers.assign(RegionLayers, RegionLayers + Region->LayersCount);
+}
 
-	SubBlockLayersIndex = AllocateLayersEntries(1 + LayersCount);
-	MultilayerSubblockMap[BlockIndex][SubBlockX][SubBlockY] = SubBlockLayersIndex;
+L2Geodata::GeoBlock& L2Geodata::GeoRegionBuilder::GetBlock(uint32_t BlockX, uint32_t BlockY)
+{
+	return Blocks[BlockX * GEO_REGION_SIZE_IN_BLOCKS + BlockY];
+}
 
-	LayersTable[SubBlockLayersIndex] = LayersCount;
-	memcpy(&LayersTable[SubBlockLayersIndex + 1], Layers, LayersCount * sizeof(*Layers));
+void L2Geodata::GeoRegionBuilder::ConvertToComplex(GeoBlock& Block)
+{
+	if (Block.Type == GEO_BLOCK_COMPLEX || Block.Type == GEO_BLOCK_MULTILAYER)
+		return;
 
-	for (int Index = 1; Index < LayersCount; Index++) {
+	uint32_t ComplexBlockIndex = (uint32_t)ComplexBlocks.size() / GEO_BLOCK_AREA_SIZE;
+	if (ComplexBlockIndex > UINT16_MAX)
+		throw new runtime_error("Complex block count exceeds the limit");
 
-		int16_t PrevHeight = GET_GEO_HEIGHT(Layers[Index - 1]);
-		int16_t Height = GET_GEO_HEIGHT(Layers[Index]);
+	int16_t SubBlock = Block.Type == GEO_BLOCK_FLAT ? Block.Data : SPECIAL_SUBBLOCK_EMPTY;
+	ComplexBlocks.insert(ComplexBlocks.end(), GEO_BLOCK_AREA_SIZE, SubBlock);
 
-		if (PrevHeight <= Height)
-			throw new runtime_error("Layers required to be sorted (" + to_string(PrevHeight) + " > " + to_string(Height) + ")");
+	Block.Type = GEO_BLOCK_COMPLEX;
+	Block.Data = (int16_t)ComplexBlockIndex;
+}
+
+void L2Geodata::GeoRegionBuilder::ConvertToMultilayer(GeoBlock& Block)
+{
+	if (Block.Type == GEO_BLOCK_MULTILAYER)
+		return;
+
+	ConvertToComplex(Block);
+
+	uint32_t MultilayerBlockIndex = (uint32_t)MultilayerBlocks.size() / GEO_BLOCK_AREA_SIZE;
+	if (MultilayerBlockIndex > UINT16_MAX)
+		throw new runtime_error("Multilayer block count exceeds the limit");
+
+	MultilayerBlocks.insert(MultilayerBlocks.end(), GEO_BLOCK_AREA_SIZE, -1);
+
+	// complex cells become single layer entries, complex block itself stays in the table until Build drops it
+	int16_t* Cells = &ComplexBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE];
+	int32_t* LayerIndices = &MultilayerBlocks[MultilayerBlockIndex * GEO_BLOCK_AREA_SIZE];
+
+	for (uint32_t CellIndex = 0; CellIndex < GEO_BLOCK_AREA_SIZE; CellIndex++)
+		if (Cells[CellIndex] != SPECIAL_SUBBLOCK_EMPTY)
+			LayerIndices[CellIndex] = AddLayers(1, &Cells[CellIndex]);
+
+	Block.Type = GEO_BLOCK_MULTILAYER;
+	Block.Data = (int16_t)MultilayerBlockIndex;
+}
+
+int32_t L2Geodata::GeoRegionBuilder::AddLayers(int16_t LayersCount, int16_t* NewLayers)
+{
+	if (Layers.size() + 1 + LayersCount > INT32_MAX)
+		throw new runtime_error("Layers entries count exceeds the limit");
+
+	int32_t Index = (int32_t)Layers.size();
+
+	Layers.push_back(LayersCount);
+	Layers.insert(Layers.end(), NewLayers, NewLayers + LayersCount);
+
+	return Index;
+}
+
+int16_t* L2Geodata::GeoRegionBuilder::GetSubBlocks(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY, int16_t& Count)
+{
+	GeoBlock& Block = GetBlock(BlockX, BlockY);
+
+	Count = 0;
+
+	switch (Block.Type) {
+	case GEO_BLOCK_FLAT:
+
+		Count = 1;
+		return &Block.Data;
+	case GEO_BLOCK_COMPLEX: {
+
+		int16_t* SubBlock = &ComplexBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY];
+		if (*SubBlock == SPECIAL_SUBBLOCK_EMPTY)
+			return nullptr;
+
+		Count = 1;
+		return SubBlock;
+	}
+	case GEO_BLOCK_MULTILAYER: {
+
+		int32_t LayersIndex = MultilayerBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY];
+		if (LayersIndex == -1)
+			return nullptr;
+
+		Count = Layers[LayersIndex];
+		return &Layers[LayersIndex + 1];
+	}
 	}
+
+	return nullptr;
+}
+
+void L2Geodata::GeoRegionBuilder::SetFlatBlock(uint32_t BlockX, uint32_t BlockY, int16_t SubBlock)
+{
+	ValidateSubBlock(SubBlock);
+
+	GeoBlock& Block = GetBlock(BlockX, BlockY);
+	if (Block.Type != GEO_BLOCK_EMPTY)
+		throw new runtime_error("Block override prevention");
+
+	Block.Type = GEO_BLOCK_FLAT;
+	Block.Data = SubBlock;
 }
 
-inline void L2Geodata::EraseGeoSubBlock(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY)
+void L2Geodata::GeoRegionBuilder::SetSubBlock(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY, int16_t SubBlock)
 {
-	int32_t BlockIndex = MultilayerBlockMap[RegionX][RegionY][BlockX][BlockY];
-	if (BlockIndex != -1)
-		MultilayerSubblockMap[BlockIndex][SubBlockX][SubBlockY] = -1;
+	ValidateSubBlock(SubBlock);
+
+	GeoBlock& Block = GetBlock(BlockX, BlockY);
+	if (Block.Type == GEO_BLOCK_FLAT)
+		throw new runtime_error("Subblock override prevention");
+
+	if (Block.Type == GEO_BLOCK_MULTILAYER) {
+
+		int32_t& LayersIndex = MultilayerBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY];
+		if (LayersIndex != -1)
+			throw new runtime_error("Subblock override prevention");
+
+		LayersIndex = AddLayers(1, &SubBlock);
+		return;
+	}
+
+	ConvertToComplex(Block);
+
+	int16_t& DestSubBlock = ComplexBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY];
+	if (DestSubBlock != SPECIAL_SUBBLOCK_EMPTY)
+		throw new runtime_error("Subblock override prevention");
+
+	DestSubBlock = SubBlock;
+}
+
+void L2Geodata::GeoRegionBuilder::SetLayers(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY, 
+	int16_t LayersCount, int16_t* NewLayers)
+{
+	if (LayersCount < 1 || LayersCount > LAYERS_PER_SUBBLOCK_LIMIT)
+		throw new runtime_error("Invalid layers count");
+
+	for (int Index = 0; Index < LayersCount; Index++)
+		ValidateSubBlock(NewLayers[Index]);
+
+	for (int Index = 1; Index < LayersCount; Index++) {
+
+		int16_t PrevHeight = GET_GEO_HEIGHT(NewLayers[Index - 1]);
+		int16_t Height = GET_GEO_HEIGHT(NewLayers[Index]);
+
+		if (PrevHeight <= Height)
+			throw new runtime_error("Layers required to be sorted (" + to_string(PrevHeight) + " > " + to_string(Height) + ")");
+	}
+
+	GeoBlock& Block = GetBlock(BlockX, BlockY);
+	if (Block.Type == GEO_BLOCK_FLAT)
+		throw new runtime_error("Geo subblock is not empty");
+
+	ConvertToMultilayer(Block);
+
+	int32_t& LayersIndex = MultilayerBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY];
+	if (LayersIndex != -1)
+		throw new runtime_error("Block layers are already set");
+
+	LayersIndex = AddLayers(LayersCount, NewLayers);
+}
+
+void L2Geodata::GeoRegionBuilder::EraseSubBlock(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY)
+{
+	GeoBlock& Block = GetBlock(BlockX, BlockY);
+
+	switch (Block.Type) {
+	case GEO_BLOCK_FLAT:
+
+		ConvertToComplex(Block);
+		ComplexBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY] = SPECIAL_SUBBLOCK_EMPTY;
+		break;
+	case GEO_BLOCK_COMPLEX:
+
+		ComplexBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY] = SPECIAL_SUBBLOCK_EMPTY;
+		break;
+	case GEO_BLOCK_MULTILAYER:
+
+		MultilayerBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY] = -1;
+		break;
+	}
+}
+
+// packs blocks in current layout order, so the blob doesn't depend on the order subblocks were set in,
+// complex blocks with identical subblocks become flat and multilayer blocks without layers become complex
+L2Geodata::GeoRegion* L2Geodata::GeoRegionBuilder::Build(void)
+{
+	const uint32_t BlocksCount = GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS;
+
+	// packed index -> builder (linear) index
+	vector<uint32_t> BlockOrder(BlocksCount);
+	uint32_t CellOrder[GEO_BLOCK_AREA_SIZE];
+
+	for (uint32_t BlockX = 0; BlockX < GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+		for (uint32_t BlockY = 0; BlockY < GEO_REGION_SIZE_IN_BLOCKS; BlockY++)
+			BlockOrder[GetBlockIndex(Layout, BlockX, BlockY)] = BlockX * GEO_REGION_SIZE_IN_BLOCKS + BlockY;
+
+	for (uint32_t SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
+		for (uint32_t SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++)
+			CellOrder[GetCellIndex(Layout, SubBlockX, SubBlockY)] = SubBlockX * GEO_BLOCK_SIZE + SubBlockY;
+
+	GeoBlock* PackedBlocks = new GeoBlock[BlocksCount];
+	vector<int16_t> PackedComplexBlocks;
+	vector<int32_t> PackedMultilayerBlocks;
+	vector<int16_t> PackedLayers;
+
+	for (uint32_t PackedIndex = 0; PackedIndex < BlocksCount; PackedIndex++) {
+
+		GeoBlock Block = Blocks[BlockOrder[PackedIndex]];
+
+		int16_t Cells[GEO_BLOCK_AREA_SIZE];
+		bool HaveLayers = false;
+
+		if (Block.Type == GEO_BLOCK_MULTILAYER) {
+
+			int32_t* LayerIndices = &MultilayerBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE];
+
+			for (uint32_t CellIndex = 0; CellIndex < GEO_BLOCK_AREA_SIZE; CellIndex++) {
+
+				int32_t LayersIndex = LayerIndices[CellIndex];
+
+				if (LayersIndex == -1)
+					Cells[CellIndex] = SPECIAL_SUBBLOCK_EMPTY;
+				else if (Layers[LayersIndex] == 1)
+					Cells[CellIndex] = Layers[LayersIndex + 1];
+				else {
+					Cells[CellIndex] = SPECIAL_SUBBLOCK_MULTILAYER;
+					HaveLayers = true;
+				}
+			}
+
+			if (HaveLayers) {
+
+				if (PackedMultilayerBlocks.size() / GEO_BLOCK_AREA_SIZE > UINT16_MAX)
+					throw new runtime_error("Multilayer block count exceeds the limit");
+
+				PackedBlocks[PackedIndex] = { GEO_BLOCK_MULTILAYER, (int16_t)(PackedMultilayerBlocks.size() / GEO_BLOCK_AREA_SIZE) };
+
+				for (uint32_t PackedCellIndex = 0; PackedCellIndex < GEO_BLOCK_AREA_SIZE; PackedCellIndex++) {
+
+					int32_t LayersIndex = LayerIndices[CellOrder[PackedCellIndex]];
+					if (LayersIndex == -1) {
+						PackedMultilayerBlocks.push_back(-1);
+						continue;
+					}
+
+					PackedMultilayerBlocks.push_back((int32_t)PackedLayers.size());
+					PackedLayers.insert(PackedLayers.end(), &Layers[LayersIndex], &Layers[LayersIndex + 1 + Layers[LayersIndex]]);
+				}
+
+				continue;
+			}
+		}
+		else if (Block.Type == GEO_BLOCK_COMPLEX)
+			memcpy(Cells, &ComplexBlocks[(uint16_t)Block.Data * GEO_BLOCK_AREA_SIZE], sizeof(Cells));
+		else {
+			PackedBlocks[PackedIndex] = Block;
+			continue;
+		}
+
+		bool IsUniform = true;
+		for (uint32_t CellIndex = 1; IsUniform && CellIndex < GEO_BLOCK_AREA_SIZE; CellIndex++)
+			IsUniform = Cells[CellIndex] == Cells[0];
+
+		if (IsUniform && Cells[0] == SPECIAL_SUBBLOCK_EMPTY)
+			PackedBlocks[PackedIndex] = { GEO_BLOCK_EMPTY, 0 };
+		else if (IsUniform)
+			PackedBlocks[PackedIndex] = { GEO_BLOCK_FLAT, Cells[0] };
+		else {
+			if (PackedComplexBlocks.size() / GEO_BLOCK_AREA_SIZE > UINT16_MAX)
+				throw new runtime_error("Complex block count exceeds the limit");
+
+			PackedBlocks[PackedIndex] = { GEO_BLOCK_COMPLEX, (int16_t)(PackedComplexBlocks.size() / GEO_BLOCK_AREA_SIZE) };
+
+			for (uint32_t PackedCellIndex = 0; PackedCellIndex < GEO_BLOCK_AREA_SIZE; PackedCellIndex++)
+				PackedComplexBlocks.push_back(Cells[CellOrder[PackedCellIndex]]);
+		}
+	}
+
+	uint64_t ComplexBlocksOffset = sizeof(GeoRegion);
+	uint64_t MultilayerBlocksOffset = ComplexBlocksOffset + PackedComplexBlocks.size() * sizeof(int16_t);
+	uint64_t LayersOffset = MultilayerBlocksOffset + PackedMultilayerBlocks.size() * sizeof(int32_t);
+	uint64_t Size = LayersOffset + PackedLayers.size() * sizeof(int16_t);
+
+	if (Size > UINT32_MAX)
+		throw new runtime_error("Geo region is too big");
+
+	GeoRegion* Region = (GeoRegion*)AllocateGeoMemory((size_t)Size);
+	if (!Region)
+		throw new runtime_error("Couldn't allocate geo region");
+
+	Region->Size = (uint32_t)Size;
+	Region->ComplexBlocksCount = (uint32_t)(PackedComplexBlocks.size() / GEO_BLOCK_AREA_SIZE);
+	Region->MultilayerBlocksCount = (uint32_t)(PackedMultilayerBlocks.size() / GEO_BLOCK_AREA_SIZE);
+	Region->LayersCount = (uint32_t)PackedLayers.size();
+	Region->ComplexBlocksOffset = (uint32_t)ComplexBlocksOffset;
+	Region->MultilayerBlocksOffset = (uint32_t)MultilayerBlocksOffset;
+	Region->LayersOffset = (uint32_t)LayersOffset;
+	Region->Layout = Layout;
+
+	memcpy(Region->Blocks, PackedBlocks, sizeof(Region->Blocks));
+	memcpy(Region->GetComplexBlocks(), PackedComplexBlocks.data(), PackedComplexBlocks.size() * sizeof(int16_t));
+	memcpy(Region->GetMultilayerBlocks(), PackedMultilayerBlocks.data(), PackedMultilayerBlocks.size() * sizeof(int32_t));
+	memcpy(Region->GetLayers(), PackedLayers.data(), PackedLayers.size() * sizeof(int16_t));
+
+	delete[] PackedBlocks;
+
+	return Region;
+}
+
+// large pages
+
+bool L2Geodata::EnableLargePages(bool Enable)
+{
+	if (!Enable) {
+		UseLargePages = false;
+		return true;
+	}
+
+	if (LargePageSize == 0) {
+
+		SIZE_T MinimumSize = GetLargePageMinimum();
+		if (MinimumSize == 0) {
+			cout << "Large pages aren't supported, using regular pages" << endl;
+			return false;
+		}
+
+		// privilege has to be granted by policy ("Lock pages in memory"), here it's only enabled in the token
+		HANDLE Token;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &Token)) {
+			cout << "Couldn't open process token, using regular pages" << endl;
+			return false;
+		}
+
+		TOKEN_PRIVILEGES Privileges = { };
+		Privileges.PrivilegeCount = 1;
+		Privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+		// AdjustTokenPrivileges succeeds even if privilege wasn't assigned, that is reported through last error
+		bool IsEnabled = 
+			LookupPrivilegeValueW(NULL, SE_LOCK_MEMORY_NAME, &Privileges.Privileges[0].Luid) &&
+			AdjustTokenPrivileges(Token, FALSE, &Privileges, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+
+		CloseHandle(Token);
+
+		if (!IsEnabled) {
+			cout << "SeLockMemoryPrivilege isn't granted, using regular pages" << endl;
+			return false;
+		}
+
+		LargePageSize = MinimumSize;
+	}
+
+	UseLargePages = true;
+
+	cout << "Large pages enabled (" << LargePageSize / 1024 << " KB)" << endl;
+
+	return true;
+}
+
+L2Geodata::LargePageStats L2Geodata::GetLargePageStats(void)
+{
+	lock_guard<mutex> Lock(LargePageBlocksLock);
+
+	LargePageStats Stats = { };
+
+	for (auto& Block : LargePageBlocks)
+		Stats.Size += Block.second;
+
+	Stats.BlocksCount = LargePageBlocks.size();
+	Stats.Fallbacks = LargePageFallbacks;
+
+	return Stats;
+}
+
+void* L2Geodata::AllocateGeoMemory(size_t Size)
+{
+	// smaller block would leave most of the page unused
+	if (UseLargePages && Size >= LargePageSize) {
+
+		SIZE_T LargeSize = (Size + LargePageSize - 1) / LargePageSize * LargePageSize;
+
+		// large pages are committed and locked right away, so there are no page faults later
+		void* Memory = VirtualAlloc(NULL, LargeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (Memory) {
+
+			lock_guard<mutex> Lock(LargePageBlocksLock);
+			LargePageBlocks[Memory] = LargeSize;
+
+			return Memory;
+		}
+
+		// physical memory is too fragmented to get contiguous pages
+		LargePageFallbacks++;
+	}
+
+	return malloc(Size);
+}
+
+void L2Geodata::FreeGeoMemory(void* Memory)
+{
+	if (!Memory)
+		return;
+
+	{
+		lock_guard<mutex> Lock(LargePageBlocksLock);
+
+		auto Block = LargePageBlocks.find(Memory);
+		if (Block != LargePageBlocks.end()) {
+
+			LargePageBlocks.erase(Block);
+			VirtualFree(Memory, 0, MEM_RELEASE);
+
+			return;
+		}
+	}
+
+	free(Memory);
+}
+
+VOID L2Geodata::PrefaultRegionWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	GeoRegion* Region = (GeoRegion*)Context;
+
+	const uint32_t PageSize = 4096;
+
+	volatile uint8_t Sum = 0;
+
+	for (uint32_t Offset = 0; Offset < Region->Size; Offset += PageSize)
+		Sum += ((uint8_t*)Region)[Offset];
+}
+
+void L2Geodata::PrefaultRegions(void)
+{
+	ReaderGuard Guard;
+
+	LONGLONG StartTime = GetTime();
+
+	vector<PTP_WORK> Works;
+	uint64_t Size = 0;
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			GeoRegion* Region = Regions[RegionX][RegionY];
+			if (!Region)
+				continue;
+
+			PTP_WORK Work = CreateThreadpoolWork(PrefaultRegionWorkCallback, (PVOID)Region, NULL);
+			if (Work == NULL)
+				throw new runtime_error("Couldn't create prefault work");
+
+			SubmitThreadpoolWork(Work);
+
+			Works.push_back(Work);
+			Size += Region->Size;
+		}
+
+	for (PTP_WORK Work : Works) {
+		WaitForThreadpoolWorkCallbacks(Work, false);
+		CloseThreadpoolWork(Work);
+	}
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Geo prefaulted for " << TimeToMs(EndTime - StartTime) << " ms (" << Works.size() << " regions, " << Size / (1024 * 1024) << " MB)" << endl;
+}
+
+VOID L2Geodata::ParallelWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	ParallelTask* Task = (ParallelTask*)Context;
+
+	// nothing may leave a thread pool callback
+	try {
+		(*Task->Work)(Task->Index);
+	}
+	catch (runtime_error* Error) {
+		Task->Error = Error;
+	}
+	catch (exception& Error) {
+		Task->Error = new runtime_error(Error.what());
+	}
+}
+
+void L2Geodata::RunParallel(uint32_t Count, const function<void(uint32_t Index)>& Work)
+{
+	vector<ParallelTask> Tasks(Count);
+	vector<PTP_WORK> Works;
+	Works.reserve(Count);
+
+	runtime_error* Error = nullptr;
+
+	for (uint32_t Index = 0; Index < Count; Index++) {
+
+		Tasks[Index] = { &Work, Index, nullptr };
+
+		PTP_WORK ThreadpoolWork = CreateThreadpoolWork(ParallelWorkCallback, (PVOID)&Tasks[Index], NULL);
+		if (ThreadpoolWork == NULL) {
+			// works that are already submitted still use Tasks, so they have to finish before we leave
+			Error = new runtime_error("Couldn't create parallel work");
+			break;
+		}
+
+		SubmitThreadpoolWork(ThreadpoolWork);
+
+		Works.push_back(ThreadpoolWork);
+	}
+
+	for (PTP_WORK ThreadpoolWork : Works) {
+		WaitForThreadpoolWorkCallbacks(ThreadpoolWork, false);
+		CloseThreadpoolWork(ThreadpoolWork);
+	}
+
+	for (ParallelTask& Task : Tasks)
+		if (Task.Error) {
+			if (!Error)
+				Error = Task.Error;
+			else
+				delete Task.Error;
+		}
+
+	if (Error)
+		throw Error;
+}
+
+// alloc
+
+void L2Geodata::AllocateData(void) {
+
+	if (((SPECIAL_SUBBLOCK_EMPTY >> 8) & 0xFF) != (SPECIAL_SUBBLOCK_EMPTY & 0xFF))
+		throw new runtime_error("Invalid empty block special value");
+
+	if (sizeof(GeoRegion) % sizeof(int32_t) != 0)
+		throw new runtime_error("Invalid geo region header size");
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+			Regions[RegionX][RegionY] = nullptr;
+}
+
+// expects that there are no readers left
+void L2Geodata::ReleaseData(void) {
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			FreeRegion(Regions[RegionX][RegionY].exchange(nullptr));
+
+			SetRegionSource(RegionX, RegionY, { });
+		}
+
+	LazyLoading = false;
+	PagedSize = 0;
+
+	ReclaimRegions();
+
+	UnmapEasyGeo();
+}
+
+bool L2Geodata::IsMappedRegion(GeoRegion *Region) {
+
+	return EasyGeoView && (uint8_t*)Region >= EasyGeoView && (uint8_t*)Region < EasyGeoView + EasyGeoViewSize;
+}
+
+void L2Geodata::FreeRegion(GeoRegion *Region) {
+
+	if (Region && !IsMappedRegion(Region))
+		FreeGeoMemory(Region);
+}
+
+void L2Geodata::SetRegion(uint32_t RegionX, uint32_t RegionY, GeoRegion *Region) {
+
+	if (Regions[RegionX][RegionY])
+		throw new runtime_error("Region is already loaded");
+
+	Regions[RegionX][RegionY] = Region;
+}
+
+bool L2Geodata::IsValidRegion(GeoRegion *Region, uint64_t MaxSize) {
+
+	if (MaxSize < sizeof(GeoRegion) || Region->Size < sizeof(GeoRegion) || Region->Size > MaxSize || Region->Layout > GEO_LAYOUT_MORTON)
+		return false;
+
+	uint64_t ComplexBlocksEnd = Region->ComplexBlocksOffset + (uint64_t)Region->ComplexBlocksCount * sizeof(ComplexBlock);
+	uint64_t MultilayerBlocksEnd = Region->MultilayerBlocksOffset + (uint64_t)Region->MultilayerBlocksCount * sizeof(MultilayerBlock);
+	uint64_t LayersEnd = Region->LayersOffset + (uint64_t)Region->LayersCount * sizeof(int16_t);
+
+	if (Region->ComplexBlocksOffset < sizeof(GeoRegion) || ComplexBlocksEnd > Region->Size ||
+		Region->MultilayerBlocksOffset < sizeof(GeoRegion) || MultilayerBlocksEnd > Region->Size || Region->MultilayerBlocksOffset % sizeof(int32_t) != 0 ||
+		Region->LayersOffset < sizeof(GeoRegion) || LayersEnd > Region->Size)
+		return false;
+
+	// block table itself isn't walked here, it would page in every mapped region on load, see IsValidBlockTable
+	return true;
+}
+
+bool L2Geodata::IsValidBlockTable(GeoRegion *Region) {
+
+	MultilayerBlock* MultilayerBlocks = Region->GetMultilayerBlocks();
+	int16_t* Layers = Region->GetLayers();
+
+	for (GeoBlock& Block : Region->Blocks) {
+
+		switch (Block.Type) {
+		case GEO_BLOCK_EMPTY:
+		case GEO_BLOCK_FLAT:
+
+			break;
+		case GEO_BLOCK_COMPLEX:
+
+			if ((uint16_t)Block.Data >= Region->ComplexBlocksCount)
+				return false;
+
+			break;
+		case GEO_BLOCK_MULTILAYER: {
+
+			if ((uint16_t)Block.Data >= Region->MultilayerBlocksCount)
+				return false;
+
+			int32_t* LayerIndices = (int32_t*)MultilayerBlocks[(uint16_t)Block.Data];
+
+			// every subblock is -1 or index of layers count followed by that many layers
+			for (uint32_t CellIndex = 0; CellIndex < GEO_BLOCK_AREA_SIZE; CellIndex++) {
+
+				int32_t LayersIndex = LayerIndices[CellIndex];
+				if (LayersIndex == -1)
+					continue;
+
+				if (LayersIndex < 0 || (uint32_t)LayersIndex >= Region->LayersCount ||
+					Layers[LayersIndex] < 1 || Layers[LayersIndex] > LAYERS_PER_SUBBLOCK_LIMIT ||
+					(uint64_t)LayersIndex + 1 + Layers[LayersIndex] > Region->LayersCount)
+					return false;
+			}
+
+			break;
+		}
+		default:
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+uint32_t L2Geodata::GetLoadedRegionsCount(void)
+{
+	uint32_t Count = 0;
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+			if (Regions[RegionX][RegionY])
+				Count++;
+
+	return Count;
+}
+
+uint64_t L2Geodata::GetResidentSize(void)
+{
+	ReaderGuard Guard;
+
+	uint64_t Size = 0;
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			GeoRegion* Region = Regions[RegionX][RegionY];
+			if (Region)
+				Size += Region->Size;
+
+			if (NWC_Regions[RegionX][RegionY])
+				Size += sizeof(NWCRegion);
+		}
+
+	Size += sizeof(*NWC_MultilayerSubblockMap) * (uint64_t)NWC_NextMultilayerBlockMapIndex;
+	Size += sizeof(*NWC_LayersTable) * (uint64_t)NWC_NextLayersTableIndex;
+
+	return Size;
+}
+
+// epochs
+
+void L2Geodata::EnterReader(void)
+{
+	if (ReaderDepth++ > 0)
+		return;
+
+	uint64_t Epoch = GlobalEpoch.load();
+
+	for (uint32_t Slot = GetCurrentThreadId() % READER_SLOTS_COUNT; ; Slot = (Slot + 1) % READER_SLOTS_COUNT) {
+
+		uint64_t FreeSlot = 0;
+
+		if (ReaderEpochs[Slot].compare_exchange_strong(FreeSlot, Epoch)) {
+			ReaderSlot = Slot;
+			return;
+		}
+	}
+}
+
+void L2Geodata::LeaveReader(void)
+{
+	if (--ReaderDepth > 0)
+		return;
+
+	ReaderEpochs[ReaderSlot].store(0, memory_order_release);
+}
+
+// region must be already unlinked, readers that entered before that might still use it
+void L2Geodata::RetireRegion(GeoRegion* Region)
+{
+	if (!Region || IsMappedRegion(Region))
+		return;
+
+	{
+		lock_guard<mutex> Lock(RetiredRegionsLock);
+
+		RetiredRegions.push_back({ Region, GlobalEpoch.fetch_add(1) });
+	}
+
+	ReclaimRegions();
+}
+
+void L2Geodata::ReplaceRegion(uint32_t RegionX, uint32_t RegionY, GeoRegion* Region)
+{
+	ReloadVersion++;
+
+	// cells may have other layers now, so weights of the old region can't be used for them,
+	// flag goes first so nobody gets new layers with old weights
+	NWC_StaleRegions[RegionX][RegionY] = true;
+
+	// same for pyramid and walkable summary, skipping by maxima of the old content would see through new geometry
+	// and summary would skip cells that are walkable now
+	L2GeodataRaycast::FreePyramid(RegionX, RegionY);
+	L2GeodataSpatial::FreeSummary(RegionX, RegionY);
+
+	GeoRegion* OldRegion = Regions[RegionX][RegionY].exchange(Region);
+
+	ReloadVersion++;
+
+	RetireRegion(OldRegion);
+}
+
+void L2Geodata::ReclaimRegions(void)
+{
+	lock_guard<mutex> Lock(RetiredRegionsLock);
+
+	uint64_t MinEpoch = UINT64_MAX;
+
+	for (uint32_t Slot = 0; Slot < READER_SLOTS_COUNT; Slot++) {
+
+		uint64_t Epoch = ReaderEpochs[Slot].load();
+		if (Epoch != 0 && Epoch < MinEpoch)
+			MinEpoch = Epoch;
+	}
+
+	auto Reclaimed = remove_if(RetiredRegions.begin(), RetiredRegions.end(), [MinEpoch](RetiredRegion& Retired) {
+		if (Retired.Epoch >= MinEpoch)
+			return false;
+
+		FreeRegion(Retired.Region);
+		return true;
+	});
+
+	RetiredRegions.erase(Reclaimed, RetiredRegions.end());
+
+	auto ReclaimedMemory = remove_if(RetiredMemoryBlocks.begin(), RetiredMemoryBlocks.end(), [MinEpoch](RetiredMemory& Retired) {
+		if (Retired.Epoch >= MinEpoch)
+			return false;
+
+		free(Retired.Memory);
+		return true;
+	});
+
+	RetiredMemoryBlocks.erase(ReclaimedMemory, RetiredMemoryBlocks.end());
+}
+
+void L2Geodata::RetireMemory(void* Memory)
+{
+	if (!Memory)
+		return;
+
+	{
+		lock_guard<mutex> Lock(RetiredRegionsLock);
+
+		RetiredMemoryBlocks.push_back({ Memory, GlobalEpoch.fetch_add(1) });
+	}
+
+	ReclaimRegions();
+}
+
+void L2Geodata::SetWorldOverlay(L2GeodataOverlay* Overlay)
+{
+	WorldOverlay.store(Overlay, memory_order_release);
+}
+
+// lazy paging
+
+inline L2Geodata::GeoRegion *L2Geodata::AcquireLazyRegion(uint32_t RegionX, uint32_t RegionY, GeoRegion *Region)
+{
+	if (Region) {
+		if (++LocalPagingHits == PAGING_HITS_BATCH) {
+			PagingHits.fetch_add(PAGING_HITS_BATCH, memory_order_relaxed);
+			LocalPagingHits = 0;
+		}
+
+		// clock ticks only when a region is paged in, that's the only time eviction order matters, so access
+		// is stored once per tick and region instead of on every lookup
+		uint64_t Tick = AccessClock.load(memory_order_relaxed);
+		if (RegionLastAccess[RegionX][RegionY].load(memory_order_relaxed) != Tick)
+			RegionLastAccess[RegionX][RegionY].store(Tick, memory_order_relaxed);
+
+		return Region;
+	}
+
+	if (!HasRegionSource[RegionX][RegionY])
+		return nullptr;
+
+	return PageInRegion(RegionX, RegionY);
+}
+
+void L2Geodata::SetRegionSource(uint32_t RegionX, uint32_t RegionY, const RegionSource& Source)
+{
+	RegionSources[RegionX][RegionY] = Source;
+	HasRegionSource[RegionX][RegionY] = !Source.FilePath.empty();
+}
+
+L2Geodata::GeoRegion *L2Geodata::PageInRegion(uint32_t RegionX, uint32_t RegionY)
+{
+	RegionSource Source;
+
+	{
+		lock_guard<mutex> Lock(RegionsLock);
+
+		// someone could page it in while we were waiting
+		GeoRegion* Region = Regions[RegionX][RegionY];
+		if (Region) {
+			PagingHits++;
+			return Region;
+		}
+
+		if (!HasRegionSource[RegionX][RegionY])
+			return nullptr;
+
+		Source = RegionSources[RegionX][RegionY];
+	}
+
+	// file is read without the lock, so other page-ins, reloads and edits don't wait for this disk read
+	GeoRegion* Region = ReadRegion(Source);
+
+	lock_guard<mutex> Lock(RegionsLock);
+
+	// region could be paged in by another thread, reloaded or edited meanwhile, then ours is not needed
+	GeoRegion* CurrentRegion = Regions[RegionX][RegionY];
+	RegionSource& CurrentSource = RegionSources[RegionX][RegionY];
+
+	if (CurrentRegion || CurrentSource.FilePath != Source.FilePath || CurrentSource.Type != Source.Type ||
+		CurrentSource.Offset != Source.Offset) {
+
+		FreeRegion(Region);
+
+		if (CurrentRegion)
+			PagingHits++;
+
+		return CurrentRegion;
+	}
+
+	PagingMisses++;
+
+	PagedSize += Region->Size;
+	RegionLastAccess[RegionX][RegionY] = AccessClock.fetch_add(1);
+
+	Regions[RegionX][RegionY] = Region;
+
+	EvictRegions(RegionX, RegionY);
+
+	return Region;
+}
+
+L2Geodata::GeoRegion *L2Geodata::ReadRegion(RegionSource& Source)
+{
+	if (Source.Type == INTERNAL) {
+
+		ifstream Stream(Source.FilePath, ios::binary);
+
+		GeoRegion Header;
+
+		Stream.seekg(Source.Offset, ios_base::beg);
+		Stream.read((char *)&Header, sizeof(Header));
+
+		if (Stream.fail() || Header.Size < sizeof(GeoRegion))
+			throw new runtime_error("Couldn't read easygeo region");
+
+		GeoRegion* Region = (GeoRegion*)AllocateGeoMemory(Header.Size);
+		if (!Region)
+			throw new runtime_error("Couldn't allocate geo region");
+
+		memcpy(Region, &Header, sizeof(Header));
+		Stream.read((char *)Region + sizeof(Header), Header.Size - sizeof(Header));
+
+		if (Stream.fail() || !IsValidRegion(Region, Header.Size) || !IsValidBlockTable(Region)) {
+			FreeGeoMemory(Region);
+			throw new runtime_error("Couldn't read easygeo region");
+		}
+
+		if (Region->Layout != Layout) {
+
+			GeoRegionBuilder* Builder = new GeoRegionBuilder(Region);
+			FreeGeoMemory(Region);
+
+			Region = Builder->Build();
+			delete Builder;
+		}
+
+		return Region;
+	}
+
+	GeoRegionBuilder* Builder = new GeoRegionBuilder();
+	GeoLoadStats Stats = { };
+
+	bool Loaded = LoadRegion(*Builder, Source.FilePath, Source.Type, Stats);
+
+	GeoRegion* Region = Loaded ? Builder->Build() : nullptr;
+
+	delete Builder;
+
+	if (!Loaded)
+		throw new runtime_error("Coudn't load geo file");
+
+	return Region;
+}
+
+// evicts least recently used regions until paged size fits the budget
+void L2Geodata::EvictRegions(uint32_t KeepRegionX, uint32_t KeepRegionY)
+{
+	while (PagedSize > PagingMemoryBudget) {
+
+		uint32_t VictimX = 0, VictimY = 0;
+		uint64_t VictimAccess = UINT64_MAX;
+
+		for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+			for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+				if ((RegionX == KeepRegionX && RegionY == KeepRegionY) || !HasRegionSource[RegionX][RegionY] ||
+					Regions[RegionX][RegionY] == nullptr)
+					continue;
+
+				uint64_t Access = RegionLastAccess[RegionX][RegionY];
+				if (Access < VictimAccess) {
+					VictimX = RegionX;
+					VictimY = RegionY;
+					VictimAccess = Access;
+				}
+			}
+
+		if (VictimAccess == UINT64_MAX)
+			break;
+
+		GeoRegion* Region = Regions[VictimX][VictimY].exchange(nullptr);
+
+		PagedSize -= Region->Size;
+		PagingEvictions++;
+
+		RetireRegion(Region);
+	}
+}
+
+bool L2Geodata::IsRegionPresent(uint32_t RegionX, uint32_t RegionY)
+{
+	return Regions[RegionX][RegionY] != nullptr || HasRegionSource[RegionX][RegionY];
+}
+
+void L2Geodata::SetupLazyLoading(wstring Directory, GeoType Type, uint64_t MemoryBudget)
+{
+	ReleaseData();
+
+	uint32_t RegionsCount = 0;
+
+	for (directory_entry p : directory_iterator(Directory)) {
+
+		path path = p.path();
+
+		uint32_t RegionX, RegionY;
+		if (!GetRegionFileCoords(path.filename().replace_extension("").wstring(), RegionX, RegionY))
+			continue;
+
+		SetRegionSource(RegionX, RegionY, { path.wstring(), Type, 0 });
+		RegionsCount++;
+	}
+
+	PagingMemoryBudget = MemoryBudget;
+	PagingHits = PagingMisses = PagingEvictions = 0;
+
+	LazyLoading = true;
+
+	cout << "Lazy loading is set up for " << RegionsCount << " regions, budget " << MemoryBudget / (1024 * 1024) << " MB" << endl;
+}
+
+void L2Geodata::SetupLazyEasyGeo(wstring FilePath, uint64_t MemoryBudget)
+{
+	ReleaseData();
+
+	ifstream Stream(FilePath, ios::binary | ios::ate);
+
+	uint64_t FileSize = (uint64_t)Stream.tellg();
+	Stream.seekg(0, ios_base::beg);
+
+	EasyGeoHeader Header;
+	Stream.read((char *)&Header, sizeof(Header));
+
+	EasyGeoSection& DirectorySection = Header.Sections[EASYGEO_SECTION_REGION_DIRECTORY];
+
+	if (Stream.fail() || Header.Magic != EASYGEO_MAGIC || Header.Version != EASYGEO_VERSION || Header.HeaderSize != sizeof(EasyGeoHeader) ||
+		Header.SectionCount != EASYGEO_SECTION_COUNT || DirectorySection.Size != sizeof(uint64_t) * GEO_REGIONS_COUNT ||
+		DirectorySection.Offset + DirectorySection.Size > FileSize)
+		throw new runtime_error("Invalid easygeo header");
+
+	vector<uint64_t> RegionOffsets(GEO_REGIONS_COUNT);
+
+	Stream.seekg(DirectorySection.Offset, ios_base::beg);
+	Stream.read((char *)RegionOffsets.data(), DirectorySection.Size);
+
+	if (Stream.fail())
+		throw new runtime_error("Couldn't read easygeo region directory");
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			uint64_t RegionOffset = RegionOffsets[RegionX * GEO_HEIGHT_IN_REGIONS + RegionY];
+			if (RegionOffset == 0)
+				continue;
+
+			if (RegionOffset + sizeof(GeoRegion) > FileSize)
+				throw new runtime_error("Invalid easygeo region directory");
+
+			SetRegionSource(RegionX, RegionY, { FilePath, INTERNAL, RegionOffset });
+		}
+
+	PagingMemoryBudget = MemoryBudget;
+	PagingHits = PagingMisses = PagingEvictions = 0;
+
+	LazyLoading = true;
+
+	cout << "Lazy easy geo is set up, budget " << MemoryBudget / (1024 * 1024) << " MB" << endl;
+}
+
+L2Geodata::PagingStats L2Geodata::GetPagingStats(void)
+{
+	return { PagingHits, PagingMisses, PagingEvictions, PagedSize };
+}
+
+// loading
+
+#define PTS_BLOCK_FLAT 0
+#define PTS_BLOCK_COMPLEX 0x40
+
+bool L2Geodata::LoadRegion(GeoRegionBuilder& Builder, wstring FilePath, GeoType Type, GeoLoadStats& Stats) {
+
+	if (Type == PTS) {
+
+		ifstream Stream(FilePath, ios::binary | ios::ate);
+		if (!Stream.is_open())
+			return false;
+
+		streamsize size = Stream.tellg();
+		if (size <= 18)
+			return false;
+
+		size -= 18;
+
+		vector<int16_t> buffer(size / sizeof(int16_t));
+
+		if (!Stream.seekg(18, ios_base::beg) || !Stream.read((char *)buffer.data(), size))
+			return false;
+
+		int32_t position = 0;
+
+		for (int BlockX = 0; BlockX < GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+			for (int BlockY = 0; BlockY < GEO_REGION_SIZE_IN_BLOCKS; BlockY++) {
+
+				int16_t SubBlockCount = buffer[position++];
+
+				int16_t SubBlock;
+
+				switch (SubBlockCount) {
+				case PTS_BLOCK_FLAT:
+
+					// skip max height (unused)
+					position++;
+
+					SubBlock = buffer[position++];
+					SubBlock = ((SubBlock << 1) & 0xFFF0) | NSWE_ALL;
+
+					Builder.SetFlatBlock(BlockX, BlockY, SubBlock);
+
+					break;
+				case PTS_BLOCK_COMPLEX:
+
+					for (int SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++) 
+						for (int SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++) {
+
+							SubBlock = buffer[position++];
+
+							Builder.SetSubBlock(BlockX, BlockY, SubBlockX, SubBlockY, SubBlock);
+						}
+
+					break;
+				default:
+
+					if (SubBlockCount <= PTS_BLOCK_COMPLEX)
+						return false;
+
+					Stats.MultilayerBlockCount++;
+
+					int SubBlockCount = 0;
+
+					for (int SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
+						for (int SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++) {
+
+							int16_t LayersCount = buffer[position++];
+
+							if (LayersCount > 1) {
+
+								Builder.SetLayers(BlockX, BlockY, SubBlockX, SubBlockY, LayersCount, &buffer[position]);
+								position += LayersCount;
+
+								Stats.LayersCount += LayersCount;
+								Stats.MultilayerSubBlockCount++;
+
+								if (LayersCount > Stats.MaxLayersCountPerSubBlock)
+									Stats.MaxLayersCountPerSubBlock = LayersCount;
+							}
+							else {
+								SubBlock = buffer[position++];
+
+								Builder.SetSubBlock(BlockX, BlockY, SubBlockX, SubBlockY, SubBlock);
+							}
+
+							SubBlockCount += LayersCount;
+						}
+
+					if (SubBlockCount != SubBlockCount)
+						return false;
+
+					break;
+				}
+			}
+
+		if (position != buffer.size())
+			return false;
+	}
+	else if (Type == L2J)
+		return LoadL2JRegion(Builder, FilePath, Stats);
+	else
+		return false;
+
+	return true;
+}
+
+#define L2J_BLOCK_FLAT 0
+#define L2J_BLOCK_COMPLEX 1
+#define L2J_BLOCK_MULTILAYER 2
+
+L2Geodata::GeoFileReader::GeoFileReader(wstring FilePath) : Stream(FilePath, ios::binary)
+{
+	ChunkPosition = 0;
+	ChunkSize = 0;
+}
+
+bool L2Geodata::GeoFileReader::IsOpen(void)
+{
+	return Stream.is_open();
+}
+
+bool L2Geodata::GeoFileReader::IsEOF(void)
+{
+	return ChunkPosition == ChunkSize && Stream.peek() == char_traits<char>::eof();
+}
+
+bool L2Geodata::GeoFileReader::Read(void* Data, uint32_t Size)
+{
+	uint8_t* Dest = (uint8_t*)Data;
+
+	while (Size > 0) {
+
+		if (ChunkPosition == ChunkSize) {
+
+			Stream.read((char *)Chunk, CHUNK_SIZE);
+
+			ChunkPosition = 0;
+			ChunkSize = (uint32_t)Stream.gcount();
+
+			if (ChunkSize == 0)
+				return false;
+		}
+
+		uint32_t ReadSize = min(Size, ChunkSize - ChunkPosition);
+
+		memcpy(Dest, &Chunk[ChunkPosition], ReadSize);
+
+		ChunkPosition += ReadSize;
+		Dest += ReadSize;
+		Size -= ReadSize;
+	}
+
+	return true;
+}
+
+// L2J region is 256x256 blocks, each block starts with type byte:
+// flat - single height, complex - 8x8 subblocks, multilayer - layers count byte and layers for every subblock
+bool L2Geodata::LoadL2JRegion(GeoRegionBuilder& Builder, wstring FilePath, GeoLoadStats& Stats) {
+
+	GeoFileReader* Reader = new GeoFileReader(FilePath);
+	if (!Reader->IsOpen()) {
+		delete Reader;
+		return false;
+	}
+
+	bool Loaded = true;
+
+	for (uint32_t BlockX = 0; Loaded && BlockX < GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+		for (uint32_t BlockY = 0; Loaded && BlockY < GEO_REGION_SIZE_IN_BLOCKS; BlockY++) {
+
+			uint8_t BlockType;
+			if (!Reader->Read(BlockType)) {
+				Loaded = false;
+				break;
+			}
+
+			int16_t SubBlock;
+
+			switch (BlockType) {
+			case L2J_BLOCK_FLAT:
+
+				if (!Reader->Read(SubBlock)) {
+					Loaded = false;
+					break;
+				}
+
+				SubBlock = ((SubBlock << 1) & 0xFFF0) | NSWE_ALL;
+
+				Builder.SetFlatBlock(BlockX, BlockY, SubBlock);
+
+				break;
+			case L2J_BLOCK_COMPLEX: {
+
+				int16_t SubBlocks[GEO_BLOCK_AREA_SIZE];
+				if (!Reader->Read(SubBlocks)) {
+					Loaded = false;
+					break;
+				}
+
+				for (uint32_t SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
+					for (uint32_t SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++)
+						Builder.SetSubBlock(BlockX, BlockY, SubBlockX, SubBlockY, SubBlocks[SubBlockX * GEO_BLOCK_SIZE + SubBlockY]);
+
+				break;
+			}
+			case L2J_BLOCK_MULTILAYER:
+
+				Stats.MultilayerBlockCount++;
+
+				for (uint32_t SubBlockX = 0; Loaded && SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
+					for (uint32_t SubBlockY = 0; Loaded && SubBlockY < GEO_BLOCK_SIZE; SubBlockY++) {
+
+						uint8_t LayersCount;
+						int16_t Layers[LAYERS_PER_SUBBLOCK_LIMIT];
+
+						if (!Reader->Read(LayersCount) || LayersCount > LAYERS_PER_SUBBLOCK_LIMIT || 
+							!Reader->Read(Layers, LayersCount * sizeof(int16_t))) {
+							Loaded = false;
+							break;
+						}
+
+						if (LayersCount == 0)
+							continue;
+
+						if (LayersCount == 1) {
+							Builder.SetSubBlock(BlockX, BlockY, SubBlockX, SubBlockY, Layers[0]);
+							continue;
+						}
+
+						// L2J doesn't guarantee layers order
+						sort(Layers, Layers + LayersCount, [](int16_t A, int16_t B) {
+							return GET_GEO_HEIGHT(A) > GET_GEO_HEIGHT(B);
+						});
+
+						Builder.SetLayers(BlockX, BlockY, SubBlockX, SubBlockY, LayersCount, Layers);
+
+						Stats.LayersCount += LayersCount;
+						Stats.MultilayerSubBlockCount++;
+
+						if (LayersCount > Stats.MaxLayersCountPerSubBlock)
+							Stats.MaxLayersCountPerSubBlock = LayersCount;
+					}
+
+				break;
+			default:
+
+				Loaded = false;
+				break;
+			}
+		}
+
+	if (Loaded && !Reader->IsEOF())
+		Loaded = false;
+
+	delete Reader;
+
+	return Loaded;
+}
+
+bool L2Geodata::LoadRegion(uint32_t RegionX, uint32_t RegionY, wstring FilePath, GeoType Type) {
+
+	RegionX -= GEO_X_FIRST;
+	RegionY -= GEO_Y_FIRST;
+
+	if (RegionX >= GEO_WIDTH_IN_REGIONS || RegionY >= GEO_HEIGHT_IN_REGIONS)
+		return false;
+
+	GeoRegionBuilder* Builder = new GeoRegionBuilder();
+	GeoLoadStats Stats = { };
+
+	bool Loaded = LoadRegion(*Builder, FilePath, Type, Stats);
+	if (Loaded)
+		SetRegion(RegionX, RegionY, Builder->Build());
+
+	delete Builder;
+
+	return Loaded;
+}
+
+void L2Geodata::Init(GeoLayout Layout)
+{
+	L2Geodata::Layout = Layout;
+
+	AllocateData();
+	AllocateNWCData();
+}
+
+void L2Geodata::Unload(void)
+{
+	ReleaseData();
+	ReleaseNWCData();
+}
+
+void L2Geodata::SetLayout(GeoLayout Layout)
+{
+	if (Layout == L2Geodata::Layout)
+		return;
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+			if (IsRegionPresent(RegionX, RegionY) || NWC_Regions[RegionX][RegionY])
+				throw new runtime_error("Layout can't be changed while geodata is loaded");
+
+	L2Geodata::Layout = Layout;
+}
+
+GeoLayout L2Geodata::GetLayout(void)
+{
+	return Layout;
+}
+
+VOID L2Geodata::LoadRegionWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	GeoLoadTask* Task = (GeoLoadTask*)Context;
+
+	LONGLONG StartTime = GetTime();
+
+	GeoRegionBuilder* Builder = new GeoRegionBuilder();
+
+	try {
+		Task->Loaded = LoadRegion(*Builder, Task->FilePath, Task->Type, Task->Stats);
+		if (Task->Loaded)
+			Task->Region = Builder->Build();
+	}
+	catch (runtime_error* Error) {
+		Task->Error = Error;
+	}
+
+	delete Builder;
+
+	LONGLONG EndTime = GetTime();
+
+	Task->ParseTime = EndTime - StartTime;
+}
+
+// file name is "X_Y", returns region coords relative to the first region
+bool L2Geodata::GetRegionFileCoords(wstring FileName, uint32_t& RegionX, uint32_t& RegionY) {
+
+	unsigned int regionX, regionY;
+
+	const wchar_t *str = FileName.c_str();
+	wchar_t *end;
+
+	errno = 0;
+
+	regionX = wcstol(str, &end, 10);
+	if (str == end || errno == ERANGE || *end != '_')
+		return false;
+
+	str = end + 1;
+	regionY = wcstol(str, &end, 10);
+	if (str == end || errno == ERANGE)
+		return false;
+
+	if (regionX - GEO_X_FIRST >= GEO_WIDTH_IN_REGIONS || regionY - GEO_Y_FIRST >= GEO_HEIGHT_IN_REGIONS)
+		throw new runtime_error("Invalid geo file region");
+
+	RegionX = regionX - GEO_X_FIRST;
+	RegionY = regionY - GEO_Y_FIRST;
+
+	return true;
+}
+
+void L2Geodata::ReloadRegion(wstring FilePath, GeoType Type) {
+
+	LONGLONG StartTime = GetTime();
+
+	uint32_t RegionX, RegionY;
+	if (!GetRegionFileCoords(path(FilePath).filename().replace_extension("").wstring(), RegionX, RegionY))
+		throw new runtime_error("Invalid geo file name");
+
+	RegionSource Source = { FilePath, Type, 0 };
+
+	GeoRegion* Region = ReadRegion(Source);
+
+	{
+		lock_guard<mutex> Lock(RegionsLock);
+
+		GeoRegion* OldRegion = Regions[RegionX][RegionY];
+
+		if (LazyLoading) {
+
+			// file that was paged from might be stale now, so region pages from the new file from now on
+			if (OldRegion && HasRegionSource[RegionX][RegionY])
+				PagedSize -= OldRegion->Size;
+
+			SetRegionSource(RegionX, RegionY, Source);
+
+			PagedSize += Region->Size;
+			RegionLastAccess[RegionX][RegionY] = AccessClock.fetch_add(1);
+		}
+
+		ReplaceRegion(RegionX, RegionY, Region);
+
+		if (LazyLoading)
+			EvictRegions(RegionX, RegionY);
+	}
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Region " << RegionX + GEO_X_FIRST << "_" << RegionY + GEO_Y_FIRST << " reloaded for " << TimeToMs(EndTime - StartTime) << " ms" << endl;
+}
+
+void L2Geodata::Load(wstring Directory, GeoType Type) {
+
+	LONGLONG StartTime = GetTime();
+
+	vector<GeoLoadTask> Tasks;
+
+	for (directory_entry p : directory_iterator(Directory)) {
+
+		path path = p.path();
+
+		uint32_t RegionX, RegionY;
+		if (!GetRegionFileCoords(path.filename().replace_extension("").wstring(), RegionX, RegionY))
+			continue;
+
+		GeoLoadTask Task = { };
+		Task.RegionX = RegionX;
+		Task.RegionY = RegionY;
+		Task.FilePath = path.wstring();
+		Task.Type = Type;
+		Task.FileSize = file_size(path);
+
+		Tasks.push_back(Task);
+	}
+
+	// directory order is up to the file system, publishing order shouldn't be
+	sort(Tasks.begin(), Tasks.end(), [](const GeoLoadTask& A, const GeoLoadTask& B) {
+		return A.RegionX != B.RegionX ? A.RegionX < B.RegionX : A.RegionY < B.RegionY;
+	});
+
+	vector<PTP_WORK> Works;
+	Works.reserve(Tasks.size());
+
+	runtime_error* Error = nullptr;
+
+	for (size_t TaskIndex = 0; TaskIndex < Tasks.size(); TaskIndex++) {
+
+		PTP_WORK Work = CreateThreadpoolWork(LoadRegionWorkCallback, (PVOID)&Tasks[TaskIndex], NULL);
+		if (Work == NULL) {
+			// works that are already submitted still use Tasks, so they have to finish before we leave
+			Error = new runtime_error("Couldn't create region load work");
+			break;
+		}
+
+		SubmitThreadpoolWork(Work);
+
+		Works.push_back(Work);
+	}
+
+	for (PTP_WORK Work : Works) {
+		WaitForThreadpoolWorkCallbacks(Work, false);
+		CloseThreadpoolWork(Work);
+	}
+
+	// check every task before publishing anything, failed load shouldn't leave a half-loaded world
+	for (GeoLoadTask& Task : Tasks)
+		if (Task.Error || !Task.Loaded) {
+			if (!Error)
+				Error = Task.Error ? Task.Error : new runtime_error("Coudn't load geo file");
+			else
+				delete Task.Error;
+		}
+
+	if (Error) {
+		for (GeoLoadTask& Task : Tasks)
+			if (Task.Loaded && !Task.Error)
+				FreeRegion(Task.Region);
+
+		throw Error;
+	}
+
+	GeoLoadStats Stats = { };
+	uint64_t TotalFileSize = 0;
+
+	for (GeoLoadTask& Task : Tasks) {
+
+		SetRegion(Task.RegionX, Task.RegionY, Task.Region);
+
+		cout << "Region " << Task.RegionX + GEO_X_FIRST << "_" << Task.RegionY + GEO_Y_FIRST << " parsed for " << TimeToMs(Task.ParseTime) << " ms (" << 
+			Task.FileSize / 1024 << " KB)" << endl;
+
+		Stats.LayersCount += Task.Stats.LayersCount;
+		Stats.MultilayerSubBlockCount += Task.Stats.MultilayerSubBlockCount;
+		Stats.MultilayerBlockCount += Task.Stats.MultilayerBlockCount;
+		Stats.MaxLayersCountPerSubBlock = max(Stats.MaxLayersCountPerSubBlock, Task.Stats.MaxLayersCountPerSubBlock);
+
+		TotalFileSize += Task.FileSize;
+	}
+
+	LONGLONG EndTime = GetTime();
+
+	LONG LoadTime = TimeToMs(EndTime - StartTime);
+
+	cout << "Geo loaded for " << LoadTime << " ms (" << Tasks.size() << " files, " << 
+		(LoadTime > 0 ? TotalFileSize / (1024.0 * 1024.0) / (LoadTime / 1000.0) : 0.0) << " MB/s)" << endl;
+
+	cout << "Layers count: " << Stats.LayersCount << endl;
+	cout << "Layers subblock count: " << Stats.MultilayerSubBlockCount << endl;
+	cout << "Max layer count per subblock: " << Stats.MaxLayersCountPerSubBlock << endl;
+	cout << "Multilayer block count: " << Stats.MultilayerBlockCount << endl;
+
+	ReaderGuard Guard;
+
+	uint64_t BlockTypeCounts[GEO_BLOCK_MULTILAYER + 1] = { };
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			GeoRegion* Region = Regions[RegionX][RegionY];
+			if (!Region)
+				continue;
+
+			for (uint32_t BlockIndex = 0; BlockIndex < GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS; BlockIndex++)
+				BlockTypeCounts[Region->Blocks[BlockIndex].Type]++;
+		}
+
+	cout << "Blocks (empty / flat / complex / multilayer): " << BlockTypeCounts[GEO_BLOCK_EMPTY] << " / " << BlockTypeCounts[GEO_BLOCK_FLAT] << 
+		" / " << BlockTypeCounts[GEO_BLOCK_COMPLEX] << " / " << BlockTypeCounts[GEO_BLOCK_MULTILAYER] << endl;
+
+	cout << "Loaded regions count: " << GetLoadedRegionsCount() << " of " << GEO_REGIONS_COUNT << endl;
+	cout << "Resident geodata size: " << GetResidentSize() / (1024 * 1024) << " MB" << endl;
+
+	if (UseLargePages) {
+		LargePageStats LargePages = GetLargePageStats();
+		cout << "Large page backed size: " << LargePages.Size / (1024 * 1024) << " MB (" << LargePages.BlocksCount << " blocks, " << 
+			LargePages.Fallbacks << " fallbacks)" << endl;
+	}
+}
+
+// EasyGeo layout: header with section table, then every section starts at EASYGEO_SECTION_ALIGNMENT boundary.
+// Region directory holds file offset of every present region, regions themselves are stored as self-contained GeoRegion blobs.
+// Regions are used straight from the read-only mapping, so pages are read from disk only when queries touch them.
+
+static inline uint64_t AlignEasyGeoOffset(uint64_t Offset) {
+	return (Offset + L2Geodata::EASYGEO_SECTION_ALIGNMENT - 1) / L2Geodata::EASYGEO_SECTION_ALIGNMENT * L2Geodata::EASYGEO_SECTION_ALIGNMENT;
+}
+
+// checks header, section table and every region header, View has to start with EASYGEO_MAGIC
+bool L2Geodata::IsValidEasyGeo(uint8_t* View, uint64_t Size) {
+
+	EasyGeoHeader* Header = (EasyGeoHeader*)View;
+
+	bool IsValid = 
+		Header->Version == EASYGEO_VERSION && Header->HeaderSize == sizeof(EasyGeoHeader) && Header->SectionCount == EASYGEO_SECTION_COUNT;
+
+	if (IsValid) {
+
+		uint64_t SectionSizes[EASYGEO_SECTION_COUNT] = {
+			sizeof(uint64_t) * GEO_REGIONS_COUNT,
+			Header->Sections[EASYGEO_SECTION_REGIONS].Size
+		};
+
+		for (uint32_t SectionIndex = 0; IsValid && SectionIndex < EASYGEO_SECTION_COUNT; SectionIndex++) {
+
+			EasyGeoSection& Section = Header->Sections[SectionIndex];
+
+			IsValid =
+				Section.Type == SectionIndex && Section.Size == SectionSizes[SectionIndex] &&
+				Section.Offset % EASYGEO_SECTION_ALIGNMENT == 0 && Section.Offset + Section.Size <= Size;
+		}
+	}
+
+	if (IsValid) {
+
+		EasyGeoSection& RegionsSection = Header->Sections[EASYGEO_SECTION_REGIONS];
+		uint64_t* RegionOffsets = (uint64_t*)(View + Header->Sections[EASYGEO_SECTION_REGION_DIRECTORY].Offset);
+
+		uint64_t RegionsEnd = RegionsSection.Offset + RegionsSection.Size;
+
+		for (uint32_t RegionIndex = 0; IsValid && RegionIndex < GEO_REGIONS_COUNT; RegionIndex++) {
+
+			uint64_t RegionOffset = RegionOffsets[RegionIndex];
+
+			IsValid = RegionOffset == 0 || (
+				RegionOffset % EASYGEO_SECTION_ALIGNMENT == 0 && RegionOffset >= RegionsSection.Offset && RegionOffset < RegionsEnd &&
+				IsValidRegion((GeoRegion*)(View + RegionOffset), RegionsEnd - RegionOffset));
+		}
+	}
+
+	return IsValid;
+}
+
+// releases current data and takes ownership of the mapping, regions are used straight from the view
+void L2Geodata::UseEasyGeoView(HANDLE File, HANDLE Mapping, uint8_t* View, uint64_t Size) {
+
+	ReleaseData();
+
+	EasyGeoFile = File;
+	EasyGeoMapping = Mapping;
+	EasyGeoView = View;
+	EasyGeoViewSize = Size;
+
+	EasyGeoHeader* Header = (EasyGeoHeader*)View;
+	uint64_t* RegionOffsets = (uint64_t*)(View + Header->Sections[EASYGEO_SECTION_REGION_DIRECTORY].Offset);
+
+	uint32_t RebuiltRegionsCount = 0;
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			uint64_t RegionOffset = RegionOffsets[RegionX * GEO_HEIGHT_IN_REGIONS + RegionY];
+			if (RegionOffset == 0)
+				continue;
+
+			GeoRegion* Region = (GeoRegion*)(View + RegionOffset);
+
+			// region saved in other layout is rebuilt on heap, the rest stays in mapping
+			if (Region->Layout != Layout) {
+
+				GeoRegionBuilder* Builder = new GeoRegionBuilder(Region);
+				Region = Builder->Build();
+				delete Builder;
+
+				RebuiltRegionsCount++;
+			}
+
+			Regions[RegionX][RegionY] = Region;
+		}
+
+	if (RebuiltRegionsCount > 0)
+		cout << "Easy geo regions converted to current layout: " << RebuiltRegionsCount << endl;
+}
+
+void L2Geodata::LoadEasyGeo(wstring FilePath) {
+
+	LONGLONG StartTime = GetTime();
+
+	HANDLE File = CreateFileW(FilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		throw new runtime_error("Couldn't open easygeo");
+
+	LARGE_INTEGER FileSize;
+	if (!GetFileSizeEx(File, &FileSize) || FileSize.QuadPart < sizeof(EasyGeoHeader)) {
+		CloseHandle(File);
+		throw new runtime_error("Invalid easygeo size");
+	}
+
+	HANDLE Mapping = CreateFileMappingW(File, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (Mapping == NULL) {
+		CloseHandle(File);
+		throw new runtime_error("Couldn't create easygeo mapping");
+	}
+
+	uint8_t* View = (uint8_t*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (View == NULL) {
+		CloseHandle(Mapping);
+		CloseHandle(File);
+		throw new runtime_error("Couldn't map easygeo");
+	}
+
+	EasyGeoHeader* Header = (EasyGeoHeader*)View;
+	if (Header->Magic != EASYGEO_MAGIC) {
+
+		UnmapViewOfFile(View);
+		CloseHandle(Mapping);
+		CloseHandle(File);
+
+		// old raw dump, go through converter path
+		LoadLegacyEasyGeo(FilePath);
+		return;
+	}
+
+	if (!IsValidEasyGeo(View, (uint64_t)FileSize.QuadPart)) {
+		UnmapViewOfFile(View);
+		CloseHandle(Mapping);
+		CloseHandle(File);
+		throw new runtime_error("Invalid easygeo header");
+	}
+
+	UseEasyGeoView(File, Mapping, View, (uint64_t)FileSize.QuadPart);
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Easy geo mapped for " << TimeToMs(EndTime - StartTime) << " ms (" << GetLoadedRegionsCount() << " regions)" << endl;
+}
+
+// legacy file is a raw dump of dense tables: full data (RegionY major), multilayer block map (RegionX major),
+// then global multilayer subblock map, layers table and their used counts. Block maps and used part of the global tables
+// are read first, so full data can be streamed region by region straight into region builders.
+
+void L2Geodata::LoadLegacyEasyGeo(wstring FilePath) {
+
+	LONGLONG StartTime = GetTime();
+
+	const uint64_t FullDataOffset = 0;
+	const uint64_t BlockMapOffset = FullDataOffset + (uint64_t)GEO_REGIONS_COUNT * GEO_REGION_AREA_SIZE * sizeof(int16_t);
+	const uint64_t MultilayerSubblockMapOffset = BlockMapOffset + (uint64_t)GEO_REGIONS_COUNT * GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS * sizeof(int32_t);
+	const uint64_t LayersTableOffset = MultilayerSubblockMapOffset + (uint64_t)MULTILAYER_BLOCK_LIMIT * sizeof(MultilayerBlock);
+	const uint64_t CountsOffset = LayersTableOffset + (uint64_t)LAYERS_COUNT_LIMIT * sizeof(int16_t);
+
+	ReleaseData();
+	AllocateData();
+
+	ifstream Stream(FilePath, ios::binary);
+
+	int32_t NextMultilayerBlockMapIndex = 0, NextLayersTableIndex = 0;
+
+	Stream.seekg(CountsOffset, ios_base::beg);
+	Stream.read((char *)&NextMultilayerBlockMapIndex, sizeof(NextMultilayerBlockMapIndex));
+	Stream.read((char *)&NextLayersTableIndex, sizeof(NextLayersTableIndex));
+
+	if (Stream.fail() || NextMultilayerBlockMapIndex < 0 || (uint32_t)NextMultilayerBlockMapIndex > MULTILAYER_BLOCK_LIMIT ||
+		NextLayersTableIndex < 0 || (uint32_t)NextLayersTableIndex > LAYERS_COUNT_LIMIT)
+		throw new runtime_error("Couldn't load legacy easygeo");
+
+	vector<int32_t> MultilayerSubblockMap((size_t)NextMultilayerBlockMapIndex * GEO_BLOCK_AREA_SIZE);
+	vector<int16_t> LayersTable(NextLayersTableIndex);
+
+	Stream.seekg(MultilayerSubblockMapOffset, ios_base::beg);
+	Stream.read((char *)MultilayerSubblockMap.data(), sizeof(int32_t) * MultilayerSubblockMap.size());
+
+	Stream.seekg(LayersTableOffset, ios_base::beg);
+	Stream.read((char *)LayersTable.data(), sizeof(int16_t) * LayersTable.size());
+
+	vector<int32_t> BlockMaps((size_t)GEO_REGIONS_COUNT * GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS);
+
+	Stream.seekg(BlockMapOffset, ios_base::beg);
+	Stream.read((char *)BlockMaps.data(), sizeof(int32_t) * BlockMaps.size());
+
+	vector<int16_t> SubBlocks(GEO_REGION_AREA_SIZE);
+
+	Stream.seekg(FullDataOffset, ios_base::beg);
+
+	for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+		for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++) {
+
+			Stream.read((char *)SubBlocks.data(), sizeof(int16_t) * SubBlocks.size());
+			if (Stream.fail())
+				throw new runtime_error("Couldn't load legacy easygeo");
+
+			bool IsEmpty = true;
+			for (uint32_t Index = 0; IsEmpty && Index < GEO_REGION_AREA_SIZE; Index++)
+				IsEmpty = SubBlocks[Index] == SPECIAL_SUBBLOCK_EMPTY;
+
+			if (IsEmpty)
+				continue;
+
+			int32_t* BlockMap = &BlockMaps[(RegionX * GEO_HEIGHT_IN_REGIONS + RegionY) * GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS];
+
+			GeoRegionBuilder* Builder = new GeoRegionBuilder();
+
+			for (uint32_t BlockX = 0; BlockX < GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+				for (uint32_t BlockY = 0; BlockY < GEO_REGION_SIZE_IN_BLOCKS; BlockY++)
+					for (uint32_t SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
+						for (uint32_t SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++) {
+
+							int16_t SubBlock = SubBlocks[
+								BlockX * GEO_REGION_COLUMN_SIZE + BlockY * GEO_BLOCK_AREA_SIZE +
+								SubBlockX * GEO_BLOCK_COLUMN_SIZE + SubBlockY * 1];
+
+							if (SubBlock == SPECIAL_SUBBLOCK_EMPTY)
+								continue;
+
+							if (SubBlock != SPECIAL_SUBBLOCK_MULTILAYER) {
+								Builder->SetSubBlock(BlockX, BlockY, SubBlockX, SubBlockY, SubBlock);
+								continue;
+							}
+
+							int32_t BlockIndex = BlockMap[BlockX * GEO_REGION_SIZE_IN_BLOCKS + BlockY];
+							if (BlockIndex < 0 || BlockIndex >= NextMultilayerBlockMapIndex)
+								continue;
+
+							int32_t SubBlockLayersIndex = MultilayerSubblockMap[BlockIndex * GEO_BLOCK_AREA_SIZE + SubBlockX * GEO_BLOCK_SIZE + SubBlockY];
+							if (SubBlockLayersIndex < 0 || SubBlockLayersIndex >= NextLayersTableIndex || 
+								SubBlockLayersIndex + 1 + LayersTable[SubBlockLayersIndex] > NextLayersTableIndex)
+								throw new runtime_error("Invalid legacy easygeo layers");
+
+							int16_t LayersCount = LayersTable[SubBlockLayersIndex];
+
+							if (LayersCount == 1)
+								Builder->SetSubBlock(BlockX, BlockY, SubBlockX, SubBlockY, LayersTable[SubBlockLayersIndex + 1]);
+							else
+								Builder->SetLayers(BlockX, BlockY, SubBlockX, SubBlockY, LayersCount, &LayersTable[SubBlockLayersIndex + 1]);
+						}
+
+			SetRegion(RegionX, RegionY, Builder->Build());
+
+			delete Builder;
+		}
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Legacy easy geo loaded for " << TimeToMs(EndTime - StartTime) << " ms (" << GetLoadedRegionsCount() << " regions)" << endl;
+}
+
+static void WriteEasyGeoData(ofstream& Stream, uint64_t Offset, const void* Data, uint64_t Size) {
 
-	int16_t* DestSubBlock = GetGeoSubBlockPtrInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY);
-	*DestSubBlock = SPECIAL_SUBBLOCK_EMPTY;
+	Stream.seekp(Offset, ios_base::beg);
+	Stream.write((const char *)Data, Size);
 }
 
-void L2Geodata::SetSubBlocks(int32_t WorldX, int32_t WorldY, int16_t Count, ...)
-{
-	if (Count < 0 || Count > LAYERS_PER_SUBBLOCK_LIMIT)
-		throw new runtime_error("Invalid subblock count");
+// places directory and every loaded region, returns total size, caller holds ReaderGuard
+uint64_t L2Geodata::GetEasyGeoLayout(EasyGeoHeader& Header, vector<uint64_t>& RegionOffsets) {
 
-	uint32_t GeoX, GeoY;
+	Header = { };
+	Header.Magic = EASYGEO_MAGIC;
+	Header.Version = EASYGEO_VERSION;
+	Header.HeaderSize = sizeof(EasyGeoHeader);
+	Header.SectionCount = EASYGEO_SECTION_COUNT;
 
-	if (WorldToGeo(WorldX, WorldY, &GeoX, &GeoY)) {
+	uint64_t Offset = sizeof(EasyGeoHeader);
 
-		uint32_t RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY;
+	// directory
 
-		SplitGeoCoordinates();
+	Offset = AlignEasyGeoOffset(Offset);
+	Header.Sections[EASYGEO_SECTION_REGION_DIRECTORY] = { EASYGEO_SECTION_REGION_DIRECTORY, 0, Offset, sizeof(uint64_t) * GEO_REGIONS_COUNT };
+	Offset += sizeof(uint64_t) * GEO_REGIONS_COUNT;
 
-		EraseGeoSubBlock(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY);
+	// regions
 
-		if (Count > 0) {
-			int16_t Layers[LAYERS_PER_SUBBLOCK_LIMIT];
+	RegionOffsets.assign(GEO_REGIONS_COUNT, 0);
 
-			va_list ap;
-			va_start(ap, Count);
-			for (int Index = 0; Index < Count; Index++)
-				Layers[Index] = va_arg(ap, int16_t);
-			va_end(ap);
+	Offset = AlignEasyGeoOffset(Offset);
+	uint64_t RegionsOffset = Offset;
 
-			sort(begin(Layers), begin(Layers) + Count);
-			reverse(begin(Layers), begin(Layers) + Count);
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
 
-			if (Count == 1)
-				SetGeoSubBlockInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY, Layers[0]);
-			else {
-				SetGeoLayersInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY, Count, Layers);
-			}
+			GeoRegion* Region = Regions[RegionX][RegionY];
+			if (!Region)
+				continue;
+
+			Offset = AlignEasyGeoOffset(Offset);
+			RegionOffsets[RegionX * GEO_HEIGHT_IN_REGIONS + RegionY] = Offset;
+			Offset += Region->Size;
 		}
-	}
+
+	Header.Sections[EASYGEO_SECTION_REGIONS] = { EASYGEO_SECTION_REGIONS, 0, RegionsOffset, Offset - RegionsOffset };
+
+	return Offset;
 }
 
-// alloc
+void L2Geodata::SaveEasyGeo(wstring FilePath) {
 
-void L2Geodata::AllocateData(void) {
+	ReaderGuard Guard;
 
-	if (FullData)
-		throw new runtime_error("GeoData is already allocated");
+	EasyGeoHeader Header;
+	vector<uint64_t> RegionOffsets;
 
-	if (((SPECIAL_SUBBLOCK_EMPTY >> 8) & 0xFF) != (SPECIAL_SUBBLOCK_EMPTY & 0xFF))
-		throw new runtime_error("Invalid empty block special value");
-	
-	FullData = (int16_t*)malloc(GEO_FULL_SIZE_IN_BYTES);
+	GetEasyGeoLayout(Header, RegionOffsets);
 
-	memset(FullData, SPECIAL_SUBBLOCK_EMPTY & 0xFF, GEO_FULL_SIZE_IN_BYTES);
-	memset(MultilayerBlockMap, 0xFF, sizeof(MultilayerBlockMap));
-	memset(MultilayerSubblockMap, 0xFF, sizeof(MultilayerSubblockMap));
-}
+	ofstream Stream(FilePath, ios::binary);
 
-int32_t L2Geodata::AllocateBlockMapEntry(void)
-{
-	if (NextMultilayerBlockMapIndex + 1 > MULTILAYER_BLOCK_LIMIT)
-		throw new runtime_error("Multilayer block count exceeds the limit");
+	Stream.write((char *)&Header, sizeof(Header));
 
-	int32_t Index = NextMultilayerBlockMapIndex;
-	NextMultilayerBlockMapIndex++;
+	WriteEasyGeoData(Stream, Header.Sections[EASYGEO_SECTION_REGION_DIRECTORY].Offset, RegionOffsets.data(), 
+		Header.Sections[EASYGEO_SECTION_REGION_DIRECTORY].Size);
 
-	return Index;
-}
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
 
-int32_t L2Geodata::AllocateLayersEntries(uint32_t Count)
-{
-	if (NextLayersTableIndex + Count > LAYERS_COUNT_LIMIT)
-		throw new runtime_error("Layers entries count exceeds the limit");
+			GeoRegion* Region = Regions[RegionX][RegionY];
 
-	int32_t Index = NextLayersTableIndex;
-	NextLayersTableIndex += Count;
+			uint64_t RegionOffset = RegionOffsets[RegionX * GEO_HEIGHT_IN_REGIONS + RegionY];
+			if (RegionOffset != 0)
+				WriteEasyGeoData(Stream, RegionOffset, Region, Region->Size);
+		}
 
-	return Index;
+	if (Stream.fail())
+		throw new runtime_error("Couldn't save easygeo");
 }
 
-// loading
+void L2Geodata::ConvertLegacyEasyGeo(wstring LegacyFilePath, wstring FilePath) {
 
-#define PTS_BLOCK_FLAT 0
-#define PTS_BLOCK_COMPLEX 0x40
+	LoadLegacyEasyGeo(LegacyFilePath);
+	SaveEasyGeo(FilePath);
+}
 
-static int32_t LayersCountInAllSubBlocks = 0;
-static int32_t MultiLayerSubBlockCount = 0;
-static int32_t MaxLayersCountPerSubBlock = 0;
-static int32_t MultiLayerBlockCount = 0;
+// Shared geo is EasyGeo image in a named pagefile-backed section. Everything in it is offsets, so every process
+// maps it at whatever address it gets and uses regions straight from the view, physical pages exist once per host.
+// Header is written last, so a process that attaches too early sees no magic instead of half-written data.
 
-bool L2Geodata::LoadRegion(uint32_t RegionX, uint32_t RegionY, wstring FilePath, GeoType Type) {
+void L2Geodata::PublishSharedGeo(wstring Name) {
 
-	RegionX -= GEO_X_FIRST;
-	RegionY -= GEO_Y_FIRST;
+	LONGLONG StartTime = GetTime();
 
-	if (Type == PTS) {
+	if (LazyLoading)
+		throw new runtime_error("Lazy loaded geo can't be published");
 
-		ifstream Stream(FilePath, ios::binary | ios::ate);
-		if (!Stream.is_open())
-			return false;
+	HANDLE Mapping;
+	uint64_t Size;
 
-		streamsize size = Stream.tellg();
-		if (size <= 18)
-			return false;
+	{
+		ReaderGuard Guard;
 
-		size -= 18;
+		EasyGeoHeader Header;
+		vector<uint64_t> RegionOffsets;
 
-		vector<int16_t> buffer(size / sizeof(int16_t));
+		Size = GetEasyGeoLayout(Header, RegionOffsets);
 
-		if (!Stream.seekg(18, ios_base::beg) || !Stream.read((char *)buffer.data(), size))
-			return false;
+		Mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(Size >> 32), (DWORD)Size, Name.c_str());
+		if (Mapping == NULL)
+			throw new runtime_error("Couldn't create shared geo");
 
-		int32_t position = 0;
+		if (GetLastError() == ERROR_ALREADY_EXISTS) {
+			CloseHandle(Mapping);
+			throw new runtime_error("Shared geo is already published");
+		}
 
-		for (int BlockX = 0; BlockX < GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
-			for (int BlockY = 0; BlockY < GEO_REGION_SIZE_IN_BLOCKS; BlockY++) {
+		uint8_t* View = (uint8_t*)MapViewOfFile(Mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)Size);
+		if (View == NULL) {
+			CloseHandle(Mapping);
+			throw new runtime_error("Couldn't map shared geo");
+		}
 
-				int16_t SubBlockCount = buffer[position++];
+		memcpy(View + Header.Sections[EASYGEO_SECTION_REGION_DIRECTORY].Offset, RegionOffsets.data(), 
+			Header.Sections[EASYGEO_SECTION_REGION_DIRECTORY].Size);
 
-				int16_t SubBlock;
+		for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+			for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
 
-				switch (SubBlockCount) {
-				case PTS_BLOCK_FLAT:
+				uint64_t RegionOffset = RegionOffsets[RegionX * GEO_HEIGHT_IN_REGIONS + RegionY];
+				if (RegionOffset == 0)
+					continue;
 
-					// skip max height (unused)
-					position++;
+				GeoRegion* Region = Regions[RegionX][RegionY];
+				memcpy(View + RegionOffset, Region, Region->Size);
+			}
 
-					SubBlock = buffer[position++];
-					SubBlock = ((SubBlock << 1) & 0xFFF0) | NSWE_ALL;
+		MemoryBarrier();
 
-					for (int SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
-						for (int SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++) {
+		memcpy(View, &Header, sizeof(Header));
 
-							SetGeoSubBlockInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY, SubBlock);
-						}
+		UnmapViewOfFile(View);
+	}
 
-					break;
-				case PTS_BLOCK_COMPLEX:
+	// publisher switches to the shared copy too, so its own heap regions are freed
+	uint8_t* View = (uint8_t*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (View == NULL) {
+		CloseHandle(Mapping);
+		throw new runtime_error("Couldn't map shared geo");
+	}
 
-					for (int SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++) 
-						for (int SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++) {
+	UseEasyGeoView(INVALID_HANDLE_VALUE, Mapping, View, Size);
 
-							SubBlock = buffer[position++];
+	LONGLONG EndTime = GetTime();
 
-							SetGeoSubBlockInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY, SubBlock);
-						}
+	cout << "Shared geo published for " << TimeToMs(EndTime - StartTime) << " ms (" << GetLoadedRegionsCount() << " regions, " << 
+		Size / (1024 * 1024) << " MB)" << endl;
+}
 
-					break;
-				default:
+void L2Geodata::AttachSharedGeo(wstring Name) {
 
-					if (SubBlockCount <= PTS_BLOCK_COMPLEX)
-						return false;
+	LONGLONG StartTime = GetTime();
 
-					MultiLayerBlockCount++;
+	HANDLE Mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, Name.c_str());
+	if (Mapping == NULL)
+		throw new runtime_error("Shared geo is not published");
 
-					int SubBlockCount = 0;
+	uint8_t* View = (uint8_t*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (View == NULL) {
+		CloseHandle(Mapping);
+		throw new runtime_error("Couldn't map shared geo");
+	}
 
-					for (int SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
-						for (int SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++) {
+	// section size isn't stored anywhere else, view covers it rounded up to a page
+	MEMORY_BASIC_INFORMATION Info;
+	if (VirtualQuery(View, &Info, sizeof(Info)) == 0 || Info.RegionSize < sizeof(EasyGeoHeader)) {
+		UnmapViewOfFile(View);
+		CloseHandle(Mapping);
+		throw new runtime_error("Invalid shared geo size");
+	}
 
-							int16_t LayersCount = buffer[position++];
+	EasyGeoHeader* Header = (EasyGeoHeader*)View;
+	if (Header->Magic != EASYGEO_MAGIC) {
+		UnmapViewOfFile(View);
+		CloseHandle(Mapping);
+		throw new runtime_error("Shared geo is not published yet");
+	}
 
-							if (LayersCount > 1) {
+	if (!IsValidEasyGeo(View, Info.RegionSize)) {
+		UnmapViewOfFile(View);
+		CloseHandle(Mapping);
+		throw new runtime_error("Invalid shared geo header");
+	}
 
-								SetGeoLayersInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY, LayersCount, &buffer[position]);
-								position += LayersCount;
+	UseEasyGeoView(INVALID_HANDLE_VALUE, Mapping, View, Info.RegionSize);
 
-								LayersCountInAllSubBlocks += LayersCount;
-								MultiLayerSubBlockCount++;
+	LONGLONG EndTime = GetTime();
 
-								if (LayersCount > MaxLayersCountPerSubBlock)
-									MaxLayersCountPerSubBlock = LayersCount;
-							}
-							else {
-								SubBlock = buffer[position++];
+	cout << "Shared geo attached for " << TimeToMs(EndTime - StartTime) << " ms (" << GetLoadedRegionsCount() << " regions)" << endl;
+}
 
-								SetGeoSubBlockInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY, SubBlock);
-							}
+void L2Geodata::UnmapEasyGeo(void) {
 
-							SubBlockCount += LayersCount;
-						}
+	if (!EasyGeoView)
+		return;
 
-					if (SubBlockCount != SubBlockCount)
-						return false;
+	// regions that were changed after mapping live on the heap
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+			FreeRegion(Regions[RegionX][RegionY].exchange(nullptr));
 
-					break;
-				}
-			}
+	UnmapViewOfFile(EasyGeoView);
+	CloseHandle(EasyGeoMapping);
+	// shared memory segment has no file behind it
+	if (EasyGeoFile != INVALID_HANDLE_VALUE)
+		CloseHandle(EasyGeoFile);
 
-		if (position != buffer.size())
-			return false;
-	}
+	EasyGeoView = nullptr;
+	EasyGeoViewSize = 0;
+	EasyGeoMapping = NULL;
+	EasyGeoFile = INVALID_HANDLE_VALUE;
+}
 
-	return true;
+// Neighbor Weight Cache
+
+void L2Geodata::AllocateNWCData(void)
+{
+	memset(NWC_Regions, 0, sizeof(NWC_Regions));
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+			NWC_StaleRegions[RegionX][RegionY] = false;
+
+	NWC_NextMultilayerBlockMapIndex = 0;
+	NWC_NextLayersTableIndex = 0;
 }
 
-void L2Geodata::Init(void)
+void L2Geodata::ReleaseNWCData(void)
 {
-	AllocateData();
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+			FreeGeoMemory(NWC_Regions[RegionX][RegionY]);
+
 	AllocateNWCData();
 }
 
-void L2Geodata::Load(wstring Directory, GeoType Type) {
+L2Geodata::NWCRegion *L2Geodata::CreateNWCRegion(void)
+{
+	NWCRegion* Region = (NWCRegion*)AllocateGeoMemory(sizeof(NWCRegion));
+	if (!Region)
+		throw new runtime_error("Couldn't allocate NWC region");
 
-	LONGLONG StartTime = GetTime();
+	memset(Region->Weights, 0, sizeof(Region->Weights));
+	memset(Region->MultilayerBlockMap, 0xFF, sizeof(Region->MultilayerBlockMap));
 
-	for (directory_entry p : directory_iterator(Directory)) {
+	return Region;
+}
 
-		path path = p.path();
-		wstring filename = path.filename().replace_extension("");
+L2Geodata::NWCRegion *L2Geodata::AllocateNWCRegion(uint32_t RegionX, uint32_t RegionY)
+{
+	NWCRegion* Region = NWC_Regions[RegionX][RegionY];
+	if (Region)
+		return Region;
 
-		unsigned int regionX, regionY;
+	Region = CreateNWCRegion();
 
-		const wchar_t *str = filename.c_str();
-		wchar_t *end;
+	NWC_Regions[RegionX][RegionY] = Region;
 
-		regionX = wcstol(str, &end, 10);
-		if (str == end || errno == ERANGE || *end != '_')
-			continue;
+	return Region;
+}
 
-		str = end + 1;
-		regionY = wcstol(str, &end, 10);
-		if (str == end || errno == ERANGE)
-			continue;
+VOID L2Geodata::AllocateNWCRegionWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	NWCAllocateTask* Task = (NWCAllocateTask*)Context;
 
-		bool Loaded = LoadRegion(regionX, regionY, path, Type);
-		if (!Loaded)
-			throw new runtime_error("Coudn't load geo file");
+	try {
+		Task->Region = CreateNWCRegion();
 	}
+	catch (runtime_error* Error) {
+		Task->Error = Error;
+	}
+}
 
-	LONGLONG EndTime = GetTime();
-
-	cout << "Geo loaded for " << TimeToMs(EndTime - StartTime) << " ms" << endl;
+// every region is a few MB to clear, so they are allocated and first touched on all cores
+void L2Geodata::AllocateNWCRegions(void)
+{
+	LONGLONG StartTime = GetTime();
 
-	cout << "Layers count: " << LayersCountInAllSubBlocks << endl;
-	cout << "Layers subblock count: " << MultiLayerSubBlockCount << endl;
-	cout << "Max layer count per subblock: " << MaxLayersCountPerSubBlock << endl;
-	cout << "Multilayer block count: " << MultiLayerBlockCount << endl;
+	vector<NWCAllocateTask> Tasks(GEO_REGIONS_COUNT);
+	vector<PTP_WORK> Works(GEO_REGIONS_COUNT);
 
-	cout << "Free multilayer blocks count: " << MULTILAYER_BLOCK_LIMIT - NextMultilayerBlockMapIndex << endl;
-	cout << "Free layers count: " << LAYERS_COUNT_LIMIT - NextLayersTableIndex << endl;
-}
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
 
-void L2Geodata::LoadEasyGeo(wstring FilePath) {
+			uint32_t Index = RegionX * GEO_HEIGHT_IN_REGIONS + RegionY;
 
-	LONGLONG StartTime = GetTime();
+			if (NWC_Regions[RegionX][RegionY] || !IsRegionPresent(RegionX, RegionY))
+				continue;
 
-	ifstream Stream(FilePath, ios::binary);
+			PTP_WORK Work = CreateThreadpoolWork(AllocateNWCRegionWorkCallback, (PVOID)&Tasks[Index], NULL);
+			if (Work == NULL)
+				throw new runtime_error("Couldn't create NWC allocation work");
 
-	Stream.read((char *)FullData, GEO_FULL_SIZE_IN_BYTES);
-	Stream.read((char *)&MultilayerBlockMap, sizeof(MultilayerBlockMap));
-	Stream.read((char *)&MultilayerSubblockMap, sizeof(MultilayerSubblockMap));
-	Stream.read((char *)&LayersTable, sizeof(LayersTable));
+			SubmitThreadpoolWork(Work);
 
-	Stream.read((char *)&NextMultilayerBlockMapIndex, sizeof(NextMultilayerBlockMapIndex));
-	Stream.read((char *)&NextLayersTableIndex, sizeof(NextLayersTableIndex));
+			Works[Index] = Work;
+		}
 
-	if (Stream.fail())
-		throw new runtime_error("Couldn't load easygeo");
+	runtime_error* Error = nullptr;
+	uint32_t AllocatedCount = 0;
 
-	LONGLONG EndTime = GetTime();
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
 
-	cout << "Easy geo loaded for " << TimeToMs(EndTime - StartTime) << " ms" << endl;
-}
+			uint32_t Index = RegionX * GEO_HEIGHT_IN_REGIONS + RegionY;
+			if (Works[Index] == NULL)
+				continue;
 
-void L2Geodata::SaveEasyGeo(wstring FilePath) {
+			WaitForThreadpoolWorkCallbacks(Works[Index], false);
+			CloseThreadpoolWork(Works[Index]);
 
-	ofstream Stream(FilePath, ios::binary);
+			NWCAllocateTask& Task = Tasks[Index];
 
-	Stream.write((char *)FullData, GEO_FULL_SIZE_IN_BYTES);
-	Stream.write((char *)&MultilayerBlockMap, sizeof(MultilayerBlockMap));
-	Stream.write((char *)&MultilayerSubblockMap, sizeof(MultilayerSubblockMap));
-	Stream.write((char *)&LayersTable, sizeof(LayersTable));
-	Stream.write((char *)&NextMultilayerBlockMapIndex, sizeof(NextMultilayerBlockMapIndex));
-	Stream.write((char *)&NextLayersTableIndex, sizeof(NextLayersTableIndex));
-}
+			if (Task.Error) {
+				if (!Error)
+					Error = Task.Error;
+				else
+					delete Task.Error;
+				continue;
+			}
 
-// Neighbor Weight Cache
+			NWC_Regions[RegionX][RegionY] = Task.Region;
+			AllocatedCount++;
+		}
 
-void L2Geodata::AllocateNWCData(void)
-{
-	if (NWC_FullData)
-		throw new runtime_error("Neighbor Weight Cache is already allocated");
+	if (Error)
+		throw Error;
 
-	NWC_FullData = (uint8_t*)calloc(NWC_FULL_SIZE_IN_BYTES, 1);
+	LONGLONG EndTime = GetTime();
 
-	memset(NWC_MultilayerBlockMap, 0xFF, sizeof(NWC_MultilayerBlockMap));
-	memset(NWC_MultilayerSubblockMap, 0xFF, sizeof(NWC_MultilayerSubblockMap));
+	cout << "NWC regions allocated for " << TimeToMs(EndTime - StartTime) << " ms (" << AllocatedCount << " regions)" << endl;
 }
 
 int32_t L2Geodata::AllocateNWCBlockMapEntry(void)
 {
 	int32_t Index = NWC_NextMultilayerBlockMapIndex.fetch_add(1);
 
-	if (Index > MULTILAYER_BLOCK_LIMIT)
+	if (Index >= MULTILAYER_BLOCK_LIMIT)
 		throw new runtime_error("Multilayer weight count exceeds the limit");
 
+	memset(NWC_MultilayerSubblockMap[Index], 0xFF, sizeof(*NWC_MultilayerSubblockMap));
+
 	return Index;
 }
 
@@ -488,50 +2711,210 @@ int32_t L2Geodata::AllocateNWCLayersEntries(uint32_t Count)
 {
 	int32_t Index = NWC_NextLayersTableIndex.fetch_add(Count);
 
-	if (Index > LAYERS_COUNT_LIMIT)
+	if (Index + Count > LAYERS_COUNT_LIMIT)
 		throw new runtime_error("Layers entries count exceeds the limit (NWC)");
 
 	return Index;
 }
 
+// cache file: header with counts, then every present region (header, weights, used block map entries),
+// then used part of multilayer tables
+
+const static uint64_t NWC_LEGACY_FILE_SIZE = 
+	(uint64_t)L2Geodata::NWC_FULL_SIZE_IN_BYTES + 
+	(uint64_t)L2Geodata::GEO_REGIONS_COUNT * sizeof(L2Geodata::NWCRegion::MultilayerBlockMap) +
+	sizeof(L2Geodata::NWC_MultilayerSubblockMap) + sizeof(L2Geodata::NWC_LayersTable) + 2 * sizeof(uint32_t);
+
 void L2Geodata::LoadNeighborWeightCache(wstring FilePath)
 {
-	ifstream Stream(FilePath, ios::binary);
+	ifstream Stream(FilePath, ios::binary | ios::ate);
+
+	uint64_t FileSize = (uint64_t)Stream.tellg();
+	Stream.seekg(0, ios_base::beg);
+
+	ReleaseNWCData();
+
+	if (FileSize == NWC_LEGACY_FILE_SIZE) {
+		LoadLegacyNeighborWeightCache(Stream);
+		return;
+	}
+
+	NWCHeader Header = { };
+	Stream.read((char *)&Header, sizeof(Header));
+
+	if (Stream.fail() || Header.Magic != NWC_MAGIC || Header.Version != NWC_VERSION || Header.HeaderSize != sizeof(NWCHeader) || 
+		Header.RegionsCount > GEO_REGIONS_COUNT || Header.MultilayerBlocksCount > MULTILAYER_BLOCK_LIMIT || 
+		Header.LayersCount > LAYERS_COUNT_LIMIT)
+		throw new runtime_error("Invalid neighbor weight cache");
+
+	vector<NWCBlockMapEntry> BlockMap;
+
+	for (uint32_t Index = 0; Index < Header.RegionsCount; Index++) {
+
+		NWCRegionHeader RegionHeader;
+		Stream.read((char *)&RegionHeader, sizeof(RegionHeader));
+
+		if (Stream.fail() || RegionHeader.RegionX >= GEO_WIDTH_IN_REGIONS || RegionHeader.RegionY >= GEO_HEIGHT_IN_REGIONS ||
+			RegionHeader.MultilayerBlocksCount > GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS)
+			throw new runtime_error("Invalid neighbor weight cache region");
+
+		NWCRegion* Region = AllocateNWCRegion(RegionHeader.RegionX, RegionHeader.RegionY);
+
+		Stream.read((char *)Region->Weights, sizeof(Region->Weights));
+		RelayoutNWCWeights(Region->Weights, GEO_LAYOUT_LINEAR, Layout);
+
+		BlockMap.resize(RegionHeader.MultilayerBlocksCount);
+		Stream.read((char *)BlockMap.data(), BlockMap.size() * sizeof(NWCBlockMapEntry));
+
+		int32_t* RegionBlockMap = &Region->MultilayerBlockMap[0][0];
+		for (NWCBlockMapEntry& Entry : BlockMap) {
+
+			if (Entry.MultilayerBlockMapIndex < 0 || (uint32_t)Entry.MultilayerBlockMapIndex >= Header.MultilayerBlocksCount)
+				throw new runtime_error("Invalid neighbor weight cache block map");
+
+			RegionBlockMap[Entry.BlockIndex] = Entry.MultilayerBlockMapIndex;
+		}
+	}
+
+	Stream.read((char *)&NWC_MultilayerSubblockMap, sizeof(*NWC_MultilayerSubblockMap) * Header.MultilayerBlocksCount);
+	Stream.read((char *)&NWC_LayersTable, sizeof(*NWC_LayersTable) * Header.LayersCount);
+
+	NWC_NextMultilayerBlockMapIndex = Header.MultilayerBlocksCount;
+	NWC_NextLayersTableIndex = Header.LayersCount;
+
+	if (Stream.fail())
+		throw new runtime_error("Couldn't load neighbor weight cache");
+}
+
+void L2Geodata::LoadLegacyNeighborWeightCache(ifstream& Stream)
+{
+	NWCRegion* Region = (NWCRegion*)malloc(sizeof(NWCRegion));
+	if (!Region)
+		throw new runtime_error("Couldn't allocate NWC region");
+
+	// full data is RegionY major, keep only regions that have geodata
+	for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+		for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++) {
+
+			Stream.read((char *)Region->Weights, sizeof(Region->Weights));
+
+			if (IsRegionPresent(RegionX, RegionY)) {
+				RelayoutNWCWeights(Region->Weights, GEO_LAYOUT_LINEAR, Layout);
+				memcpy(AllocateNWCRegion(RegionX, RegionY)->Weights, Region->Weights, sizeof(Region->Weights));
+			}
+		}
+
+	// block map is RegionX major
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			Stream.read((char *)Region->MultilayerBlockMap, sizeof(Region->MultilayerBlockMap));
+
+			if (NWC_Regions[RegionX][RegionY])
+				memcpy(NWC_Regions[RegionX][RegionY]->MultilayerBlockMap, Region->MultilayerBlockMap, sizeof(Region->MultilayerBlockMap));
+		}
+
+	free(Region);
 
-	Stream.read((char *)NWC_FullData, NWC_FULL_SIZE_IN_BYTES);
-	Stream.read((char *)&NWC_MultilayerBlockMap, sizeof(NWC_MultilayerBlockMap));
 	Stream.read((char *)&NWC_MultilayerSubblockMap, sizeof(NWC_MultilayerSubblockMap));
 	Stream.read((char *)&NWC_LayersTable, sizeof(NWC_LayersTable));
 	uint32_t NWC_NextMultilayerBlockMapIndex_Local, NWC_NextLayersTableIndex_Local;
 	Stream.read((char *)&NWC_NextMultilayerBlockMapIndex_Local, sizeof(NWC_NextMultilayerBlockMapIndex_Local));
 	Stream.read((char *)&NWC_NextLayersTableIndex_Local, sizeof(NWC_NextLayersTableIndex_Local));
+
+	NWC_NextMultilayerBlockMapIndex = NWC_NextMultilayerBlockMapIndex_Local;
+	NWC_NextLayersTableIndex = NWC_NextLayersTableIndex_Local;
+
+	if (Stream.fail())
+		throw new runtime_error("Couldn't load legacy neighbor weight cache");
 }
 
+// weights are always stored in linear layout, so cache file doesn't depend on layout selected at load
 void L2Geodata::SaveNeighborWeightCache(wstring FilePath)
 {
 	ofstream Stream(FilePath, ios::binary);
 
-	Stream.write((char *)NWC_FullData, NWC_FULL_SIZE_IN_BYTES);
-	Stream.write((char *)&NWC_MultilayerBlockMap, sizeof(NWC_MultilayerBlockMap));
-	Stream.write((char *)&NWC_MultilayerSubblockMap, sizeof(NWC_MultilayerSubblockMap));
-	Stream.write((char *)&NWC_LayersTable, sizeof(NWC_LayersTable));
-	uint32_t NWC_NextMultilayerBlockMapIndex_Local = NWC_NextMultilayerBlockMapIndex;
-	uint32_t NWC_NextLayersTableIndex_Local = NWC_NextLayersTableIndex;
-	Stream.write((char *)&NWC_NextMultilayerBlockMapIndex_Local, sizeof(NWC_NextMultilayerBlockMapIndex_Local));
-	Stream.write((char *)&NWC_NextLayersTableIndex_Local, sizeof(NWC_NextLayersTableIndex_Local));
+	NWCHeader Header = { };
+	Header.Magic = NWC_MAGIC;
+	Header.Version = NWC_VERSION;
+	Header.HeaderSize = sizeof(NWCHeader);
+	Header.MultilayerBlocksCount = NWC_NextMultilayerBlockMapIndex;
+	Header.LayersCount = NWC_NextLayersTableIndex;
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++)
+			if (NWC_Regions[RegionX][RegionY])
+				Header.RegionsCount++;
+
+	Stream.write((char *)&Header, sizeof(Header));
+
+	NWCRegion* LinearRegion = (NWCRegion*)malloc(sizeof(NWCRegion));
+	if (!LinearRegion)
+		throw new runtime_error("Couldn't allocate NWC region");
+
+	vector<NWCBlockMapEntry> BlockMap;
+
+	for (uint32_t RegionX = 0; RegionX < GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			NWCRegion* Region = NWC_Regions[RegionX][RegionY];
+			if (!Region)
+				continue;
+
+			// only blocks that have multilayer weights, the rest of the map is -1
+			BlockMap.clear();
+
+			int32_t* RegionBlockMap = &Region->MultilayerBlockMap[0][0];
+			for (uint32_t BlockIndex = 0; BlockIndex < GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS; BlockIndex++)
+				if (RegionBlockMap[BlockIndex] != -1)
+					BlockMap.push_back({ (uint16_t)BlockIndex, RegionBlockMap[BlockIndex] });
+
+			NWCRegionHeader RegionHeader;
+			RegionHeader.RegionX = (uint16_t)RegionX;
+			RegionHeader.RegionY = (uint16_t)RegionY;
+			RegionHeader.MultilayerBlocksCount = (uint32_t)BlockMap.size();
+
+			Stream.write((char *)&RegionHeader, sizeof(RegionHeader));
+
+			memcpy(LinearRegion->Weights, Region->Weights, sizeof(Region->Weights));
+			RelayoutNWCWeights(LinearRegion->Weights, Layout, GEO_LAYOUT_LINEAR);
+
+			Stream.write((char *)LinearRegion->Weights, sizeof(LinearRegion->Weights));
+			Stream.write((char *)BlockMap.data(), BlockMap.size() * sizeof(NWCBlockMapEntry));
+		}
+
+	free(LinearRegion);
+
+	Stream.write((char *)&NWC_MultilayerSubblockMap, sizeof(*NWC_MultilayerSubblockMap) * Header.MultilayerBlocksCount);
+	Stream.write((char *)&NWC_LayersTable, sizeof(*NWC_LayersTable) * Header.LayersCount);
+
+	if (Stream.fail())
+		throw new runtime_error("Couldn't save neighbor weight cache");
 }
 
-inline uint8_t* L2Geodata::GetNeighborWeightPtrInternal(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY,
+inline uint8_t* L2Geodata::GetNeighborWeightPtrInternal(NWCRegion *Region, uint32_t BlockX, uint32_t BlockY,
 	uint32_t SubBlockX, uint32_t SubBlockY)
 {
 	uint32_t Index;
 
-	Index =
-		RegionY * GEO_ROW_SIZE + RegionX * GEO_REGION_AREA_SIZE +
-		BlockX * GEO_REGION_COLUMN_SIZE + BlockY * GEO_BLOCK_AREA_SIZE +
-		SubBlockX * GEO_BLOCK_COLUMN_SIZE + SubBlockY * 1;
+	Index = GetBlockIndex(Layout, BlockX, BlockY) * GEO_BLOCK_AREA_SIZE + GetCellIndex(Layout, SubBlockX, SubBlockY);
+
+	return &Region->Weights[Index];
+}
+
+void L2Geodata::RelayoutNWCWeights(uint8_t* Weights, GeoLayout From, GeoLayout To)
+{
+	if (From == To)
+		return;
+
+	vector<uint8_t> Source(Weights, Weights + GEO_REGION_AREA_SIZE);
 
-	return &NWC_FullData[Index];
+	for (uint32_t BlockX = 0; BlockX < GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+		for (uint32_t BlockY = 0; BlockY < GEO_REGION_SIZE_IN_BLOCKS; BlockY++)
+			for (uint32_t SubBlockX = 0; SubBlockX < GEO_BLOCK_SIZE; SubBlockX++)
+				for (uint32_t SubBlockY = 0; SubBlockY < GEO_BLOCK_SIZE; SubBlockY++)
+					Weights[GetBlockIndex(To, BlockX, BlockY) * GEO_BLOCK_AREA_SIZE + GetCellIndex(To, SubBlockX, SubBlockY)] = 
+						Source[GetBlockIndex(From, BlockX, BlockY) * GEO_BLOCK_AREA_SIZE + GetCellIndex(From, SubBlockX, SubBlockY)];
 }
 
 uint8_t* L2Geodata::GetNeighborWeights(int32_t WorldX, int32_t WorldY, uint8_t& Count)
@@ -544,10 +2927,21 @@ uint8_t* L2Geodata::GetNeighborWeights(int32_t WorldX, int32_t WorldY, uint8_t&
 
 		SplitGeoCoordinates();
 
-		uint8_t* Weight = GetNeighborWeightPtrInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY);
+		if (NWC_StaleRegions[RegionX][RegionY].load(memory_order_relaxed)) {
+			Count = 0;
+			return nullptr;
+		}
+
+		NWCRegion* Region = NWC_Regions[RegionX][RegionY];
+		if (Region == nullptr) {
+			Count = 1;
+			return &NWC_EmptyWeight;
+		}
+
+		uint8_t* Weight = GetNeighborWeightPtrInternal(Region, BlockX, BlockY, SubBlockX, SubBlockY);
 		if (*Weight == SPECIAL_NEIGHBOR_WEIGHT_MULTILAYER) {
 
-			int32_t BlockIndex = NWC_MultilayerBlockMap[RegionX][RegionY][BlockX][BlockY];
+			int32_t BlockIndex = Region->MultilayerBlockMap[BlockX][BlockY];
 			if (BlockIndex == -1) {
 				Count = 0;
 				return nullptr;
@@ -576,7 +2970,17 @@ uint8_t* L2Geodata::GetNeighborWeights(int32_t WorldX, int32_t WorldY, uint8_t&
 inline void L2Geodata::SetNeighborWeightInternal(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX,
 	uint32_t SubBlockY, uint8_t Weight)
 {
-	uint8_t* DestWeight = GetNeighborWeightPtrInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY);
+	NWCRegion* Region = NWC_Regions[RegionX][RegionY];
+	if (Region == nullptr) {
+
+		// absent region already reads as empty weight
+		if (Weight == NWC_EmptyWeight)
+			return;
+
+		throw new runtime_error("NWC region is not allocated");
+	}
+
+	uint8_t* DestWeight = GetNeighborWeightPtrInternal(Region, BlockX, BlockY, SubBlockX, SubBlockY);
 
 	*DestWeight = Weight;
 }
@@ -584,15 +2988,19 @@ inline void L2Geodata::SetNeighborWeightInternal(uint32_t RegionX, uint32_t Regi
 inline void L2Geodata::SetNeighborWeightsInternal(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, 
 	uint32_t SubBlockY, uint8_t WeightsCount, uint8_t* Weights)
 {
-	uint8_t* FullWeight = GetNeighborWeightPtrInternal(RegionX, RegionY, BlockX, BlockY, SubBlockX, SubBlockY);
+	NWCRegion* Region = NWC_Regions[RegionX][RegionY];
+	if (Region == nullptr)
+		throw new runtime_error("NWC region is not allocated");
+
+	uint8_t* FullWeight = GetNeighborWeightPtrInternal(Region, BlockX, BlockY, SubBlockX, SubBlockY);
 
 	*FullWeight = SPECIAL_NEIGHBOR_WEIGHT_MULTILAYER;
 
-	int32_t BlockIndex = NWC_MultilayerBlockMap[RegionX][RegionY][BlockX][BlockY];
+	int32_t BlockIndex = Region->MultilayerBlockMap[BlockX][BlockY];
 	if (BlockIndex == -1) {
 
 		BlockIndex = AllocateNWCBlockMapEntry();
-		NWC_MultilayerBlockMap[RegionX][RegionY][BlockX][BlockY] = BlockIndex;
+		Region->MultilayerBlockMap[BlockX][BlockY] = BlockIndex;
 	}
 
 	int32_t WeightsIndex = NWC_MultilayerSubblockMap[BlockIndex][SubBlockX][SubBlockY];
@@ -638,23 +3046,10 @@ int32_t GetHeightDiff(int16_t From, int16_t To);
 
 void L2Geodata::GetLowAndHighLayers(int16_t SubBlock, int16_t* Layers, int16_t LayersCount, int16_t& LowLayerIndex, int16_t& HighLayerIndex) {
 
-	LowLayerIndex = -1;
-	HighLayerIndex = -1;
-
-	int16_t Height = GET_GEO_HEIGHT(SubBlock);
-
-	for (int Index = 0; Index < LayersCount; Index++) {
-
-		int16_t CurrentHeight = GET_GEO_HEIGHT(Layers[Index]);
-
-		if (CurrentHeight <= Height) {
+	int16_t LayersAbove = CountLayersAbove(Layers, LayersCount, GET_GEO_HEIGHT(SubBlock));
 
-			LowLayerIndex = Index;
-			break;
-		}
-
-		HighLayerIndex = Index;
-	}
+	LowLayerIndex = LayersAbove < LayersCount ? LayersAbove : -1;
+	HighLayerIndex = LayersAbove - 1;
 }
 
 bool L2Geodata::CanGoInThisDirection(int16_t SubBlock, int DirectionX, int DirectionY)
@@ -721,23 +3116,23 @@ bool L2Geodata::GetWallLayerIndex(int16_t SubBlock, int OffsetX, int OffsetY, in
 	return WallRequired;
 }
 
-bool L2Geodata::GetGroundSubBlock(int32_t WorldX, int32_t WorldY, int32_t WorldZ, int16_t& GroundSubBlock, int16_t& GroundLayerIndex)
+bool L2Geodata::GetGroundSubBlock(int32_t WorldX, int32_t WorldY, int32_t WorldZ, int16_t& GroundSubBlock, int16_t& GroundLayerIndex,
+	L2GeodataOverlay* View)
 {
+	ReaderGuard Guard;
+	OverlayScope Scope(View);
+
 	int16_t LayersCount;
 	int16_t* Layers = GetSubBlocks(WorldX, WorldY, LayersCount);
 
-	for (int16_t LayerIndex = 0; LayerIndex < LayersCount; LayerIndex++) {
-
-		int16_t SubBlock = Layers[LayerIndex];
+	int16_t LayerIndex = CountLayersAbove(Layers, LayersCount, WorldZ + MIN_LAYER_DIFF);
+	if (LayerIndex == LayersCount)
+		return false;
 
-		if (GET_GEO_HEIGHT(SubBlock) <= WorldZ + MIN_LAYER_DIFF) {
-			GroundSubBlock = SubBlock;
-			GroundLayerIndex = LayerIndex;
-			return true;
-		}
-	}
+	GroundSubBlock = Layers[LayerIndex];
+	GroundLayerIndex = LayerIndex;
 
-	return false;
+	return true;
 }
 
 // Utils
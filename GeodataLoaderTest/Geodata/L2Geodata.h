@@ -2,6 +2,14 @@
 
 #include <string>
 #include <atomic>
+#include <fstream>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+
+#include <intrin.h>
+#include <emmintrin.h>
 
 using namespace std;
 
@@ -11,11 +19,19 @@ enum GeoType {
 	INTERNAL
 };
 
+// order of blocks in region and subblocks in block, Morton keeps 2D neighbours close in memory
+enum GeoLayout {
+	GEO_LAYOUT_LINEAR,
+	GEO_LAYOUT_MORTON
+};
+
 #define GET_GEO_HEIGHT(subblock) ((int16_t)(subblock & 0xFFF0) >> 1)
 #define GET_GEO_NSWE(subblock) ((int16_t)(subblock & 0x0F))
 #define MAKE_SUBBLOCK(height, NSWE) ((int16_t)((int16_t)(height & 0xFFF0) << 1 | (int16_t)(NSWE & 0x0F)))
 #define TEST_NSWE(NSWE, Mask) ((NSWE & Mask) == Mask)
 
+class L2GeodataOverlay;
+
 class L2Geodata {
 public:
 	// if flag is present then we can go to this offset, otherwise we can't
@@ -45,6 +61,8 @@ public:
 	const static uint32_t GEO_FULL_SIZE = GEO_WIDTH * GEO_HEIGHT;
 	const static uint32_t GEO_FULL_SIZE_IN_BYTES = GEO_FULL_SIZE * sizeof(int16_t);
 
+	const static uint32_t GEO_REGIONS_COUNT = GEO_WIDTH_IN_REGIONS * GEO_HEIGHT_IN_REGIONS;
+
 	const static uint32_t GEO_BLOCK_AREA_SIZE = GEO_BLOCK_SIZE * GEO_BLOCK_SIZE;
 	const static uint32_t GEO_REGION_AREA_SIZE = GEO_REGION_SIZE * GEO_REGION_SIZE;
 
@@ -71,13 +89,183 @@ public:
 	const static int HEIGHT_RESOLUTION = 8;
 	const static int MIN_LAYER_DIFF = 4 * HEIGHT_RESOLUTION;
 
-	static int16_t *FullData;
-	static int32_t MultilayerBlockMap[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS][GEO_REGION_SIZE_IN_BLOCKS][GEO_REGION_SIZE_IN_BLOCKS];
-	static int32_t MultilayerSubblockMap[MULTILAYER_BLOCK_LIMIT][GEO_BLOCK_SIZE][GEO_BLOCK_SIZE];
-	static int16_t LayersTable[LAYERS_COUNT_LIMIT];
+	// storage is region-granular, region that wasn't loaded is nullptr in directory and costs nothing
 
-	static int32_t NextMultilayerBlockMapIndex;
-	static int32_t NextLayersTableIndex;
+	// every region is block-compressed: flat block keeps single subblock, complex block keeps 64 subblocks
+	// and multilayer block keeps 64 offsets into region's layers table
+	enum GeoBlockType {
+		GEO_BLOCK_EMPTY,
+		GEO_BLOCK_FLAT,
+		GEO_BLOCK_COMPLEX,
+		GEO_BLOCK_MULTILAYER
+	};
+
+	struct GeoBlock {
+		uint16_t Type;
+		// flat: the subblock itself, complex/multilayer: index into region's complex/multilayer blocks
+		int16_t Data;
+	};
+
+	typedef int16_t ComplexBlock[GEO_BLOCK_SIZE][GEO_BLOCK_SIZE];
+	// offset into region's layers table (count followed by layers) or -1 if subblock is empty
+	typedef int32_t MultilayerBlock[GEO_BLOCK_SIZE][GEO_BLOCK_SIZE];
+
+	// region is a single blob and all offsets are relative to its start, so it can be used straight from mapped file
+	struct GeoRegion {
+		uint32_t Size;
+
+		uint32_t ComplexBlocksCount, MultilayerBlocksCount, LayersCount;
+		uint32_t ComplexBlocksOffset, MultilayerBlocksOffset, LayersOffset;
+		// GeoLayout of blocks and subblocks in complex/multilayer blocks
+		uint32_t Layout;
+
+		GeoBlock Blocks[GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS];
+
+		inline ComplexBlock *GetComplexBlocks(void) { return (ComplexBlock*)((uint8_t*)this + ComplexBlocksOffset); }
+		inline MultilayerBlock *GetMultilayerBlocks(void) { return (MultilayerBlock*)((uint8_t*)this + MultilayerBlocksOffset); }
+		inline int16_t *GetLayers(void) { return (int16_t*)((uint8_t*)this + LayersOffset); }
+	};
+
+	// mutable form of the region used while loading, Build packs it into GeoRegion blob
+	struct GeoRegionBuilder {
+		GeoBlock Blocks[GEO_REGION_SIZE_IN_BLOCKS * GEO_REGION_SIZE_IN_BLOCKS];
+
+		vector<int16_t> ComplexBlocks;
+		vector<int32_t> MultilayerBlocks;
+		vector<int16_t> Layers;
+
+		GeoRegionBuilder(void);
+		GeoRegionBuilder(GeoRegion* Region);
+
+		void SetFlatBlock(uint32_t BlockX, uint32_t BlockY, int16_t SubBlock);
+		void SetSubBlock(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY, int16_t SubBlock);
+		void SetLayers(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY, int16_t LayersCount, int16_t* Layers);
+		void EraseSubBlock(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY);
+
+		int16_t* GetSubBlocks(uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY, int16_t& Count);
+
+		GeoRegion* Build(void);
+	private:
+		GeoBlock& GetBlock(uint32_t BlockX, uint32_t BlockY);
+		void ConvertToComplex(GeoBlock& Block);
+		void ConvertToMultilayer(GeoBlock& Block);
+		int32_t AddLayers(int16_t LayersCount, int16_t* Layers);
+	};
+
+	// readers load region pointers without locks, writers publish new pointer and retire the old one
+	static atomic<GeoRegion*> Regions[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+
+	// epoch based reclamation
+
+	const static uint32_t READER_SLOTS_COUNT = 256;
+
+	struct RetiredRegion {
+		GeoRegion* Region;
+		uint64_t Epoch;
+	};
+
+	static atomic<uint64_t> GlobalEpoch;
+	// epoch that reader had on enter, 0 if slot is free
+	static atomic<uint64_t> ReaderEpochs[READER_SLOTS_COUNT];
+
+	struct RetiredMemory {
+		void* Memory;
+		uint64_t Epoch;
+	};
+
+	static vector<RetiredRegion> RetiredRegions;
+	// malloc'ed memory that readers could still see (overlay cells), reclaimed together with regions
+	static vector<RetiredMemory> RetiredMemoryBlocks;
+	static mutex RetiredRegionsLock;
+
+	static void EnterReader(void);
+	static void LeaveReader(void);
+	static void RetireRegion(GeoRegion* Region);
+	// swaps in a region with new content (reload or edit) and retires the old one, RegionsLock has to be held
+	static void ReplaceRegion(uint32_t RegionX, uint32_t RegionY, GeoRegion* Region);
+	static void ReclaimRegions(void);
+
+	// overlays
+
+	// overlay of the current thread (instance), if it isn't set world overlay is used
+	static thread_local L2GeodataOverlay* ThreadOverlay;
+	static atomic<L2GeodataOverlay*> WorldOverlay;
+
+	static inline L2GeodataOverlay* GetActiveOverlay(void) {
+		L2GeodataOverlay* Overlay = ThreadOverlay;
+		return Overlay ? Overlay : WorldOverlay.load(memory_order_acquire);
+	}
+
+	// lazy paging
+
+	// INTERNAL type means region blob at Offset of EasyGeo file
+	struct RegionSource {
+		wstring FilePath;
+		GeoType Type;
+		uint64_t Offset;
+	};
+
+	static bool LazyLoading;
+	static uint64_t PagingMemoryBudget;
+	// sources are changed and read under RegionsLock, lookups check only the flag
+	static RegionSource RegionSources[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+	static atomic<bool> HasRegionSource[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+	// serializes everything that replaces region pointers: paging, eviction and edits
+	static mutex RegionsLock;
+	// goes up before and after a region is replaced (reload or edit), so it's odd while the swap is in progress
+	static atomic<uint64_t> ReloadVersion;
+
+	// hits a thread counts before adding them to PagingHits, stats lag by up to that many hits per thread
+	const static uint32_t PAGING_HITS_BATCH = 1024;
+
+	// advanced by paging in, regions touched between two page-ins share the same access tick
+	static atomic<uint64_t> AccessClock;
+	static atomic<uint64_t> RegionLastAccess[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+	static atomic<uint64_t> PagedSize;
+	static atomic<uint64_t> PagingHits, PagingMisses, PagingEvictions;
+
+	static inline GeoRegion *AcquireLazyRegion(uint32_t RegionX, uint32_t RegionY, GeoRegion *Region);
+	static void SetRegionSource(uint32_t RegionX, uint32_t RegionY, const RegionSource& Source);
+	static GeoRegion *PageInRegion(uint32_t RegionX, uint32_t RegionY);
+	static GeoRegion *ReadRegion(RegionSource& Source);
+	static void EvictRegions(uint32_t KeepRegionX, uint32_t KeepRegionY);
+	static bool IsRegionPresent(uint32_t RegionX, uint32_t RegionY);
+
+	// EasyGeo
+
+	const static uint32_t EASYGEO_MAGIC = 'OEGE'; // "EGEO" in file
+	const static uint32_t EASYGEO_VERSION = 4;
+	// allocation granularity, so any section can be mapped by its own view if needed
+	const static uint32_t EASYGEO_SECTION_ALIGNMENT = 64 * 1024;
+
+	enum EasyGeoSectionType {
+		// uint64_t file offset of every region, 0 if region is absent
+		EASYGEO_SECTION_REGION_DIRECTORY,
+		EASYGEO_SECTION_REGIONS,
+		EASYGEO_SECTION_COUNT
+	};
+
+#pragma pack(push,1)
+	struct EasyGeoSection {
+		uint32_t Type;
+		uint32_t Reserved;
+		uint64_t Offset, Size;
+	};
+
+	struct EasyGeoHeader {
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t HeaderSize;
+		uint32_t SectionCount;
+
+		EasyGeoSection Sections[EASYGEO_SECTION_COUNT];
+	};
+#pragma pack(pop)
+
+	// set while geodata tables point into read-only EasyGeo mapping (file or shared memory, then there is no file)
+	static HANDLE EasyGeoFile, EasyGeoMapping;
+	static uint8_t *EasyGeoView;
+	static uint64_t EasyGeoViewSize;
 
 	// Neighbor weight cache
 
@@ -85,42 +273,189 @@ public:
 
 	const static uint8_t SPECIAL_NEIGHBOR_WEIGHT_MULTILAYER = 255;
 
-	static uint8_t *NWC_FullData;
-	static int32_t NWC_MultilayerBlockMap[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS][GEO_REGION_SIZE_IN_BLOCKS][GEO_REGION_SIZE_IN_BLOCKS];
+	struct NWCRegion {
+		uint8_t Weights[GEO_REGION_AREA_SIZE];
+		int32_t MultilayerBlockMap[GEO_REGION_SIZE_IN_BLOCKS][GEO_REGION_SIZE_IN_BLOCKS];
+	};
+
+	// weight for cells of absent regions, same value that generation stores for empty cells
+	static uint8_t NWC_EmptyWeight;
+
+	static NWCRegion *NWC_Regions[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
+	// regions reloaded after their NWC was built, cache has no weights for them until it's loaded again
+	static atomic<bool> NWC_StaleRegions[GEO_WIDTH_IN_REGIONS][GEO_HEIGHT_IN_REGIONS];
 	static int32_t NWC_MultilayerSubblockMap[MULTILAYER_BLOCK_LIMIT][GEO_BLOCK_SIZE][GEO_BLOCK_SIZE];
 	static uint8_t NWC_LayersTable[LAYERS_COUNT_LIMIT];
 
 	static atomic<int32_t> NWC_NextMultilayerBlockMapIndex;
 	static atomic<int32_t> NWC_NextLayersTableIndex;
 
+	const static uint32_t NWC_MAGIC = 'CCWN'; // "NWCC" in file
+	const static uint32_t NWC_VERSION = 2;
+
+#pragma pack(push,1)
+	// counts go first, so loader knows size of every part before reading it
+	struct NWCHeader {
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t HeaderSize;
+		uint32_t RegionsCount;
+		uint32_t MultilayerBlocksCount;
+		uint32_t LayersCount;
+	};
+
+	// followed by weights of the region and MultilayerBlocksCount entries of its block map
+	struct NWCRegionHeader {
+		uint16_t RegionX, RegionY;
+		uint32_t MultilayerBlocksCount;
+	};
+
+	struct NWCBlockMapEntry {
+		uint16_t BlockIndex;
+		int32_t MultilayerBlockMapIndex;
+	};
+#pragma pack(pop)
+
+	// large pages
+
+	static bool UseLargePages;
+	static SIZE_T LargePageSize;
+
+	// large page allocations and their rounded sizes, everything else came from malloc
+	static unordered_map<void*, SIZE_T> LargePageBlocks;
+	static mutex LargePageBlocksLock;
+	static atomic<uint64_t> LargePageFallbacks;
+
 	L2Geodata(void) { }
 
-	static void AllocateData(void);
-	static int32_t AllocateBlockMapEntry(void);
-	static int32_t AllocateLayersEntries(uint32_t Count);
+	// region blobs and NWC regions, large page backed when enabled and block is at least a page
+	static void* AllocateGeoMemory(size_t Size);
+	static void FreeGeoMemory(void* Memory);
 
-	static inline int16_t *GetGeoSubBlockPtrInternal(uint32_t RegionX, uint32_t RegionY,
-		uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY);
-	static inline void EraseGeoSubBlock(uint32_t RegionX, uint32_t RegionY,
-		uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY);
-	static inline void SetGeoSubBlockInternal(uint32_t RegionX, uint32_t RegionY,
-		uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY, 
-		int16_t SubBlockValue);
-	static inline void SetGeoLayersInternal(uint32_t RegionX, uint32_t RegionY,
-		uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY,
-		int16_t LayersCount, int16_t* Layers);
+	static VOID NTAPI PrefaultRegionWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work);
+
+	struct ParallelTask {
+		const function<void(uint32_t Index)>* Work;
+		uint32_t Index;
+		runtime_error* Error;
+	};
+
+	static VOID NTAPI ParallelWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work);
+
+	static void AllocateData(void);
+	static void ReleaseData(void);
+	static bool IsMappedRegion(GeoRegion *Region);
+	static void FreeRegion(GeoRegion *Region);
+	static void SetRegion(uint32_t RegionX, uint32_t RegionY, GeoRegion *Region);
+	static bool GetRegionFileCoords(wstring FileName, uint32_t& RegionX, uint32_t& RegionY);
+	static bool IsValidRegion(GeoRegion *Region, uint64_t MaxSize);
+	// indices of blocks and multilayer subblocks are inside of their tables, region has to pass IsValidRegion first,
+	// walks every block, so it's for regions that are in memory anyway (read or decoded, not mapped)
+	static bool IsValidBlockTable(GeoRegion *Region);
+	static bool IsValidEasyGeo(uint8_t* View, uint64_t Size);
+	static void UseEasyGeoView(HANDLE File, HANDLE Mapping, uint8_t* View, uint64_t Size);
+	static uint64_t GetEasyGeoLayout(EasyGeoHeader& Header, vector<uint64_t>& RegionOffsets);
+
+	// layout of every region in memory and of NWC weights, fixed while anything is loaded
+	static GeoLayout Layout;
+
+	// spreads 8 bits to even positions
+	static inline uint32_t MortonSpread(uint32_t Value) {
+		Value = (Value | (Value << 4)) & 0x0F0F;
+		Value = (Value | (Value << 2)) & 0x3333;
+		Value = (Value | (Value << 1)) & 0x5555;
+		return Value;
+	}
+
+	static inline uint32_t GetBlockIndex(GeoLayout Layout, uint32_t BlockX, uint32_t BlockY) {
+		if (Layout == GEO_LAYOUT_MORTON)
+			return (MortonSpread(BlockX) << 1) | MortonSpread(BlockY);
+		return BlockX * GEO_REGION_SIZE_IN_BLOCKS + BlockY;
+	}
+
+	static inline uint32_t GetCellIndex(GeoLayout Layout, uint32_t SubBlockX, uint32_t SubBlockY) {
+		if (Layout == GEO_LAYOUT_MORTON)
+			return (MortonSpread(SubBlockX) << 1) | MortonSpread(SubBlockY);
+		return SubBlockX * GEO_BLOCK_SIZE + SubBlockY;
+	}
+
+	static void RelayoutNWCWeights(uint8_t* Weights, GeoLayout From, GeoLayout To);
+
+	static inline GeoBlock *GetGeoBlockPtrInternal(GeoRegion *Region, uint32_t BlockX, uint32_t BlockY);
+	static inline int16_t *GetRegionSubBlocksInternal(GeoRegion *Region, uint32_t BlockX, uint32_t BlockY, 
+		uint32_t SubBlockX, uint32_t SubBlockY, int16_t& Count);
+
+	static bool IsAVX2Supported(void);
+	static uint32_t DecodeSubBlocksAVX2(const int16_t* SubBlocks, uint32_t Count, int16_t* Heights, int16_t* NSWE);
 
 	static inline void ValidateSubBlock(int16_t SubBlock);
 
+	struct GeoLoadStats {
+		int32_t LayersCount;
+		int32_t MultilayerSubBlockCount;
+		int32_t MaxLayersCountPerSubBlock;
+		int32_t MultilayerBlockCount;
+	};
+
+	// every region file is parsed into its own builder, regions are published in task order once all works are done
+	struct GeoLoadTask {
+		uint32_t RegionX, RegionY;
+		wstring FilePath;
+		GeoType Type;
+
+		GeoRegion* Region;
+		bool Loaded;
+		runtime_error* Error;
+
+		uint64_t FileSize;
+		LONGLONG ParseTime;
+		GeoLoadStats Stats;
+	};
+
+	// reads region file through a fixed-size chunk instead of loading it whole
+	struct GeoFileReader {
+		const static uint32_t CHUNK_SIZE = 64 * 1024;
+
+		ifstream Stream;
+		uint8_t Chunk[CHUNK_SIZE];
+		uint32_t ChunkPosition, ChunkSize;
+
+		GeoFileReader(wstring FilePath);
+
+		bool IsOpen(void);
+		bool IsEOF(void);
+		bool Read(void* Data, uint32_t Size);
+
+		template<typename T> 
+		bool Read(T& Value) {
+			return Read(&Value, sizeof(T));
+		}
+	};
+
+	static bool LoadRegion(GeoRegionBuilder& Builder, wstring FilePath, GeoType Type, GeoLoadStats& Stats);
+	static bool LoadL2JRegion(GeoRegionBuilder& Builder, wstring FilePath, GeoLoadStats& Stats);
 	static bool LoadRegion(uint32_t RegionX, uint32_t RegionY, wstring FilePath, GeoType Type);
 
+	static VOID NTAPI LoadRegionWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work);
+
 	// NWC
 
 	static void AllocateNWCData(void);
+	static void ReleaseNWCData(void);
+	struct NWCAllocateTask {
+		NWCRegion* Region;
+		runtime_error* Error;
+	};
+
+	static NWCRegion *CreateNWCRegion(void);
+	static NWCRegion *AllocateNWCRegion(uint32_t RegionX, uint32_t RegionY);
+	static VOID NTAPI AllocateNWCRegionWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work);
 	static int32_t AllocateNWCBlockMapEntry(void);
 	static int32_t AllocateNWCLayersEntries(uint32_t Count);
 
-	static inline uint8_t *GetNeighborWeightPtrInternal(uint32_t RegionX, uint32_t RegionY,
+	static void LoadLegacyNeighborWeightCache(ifstream& Stream);
+
+	static inline uint8_t *GetNeighborWeightPtrInternal(NWCRegion *Region,
 		uint32_t BlockX, uint32_t BlockY, uint32_t SubBlockX, uint32_t SubBlockY);
 	static inline void SetNeighborWeightInternal(uint32_t RegionX, uint32_t RegionY, uint32_t BlockX, uint32_t BlockY, 
 		uint32_t SubBlockX, uint32_t SubBlockY, uint8_t Weight);
@@ -129,33 +464,176 @@ public:
 
 	// Usage utils
 
+	// number of leading layers higher than Height, layers are sorted by height descending,
+	// so it's also index of the first layer at or below Height
+	static inline int16_t CountLayersAbove(const int16_t* Layers, int16_t LayersCount, int32_t Height);
 	static void GetLowAndHighLayers(int16_t SubBlock, int16_t* Layers, int16_t LayersCount, int16_t& LowLayerIndex, int16_t& HighLayerIndex);
 	static bool CanGoInThisDirection(int16_t SubBlock, int DirectionX, int DirectionY);
 	static bool CanGoUnderneath(int16_t SubBlock, int16_t HigherSubBlock);
 public:
-	static void Init(void);
+	// region pointers (and subblock pointers returned by GetSubBlocks) stay valid while the thread holds a guard,
+	// required whenever regions can be evicted or replaced (lazy loading, SetSubBlocks), guards can be nested
+	class ReaderGuard {
+	public:
+		ReaderGuard(void) { EnterReader(); }
+		~ReaderGuard(void) { LeaveReader(); }
+	};
+
+	// queries done by this thread inside the scope see given overlay (and its parents) instead of world overlay,
+	// nullptr keeps overlay of the outer scope, so view parameters can be passed through as they are.
+	// View parameter of queries is such an overlay: geodata as seen by an instance (overlay whose parent is
+	// world overlay), the query runs in OverlayScope of it
+	class OverlayScope {
+	public:
+		OverlayScope(L2GeodataOverlay* Overlay) { Previous = ThreadOverlay; ThreadOverlay = Overlay ? Overlay : Previous; }
+		~OverlayScope(void) { ThreadOverlay = Previous; }
+	private:
+		L2GeodataOverlay* Previous;
+	};
+
+	struct PagingStats {
+		uint64_t Hits, Misses, Evictions;
+		uint64_t PagedSize;
+	};
+
+	struct LargePageStats {
+		uint64_t Size, BlocksCount;
+		// allocations that asked for large pages but got regular ones
+		uint64_t Fallbacks;
+	};
+
+	static void Init(GeoLayout Layout = GEO_LAYOUT_LINEAR);
+	// releases loaded and mapped regions and NWC, so another Load can be done
+	static void Unload(void);
+	// only while nothing is loaded, regions stored in other layout are converted on load
+	static void SetLayout(GeoLayout Layout);
+	static GeoLayout GetLayout(void);
+
+	// regions and NWC regions allocated after this call use large pages, requires SeLockMemoryPrivilege
+	// to be granted to the account, returns false (and regular pages are used) if it isn't
+	static bool EnableLargePages(bool Enable = true);
+	static LargePageStats GetLargePageStats(void);
+	// touches every page of every loaded region from all cores, so mapped geodata doesn't fault during queries
+	static void PrefaultRegions(void);
+	// runs Work for every index below Count on the thread pool and waits for all of them. Errors are collected per work
+	// (works that couldn't be created included), the first one is thrown once every submitted work is done
+	static void RunParallel(uint32_t Count, const function<void(uint32_t Index)>& Work);
 
 	static void Load(wstring Directory, GeoType Type);
-
+	// parses region file off to the side and swaps it in, old region is freed once readers that could see it are gone.
+	// FindPath running meanwhile starts over, so it sees either old or new region. NWC of the region is dropped,
+	// its weights are calculated by the path finder until NWC is loaded again
+	static void ReloadRegion(wstring FilePath, GeoType Type);
+	// searches compare it before and after, equal even value means no region was reloaded (or edited) in between
+	static inline uint64_t GetReloadVersion(void) {
+		return ReloadVersion.load();
+	}
+
+	// maps EasyGeo file read-only, legacy (raw dump) files are loaded through LoadLegacyEasyGeo
 	static void LoadEasyGeo(wstring FilePath);
+	static void LoadLegacyEasyGeo(wstring FilePath);
 	static void SaveEasyGeo(wstring FilePath);
+	static void ConvertLegacyEasyGeo(wstring LegacyFilePath, wstring FilePath);
+	static void UnmapEasyGeo(void);
+
+	// copies loaded regions into named shared memory and switches to it, other server processes attach read-only,
+	// segment lives while any process keeps it mapped. Name is a kernel object name ("Local\..." or "Global\...")
+	static void PublishSharedGeo(wstring Name);
+	static void AttachSharedGeo(wstring Name);
 
 	static void LoadNeighborWeightCache(wstring FilePath);
 	static void SaveNeighborWeightCache(wstring FilePath);
 
+	// NWC is stored only for regions that have geodata, call it before generating the cache
+	static void AllocateNWCRegions(void);
+
+	// regions are loaded from region files (or EasyGeo blobs) on first access and evicted in LRU order
+	// once paged in regions exceed the memory budget
+	static void SetupLazyLoading(wstring Directory, GeoType Type, uint64_t MemoryBudget);
+	static void SetupLazyEasyGeo(wstring FilePath, uint64_t MemoryBudget);
+	static PagingStats GetPagingStats(void);
+
+	// overlay seen by every query that isn't inside of OverlayScope, nullptr to remove,
+	// old overlay can be deleted once readers that could see it are gone
+	static void SetWorldOverlay(L2GeodataOverlay* Overlay);
+	// frees memory once no reader that entered before this call is left
+	static void RetireMemory(void* Memory);
+
+	static uint32_t GetLoadedRegionsCount(void);
+	static uint64_t GetResidentSize(void);
+
+	// nullptr if cache has no weights for the cell (region reloaded after cache was built), weights have to be calculated then
 	static uint8_t* GetNeighborWeights(int32_t WorldX, int32_t WorldY, uint8_t& Count);
 	static void SetNeighborWeights(int32_t WorldX, int32_t WorldY, uint8_t Count, uint8_t* Weights);
 
+	// overlay cells take precedence over static geodata
 	static int16_t* GetSubBlocks(int32_t WorldX, int32_t WorldY, int16_t& Count);
+	// same as GetSubBlocks, GeoX and GeoY have to be inside of the map
+	static int16_t* GetSubBlocksGeo(uint32_t GeoX, uint32_t GeoY, int16_t& Count);
+	// static geodata only, GeoX and GeoY have to be inside of the map
+	static int16_t* GetStaticSubBlocks(uint32_t GeoX, uint32_t GeoY, int16_t& Count);
 	static void SetSubBlocks(int32_t WorldX, int32_t WorldY, int16_t Count, ...);
 
+	// batch queries fill caller owned arrays of Count entries, region lookup is done once per run of points in the same region,
+	// returned layer pointers follow the same ReaderGuard rules as GetSubBlocks
+	static void GetSubBlocksBatch(const int32_t* WorldX, const int32_t* WorldY, uint32_t Count, int16_t* LayersCounts, int16_t** Layers);
+	static void GetSubBlocksBatchGeo(const uint32_t* GeoX, const uint32_t* GeoY, uint32_t Count, int16_t* LayersCounts, int16_t** Layers);
+	// structure of arrays form: layers of every point are decoded one after another into Heights and NSWE (MaxLayersCount
+	// entries, at least LAYERS_PER_SUBBLOCK_LIMIT), returns count of points done and LayersCount written, call again for the rest
+	static uint32_t GetDecodedSubBlocksBatch(const int32_t* WorldX, const int32_t* WorldY, uint32_t Count, int16_t* LayersCounts,
+		int16_t* Heights, int16_t* NSWE, uint32_t MaxLayersCount, uint32_t& LayersCount);
+	// GroundLayerIndices is -1 (and subblock is SPECIAL_SUBBLOCK_EMPTY) where there is no ground below WorldZ
+	static void GetGroundSubBlocksBatch(const int32_t* WorldX, const int32_t* WorldY, const int32_t* WorldZ, uint32_t Count,
+		int16_t* GroundSubBlocks, int16_t* GroundLayerIndices);
+	// GET_GEO_HEIGHT / GET_GEO_NSWE over an array, uses AVX2 when CPU supports it
+	static void DecodeSubBlocks(const int16_t* SubBlocks, uint32_t Count, int16_t* Heights, int16_t* NSWE);
+
 	// return true and DestSubBlock will contain block that we gonna land on if we go in this direction, return false if we cannot go in this direction
 	static bool GetDestLayerIndex(int16_t SubBlock, int OffsetX, int OffsetY, int16_t* Layers, int16_t LayersCount, int16_t& DestLayerIndex);
 
 	static bool GetWallLayerIndex(int16_t SubBlock, int OffsetX, int OffsetY, int16_t* Layers, int16_t LayersCount, int16_t& DestLayerIndex);
 
-	static bool GetGroundSubBlock(int32_t WorldX, int32_t WorldY, int32_t WorldZ, int16_t& GroundSubBlock, int16_t& GroundLayerIndex);
+	// View as in OverlayScope
+	static bool GetGroundSubBlock(int32_t WorldX, int32_t WorldY, int32_t WorldZ, int16_t& GroundSubBlock, int16_t& GroundLayerIndex,
+		L2GeodataOverlay* View = nullptr);
 
 	static bool GeoToWorld(uint32_t GeoX, uint32_t GeoY, int32_t *WorldX, int32_t *WorldY);
 	static bool WorldToGeo(int32_t WorldX, int32_t WorldY, uint32_t *GeoX, uint32_t *GeoY);
-};
\ No newline at end of file
+};
+
+// SSE2 is always there on x64, 8 layers are compared at once and the sort order turns the compare mask into a prefix,
+// so its length is found with a single bit scan instead of a loop with a branch per layer
+inline int16_t L2Geodata::CountLayersAbove(const int16_t* Layers, int16_t LayersCount, int32_t Height)
+{
+	if (Height >= INT16_MAX)
+		return 0;
+	if (Height < INT16_MIN)
+		Height = INT16_MIN;
+
+	const __m128i HeightMask = _mm_set1_epi16((int16_t)0xFFF0);
+	const __m128i Threshold = _mm_set1_epi16((int16_t)Height);
+
+	int16_t Index = 0;
+
+	for (; Index + 8 <= LayersCount; Index += 8) {
+
+		__m128i Data = _mm_loadu_si128((const __m128i*)&Layers[Index]);
+		__m128i Heights = _mm_srai_epi16(_mm_and_si128(Data, HeightMask), 1);
+
+		uint32_t Mask = (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi16(Heights, Threshold));
+		if (Mask != 0xFFFF) {
+
+			unsigned long FirstBelow;
+			_BitScanForward(&FirstBelow, ~Mask);
+
+			return Index + (int16_t)(FirstBelow / 2);
+		}
+	}
+
+	// tail is too short for a vector load (and reading past the cell isn't safe), count it without branches
+	int16_t Count = Index;
+	for (; Index < LayersCount; Index++)
+		Count += GET_GEO_HEIGHT(Layers[Index]) > Height;
+
+	return Count;
+}
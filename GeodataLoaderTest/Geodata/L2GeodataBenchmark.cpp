@@ -0,0 +1,864 @@
+#include "stdafx.h"
+
+#include "L2GeodataBenchmark.h"
+#include "L2GeodataPathFind.h"
+#include "L2GeodataCodec.h"
+#include "L2GeodataOverlay.h"
+#include "L2GeodataLineOfSight.h"
+#include "L2GeodataRaycast.h"
+#include "L2GeodataSpatial.h"
+#include "L2GeodataPathFindService.h"
+#include "L2GeodataHierarchicalPathFind.h"
+
+#include <iostream>
+#include <experimental/filesystem>
+#include <vector>
+#include <random>
+#include <memory>
+
+#include "TimeUtils.h"
+
+using namespace experimental::filesystem::v1;
+
+uint64_t L2GeodataBenchmark::GetDirectorySize(wstring Directory)
+{
+	uint64_t Size = 0;
+
+	for (directory_entry p : directory_iterator(Directory))
+		if (is_regular_file(p.path()))
+			Size += file_size(p.path());
+
+	return Size;
+}
+
+// returns best time in ms
+double L2GeodataBenchmark::LoadDirectory(wstring Directory, GeoType Type, uint32_t RunsCount)
+{
+	double BestTime = 0;
+
+	for (uint32_t Run = 0; Run < RunsCount; Run++) {
+
+		L2Geodata::Unload();
+
+		LONGLONG StartTime = GetTime();
+
+		L2Geodata::Load(Directory, Type);
+
+		LONGLONG EndTime = GetTime();
+
+		double Time = (double)TimeToMs(EndTime - StartTime);
+		if (Run == 0 || Time < BestTime)
+			BestTime = Time;
+	}
+
+	return BestTime;
+}
+
+void L2GeodataBenchmark::CompareLoaders(wstring PTSDirectory, wstring L2JDirectory, uint32_t RunsCount)
+{
+	uint64_t PTSSize = GetDirectorySize(PTSDirectory);
+	uint64_t L2JSize = GetDirectorySize(L2JDirectory);
+
+	double PTSTime = LoadDirectory(PTSDirectory, PTS, RunsCount);
+	double L2JTime = LoadDirectory(L2JDirectory, L2J, RunsCount);
+
+	L2Geodata::Unload();
+
+	cout << "PTS: " << PTSSize / (1024 * 1024) << " MB for " << PTSTime << " ms, " << 
+		(PTSTime > 0 ? PTSSize / (1024.0 * 1024.0) / (PTSTime / 1000.0) : 0.0) << " MB/s" << endl;
+	cout << "L2J: " << L2JSize / (1024 * 1024) << " MB for " << L2JTime << " ms, " << 
+		(L2JTime > 0 ? L2JSize / (1024.0 * 1024.0) / (L2JTime / 1000.0) : 0.0) << " MB/s" << endl;
+}
+
+void L2GeodataBenchmark::CompareBatchQueries(int32_t WorldX, int32_t WorldY, uint32_t Size, uint32_t RunsCount)
+{
+	uint32_t Count = Size * Size;
+
+	vector<int32_t> PointsX(Count), PointsY(Count);
+
+	for (uint32_t X = 0; X < Size; X++)
+		for (uint32_t Y = 0; Y < Size; Y++) {
+			PointsX[X * Size + Y] = WorldX + (int32_t)X * L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+			PointsY[X * Size + Y] = WorldY + (int32_t)Y * L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+		}
+
+	vector<int16_t> LayersCounts(Count);
+	// room for a single layer per cell, multilayer cells just take more calls
+	vector<int16_t> Heights(max(Count, (uint32_t)L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT)), NSWE(Heights.size());
+
+	L2Geodata::ReaderGuard Guard;
+
+	// checksums keep both paths from being optimized away and show that they agree
+	int64_t ScalarSum = 0, BatchSum = 0;
+	double ScalarTime = 0, BatchTime = 0;
+
+	for (uint32_t Run = 0; Run < RunsCount; Run++) {
+
+		ScalarSum = 0;
+
+		LONGLONG StartTime = GetTime();
+
+		for (uint32_t Index = 0; Index < Count; Index++) {
+
+			int16_t LayersCount;
+			int16_t* PointLayers = L2Geodata::GetSubBlocks(PointsX[Index], PointsY[Index], LayersCount);
+
+			for (int16_t LayerIndex = 0; LayerIndex < LayersCount; LayerIndex++)
+				ScalarSum += GET_GEO_HEIGHT(PointLayers[LayerIndex]) + GET_GEO_NSWE(PointLayers[LayerIndex]);
+		}
+
+		LONGLONG MidTime = GetTime();
+
+		BatchSum = 0;
+
+		for (uint32_t Done = 0; Done < Count; ) {
+
+			uint32_t LayersCount;
+			Done += L2Geodata::GetDecodedSubBlocksBatch(&PointsX[Done], &PointsY[Done], Count - Done, &LayersCounts[Done],
+				Heights.data(), NSWE.data(), (uint32_t)Heights.size(), LayersCount);
+
+			for (uint32_t Index = 0; Index < LayersCount; Index++)
+				BatchSum += Heights[Index] + NSWE[Index];
+		}
+
+		LONGLONG EndTime = GetTime();
+
+		ScalarTime += TimeToMs(MidTime - StartTime);
+		BatchTime += TimeToMs(EndTime - MidTime);
+	}
+
+	cout << "Scalar queries: " << ScalarTime / RunsCount << " ms per " << Count << " cells" << endl;
+	cout << "Batch queries: " << BatchTime / RunsCount << " ms per " << Count << " cells" << endl;
+
+	if (ScalarSum != BatchSum)
+		cout << "Batch results don't match scalar ones" << endl;
+}
+
+void L2GeodataBenchmark::CompareLayerSearch(int32_t WorldX, int32_t WorldY, uint32_t Size, uint32_t RunsCount)
+{
+	struct LayerStep {
+		int16_t SubBlock;
+		int16_t* Layers;
+		int16_t LayersCount;
+	};
+
+	L2Geodata::ReaderGuard Guard;
+
+	vector<LayerStep> Steps;
+	uint64_t DestLayersSum = 0;
+
+	for (uint32_t X = 1; X < Size; X++)
+		for (uint32_t Y = 0; Y < Size; Y++) {
+
+			int32_t PointX = WorldX + (int32_t)X * L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+			int32_t PointY = WorldY + (int32_t)Y * L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+
+			int16_t LayersCount;
+			int16_t* Layers = L2Geodata::GetSubBlocks(PointX, PointY, LayersCount);
+			if (LayersCount < 2)
+				continue;
+
+			int16_t SourceLayersCount;
+			int16_t* SourceLayers = L2Geodata::GetSubBlocks(PointX - L2Geodata::GEO_COORDS_IN_WORLD_COORDS, PointY, SourceLayersCount);
+
+			for (int16_t LayerIndex = 0; LayerIndex < SourceLayersCount; LayerIndex++) {
+				Steps.push_back({ SourceLayers[LayerIndex], Layers, LayersCount });
+				DestLayersSum += LayersCount;
+			}
+		}
+
+	if (Steps.empty()) {
+		cout << "No multilayer cells in the area" << endl;
+		return;
+	}
+
+	// the way layers were searched before, kept here as a reference
+	auto GetDestLayerIndexLinear = [](int16_t SubBlock, int16_t* Layers, int16_t LayersCount, int16_t& DestLayerIndex) {
+
+		if (!L2Geodata::CanGoInThisDirection(SubBlock, 1, 0))
+			return false;
+
+		int16_t LowLayerIndex = -1, HighLayerIndex = -1;
+
+		for (int16_t Index = 0; Index < LayersCount; Index++) {
+
+			if (GET_GEO_HEIGHT(Layers[Index]) <= GET_GEO_HEIGHT(SubBlock)) {
+				LowLayerIndex = Index;
+				break;
+			}
+
+			HighLayerIndex = Index;
+		}
+
+		if (HighLayerIndex != -1 && !L2Geodata::CanGoUnderneath(SubBlock, Layers[HighLayerIndex])) {
+			DestLayerIndex = HighLayerIndex;
+			return true;
+		}
+
+		if (LowLayerIndex != -1) {
+			DestLayerIndex = LowLayerIndex;
+			return true;
+		}
+
+		return false;
+	};
+
+	// checksums keep both paths from being optimized away and show that they agree
+	int64_t LinearSum = 0, SearchSum = 0;
+	double LinearTime = 0, SearchTime = 0;
+
+	for (uint32_t Run = 0; Run < RunsCount; Run++) {
+
+		LinearSum = 0;
+		SearchSum = 0;
+
+		LONGLONG StartTime = GetTime();
+
+		for (LayerStep& Step : Steps) {
+
+			int16_t DestLayerIndex;
+			if (GetDestLayerIndexLinear(Step.SubBlock, Step.Layers, Step.LayersCount, DestLayerIndex))
+				LinearSum += DestLayerIndex + 1;
+		}
+
+		LONGLONG MidTime = GetTime();
+
+		for (LayerStep& Step : Steps) {
+
+			int16_t DestLayerIndex;
+			if (L2Geodata::GetDestLayerIndex(Step.SubBlock, 1, 0, Step.Layers, Step.LayersCount, DestLayerIndex))
+				SearchSum += DestLayerIndex + 1;
+		}
+
+		LONGLONG EndTime = GetTime();
+
+		LinearTime += TimeToMs(MidTime - StartTime);
+		SearchTime += TimeToMs(EndTime - MidTime);
+	}
+
+	cout << Steps.size() << " steps into multilayer cells (" << (double)DestLayersSum / Steps.size() << " layers on average)" << endl;
+	cout << "Linear scan: " << LinearTime / RunsCount << " ms, SSE2 layer search: " << SearchTime / RunsCount << " ms" << endl;
+
+	if (LinearSum != SearchSum)
+		cout << "Layer search results don't match linear scan" << endl;
+}
+
+void L2GeodataBenchmark::LoadWithLayout(GeoLayout Layout, wstring EasyGeoPath, wstring NWCPath)
+{
+	L2Geodata::Unload();
+	L2Geodata::SetLayout(Layout);
+
+	L2Geodata::LoadEasyGeo(EasyGeoPath);
+	L2Geodata::LoadNeighborWeightCache(NWCPath);
+}
+
+void L2GeodataBenchmark::GenerateQueries(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount, vector<pair<XMINT3, XMINT3>>& Queries)
+{
+	mt19937 Random(12345);
+	uniform_int_distribution<int32_t> Offset(-Radius, Radius);
+
+	auto GetGroundPoint = [&](XMINT3& Point) {
+
+		for (;;) {
+			Point.x = CenterX + Offset(Random);
+			Point.y = CenterY + Offset(Random);
+
+			int16_t GroundSubBlock, GroundLayerIndex;
+			if (L2Geodata::GetGroundSubBlock(Point.x, Point.y, INT16_MAX, GroundSubBlock, GroundLayerIndex)) {
+				Point.z = GET_GEO_HEIGHT(GroundSubBlock);
+				return;
+			}
+		}
+	};
+
+	Queries.clear();
+
+	for (uint32_t Index = 0; Index < QueriesCount; Index++) {
+
+		XMINT3 Start, Finish;
+		GetGroundPoint(Start);
+		GetGroundPoint(Finish);
+
+		Queries.push_back({ Start, Finish });
+	}
+}
+
+double L2GeodataBenchmark::RunPathQueries(L2GeodataPathFind& Search, vector<pair<XMINT3, XMINT3>>& Queries, uint32_t& FoundCount,
+	uint64_t& WeightsSum, uint64_t& ExpandedCount)
+{
+	FoundCount = 0;
+	WeightsSum = 0;
+	ExpandedCount = 0;
+
+	LONGLONG StartTime = GetTime();
+
+	for (pair<XMINT3, XMINT3>& Query : Queries) {
+
+		vector<vector<XMINT3>> Path;
+		uint32_t Weight;
+
+		if (Search.FindPath(Query.first, Query.second, Path, Weight)) {
+			FoundCount++;
+			WeightsSum += Weight;
+		}
+
+		ExpandedCount += Search.GetExpandedPointsCount();
+	}
+
+	LONGLONG EndTime = GetTime();
+
+	return (double)TimeToMs(EndTime - StartTime);
+}
+
+void L2GeodataBenchmark::CompareLayouts(wstring EasyGeoPath, wstring NWCPath, int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount)
+{
+	const GeoLayout Layouts[] = { GEO_LAYOUT_LINEAR, GEO_LAYOUT_MORTON };
+	const char* LayoutNames[] = { "linear", "morton" };
+
+	GeoLayout InitialLayout = L2Geodata::GetLayout();
+
+	vector<pair<XMINT3, XMINT3>> Queries;
+	double Times[2];
+
+	for (uint32_t LayoutIndex = 0; LayoutIndex < 2; LayoutIndex++) {
+
+		LoadWithLayout(Layouts[LayoutIndex], EasyGeoPath, NWCPath);
+
+		if (Queries.empty())
+			GenerateQueries(CenterX, CenterY, Radius, QueriesCount, Queries);
+
+		L2GeodataPathFind Search;
+
+		uint32_t FoundCount;
+		uint64_t WeightsSum, ExpandedCount;
+
+		Times[LayoutIndex] = RunPathQueries(Search, Queries, FoundCount, WeightsSum, ExpandedCount);
+
+		cout << "Layout " << LayoutNames[LayoutIndex] << ": " << Queries.size() << " queries (" << FoundCount << " found) for " << Times[LayoutIndex] << " ms" << endl;
+	}
+
+	LoadWithLayout(InitialLayout, EasyGeoPath, NWCPath);
+
+	cout << "Morton / linear FindPath time: " << (Times[0] > 0 ? Times[1] / Times[0] : 0.0) << endl;
+}
+
+void L2GeodataBenchmark::CompareLineOfSight(int32_t CenterX, int32_t CenterY, int32_t Radius, int32_t MaxDistance, uint32_t QueriesCount)
+{
+	mt19937 Random(12345);
+	uniform_int_distribution<int32_t> Offset(-Radius, Radius);
+	uniform_int_distribution<int32_t> TargetOffset(-MaxDistance, MaxDistance);
+
+	auto GetGroundPoint = [](XMINT3& Point) {
+
+		int16_t GroundSubBlock, GroundLayerIndex;
+		if (!L2Geodata::GetGroundSubBlock(Point.x, Point.y, INT16_MAX, GroundSubBlock, GroundLayerIndex))
+			return false;
+
+		Point.z = GET_GEO_HEIGHT(GroundSubBlock);
+		return true;
+	};
+
+	vector<XMINT3> Casters, Targets;
+
+	while (Casters.size() < QueriesCount) {
+
+		XMINT3 Caster(CenterX + Offset(Random), CenterY + Offset(Random), 0);
+		XMINT3 Target(Caster.x + TargetOffset(Random), Caster.y + TargetOffset(Random), 0);
+
+		if (!GetGroundPoint(Caster) || !GetGroundPoint(Target))
+			continue;
+
+		Casters.push_back(Caster);
+		Targets.push_back(Target);
+	}
+
+	// vector<bool> is packed, batch needs plain array
+	unique_ptr<bool[]> Results(new bool[QueriesCount]);
+
+	uint32_t SingleVisible = 0, BatchVisible = 0;
+
+	LONGLONG StartTime = GetTime();
+
+	for (uint32_t Index = 0; Index < QueriesCount; Index++)
+		SingleVisible += L2GeodataLineOfSight::CanSee(Casters[Index], Targets[Index]) ? 1 : 0;
+
+	LONGLONG MidTime = GetTime();
+
+	L2GeodataLineOfSight::CanSeeBatch(Casters.data(), Targets.data(), QueriesCount, Results.get());
+
+	LONGLONG EndTime = GetTime();
+
+	for (uint32_t Index = 0; Index < QueriesCount; Index++)
+		BatchVisible += Results[Index] ? 1 : 0;
+
+	double SingleTime = (double)TimeToMs(MidTime - StartTime);
+	double BatchTime = (double)TimeToMs(EndTime - MidTime);
+
+	cout << QueriesCount << " LOS queries, " << SingleVisible << " visible" << endl;
+	cout << "CanSee: " << SingleTime << " ms, " << (SingleTime > 0 ? QueriesCount / SingleTime * 1000.0 : 0.0) << " queries/s per core" << endl;
+	cout << "CanSeeBatch: " << BatchTime << " ms, " << (BatchTime > 0 ? QueriesCount / BatchTime * 1000.0 : 0.0) << " queries/s per core" << endl;
+
+	if (SingleVisible != BatchVisible)
+		cout << "Batch LOS results don't match single ones" << endl;
+}
+
+void L2GeodataBenchmark::CompareRaycast(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount)
+{
+	const int32_t CAMERA_HEIGHT = 2000;
+
+	mt19937 Random(12345);
+	uniform_int_distribution<int32_t> Offset(-Radius / 2, Radius / 2);
+	uniform_int_distribution<int32_t> TargetOffset(-Radius, Radius);
+
+	vector<XMINT3> Origins, Targets;
+
+	while (Origins.size() < QueriesCount) {
+
+		XMINT3 Origin(CenterX + Offset(Random), CenterY + Offset(Random), 0);
+
+		int16_t GroundSubBlock, GroundLayerIndex;
+		if (!L2Geodata::GetGroundSubBlock(Origin.x, Origin.y, INT16_MAX, GroundSubBlock, GroundLayerIndex))
+			continue;
+
+		Origin.z = GET_GEO_HEIGHT(GroundSubBlock) + CAMERA_HEIGHT;
+
+		// far below the ground, so every ray ends on terrain unless it leaves the map
+		Origins.push_back(Origin);
+		Targets.push_back({ Origin.x + TargetOffset(Random), Origin.y + TargetOffset(Random), Origin.z - 4 * CAMERA_HEIGHT });
+	}
+
+	const char* ModeNames[] = { "cell walk", "height pyramid" };
+
+	double Times[2];
+	uint32_t HitsCounts[2];
+	int64_t HitsSums[2];
+
+	for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++) {
+
+		if (ModeIndex == 0)
+			L2GeodataRaycast::FreePyramids();
+		else
+			L2GeodataRaycast::BuildPyramids();
+
+		HitsCounts[ModeIndex] = 0;
+		HitsSums[ModeIndex] = 0;
+
+		LONGLONG StartTime = GetTime();
+
+		for (uint32_t Index = 0; Index < QueriesCount; Index++) {
+
+			XMINT3 Hit;
+			if (L2GeodataRaycast::Raycast(Origins[Index], Targets[Index], Hit)) {
+				HitsCounts[ModeIndex]++;
+				HitsSums[ModeIndex] += Hit.x + Hit.y + Hit.z;
+			}
+		}
+
+		LONGLONG EndTime = GetTime();
+
+		Times[ModeIndex] = (double)TimeToMs(EndTime - StartTime);
+
+		cout << ModeNames[ModeIndex] << ": " << QueriesCount << " rays (" << HitsCounts[ModeIndex] << " hits) for " << Times[ModeIndex] << " ms" << endl;
+	}
+
+	if (HitsCounts[0] != HitsCounts[1] || HitsSums[0] != HitsSums[1])
+		cout << "Pyramid raycast results don't match cell walk" << endl;
+}
+
+void L2GeodataBenchmark::CompareArchive(wstring EasyGeoPath, wstring ArchivePath, uint32_t RunsCount)
+{
+	L2Geodata::Unload();
+	L2Geodata::LoadEasyGeo(EasyGeoPath);
+
+	uint64_t RawSize = L2Geodata::GetResidentSize();
+
+	L2GeodataCodec::SaveArchive(ArchivePath);
+
+	uint64_t EasyGeoSize = file_size(EasyGeoPath);
+	uint64_t ArchiveSize = file_size(ArchivePath);
+
+	double EasyGeoTime = 0, ArchiveTime = 0;
+
+	for (uint32_t Run = 0; Run < RunsCount; Run++) {
+
+		L2Geodata::Unload();
+
+		LONGLONG StartTime = GetTime();
+
+		L2Geodata::LoadEasyGeo(EasyGeoPath);
+
+		LONGLONG MiddleTime = GetTime();
+
+		L2Geodata::Unload();
+
+		LONGLONG ArchiveStartTime = GetTime();
+
+		L2GeodataCodec::LoadArchive(ArchivePath);
+
+		LONGLONG EndTime = GetTime();
+
+		double Time = (double)TimeToMs(MiddleTime - StartTime);
+		if (Run == 0 || Time < EasyGeoTime)
+			EasyGeoTime = Time;
+
+		Time = (double)TimeToMs(EndTime - ArchiveStartTime);
+		if (Run == 0 || Time < ArchiveTime)
+			ArchiveTime = Time;
+	}
+
+	// EasyGeo is only mapped here, its pages are read later on first access
+	cout << "EasyGeo: " << EasyGeoSize / (1024 * 1024) << " MB, mapped for " << EasyGeoTime << " ms" << endl;
+	cout << "Archive: " << ArchiveSize / (1024 * 1024) << " MB, loaded for " << ArchiveTime << " ms, " << 
+		(ArchiveTime > 0 ? RawSize / (1024.0 * 1024.0 * 1024.0) / (ArchiveTime / 1000.0) : 0.0) << " GB/s" << endl;
+	cout << "Compression ratio: " << (ArchiveSize > 0 ? (double)RawSize / ArchiveSize : 0.0) << " (regions), " << 
+		(ArchiveSize > 0 ? (double)EasyGeoSize / ArchiveSize : 0.0) << " (EasyGeo file)" << endl;
+}
+
+void L2GeodataBenchmark::CompareLargePages(wstring Directory, GeoType Type, wstring NWCPath, int32_t CenterX, int32_t CenterY, int32_t Radius, 
+	uint32_t QueriesCount)
+{
+	const char* ModeNames[] = { "regular pages", "large pages" };
+
+	vector<pair<XMINT3, XMINT3>> Queries;
+	double LoadTimes[2], SearchTimes[2];
+
+	for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++) {
+
+		L2Geodata::Unload();
+
+		if (!L2Geodata::EnableLargePages(ModeIndex == 1)) {
+			cout << "Large pages are not available, nothing to compare" << endl;
+			return;
+		}
+
+		LONGLONG StartTime = GetTime();
+
+		L2Geodata::Load(Directory, Type);
+		L2Geodata::LoadNeighborWeightCache(NWCPath);
+
+		LONGLONG LoadEndTime = GetTime();
+
+		if (Queries.empty())
+			GenerateQueries(CenterX, CenterY, Radius, QueriesCount, Queries);
+
+		L2GeodataPathFind Search;
+
+		uint32_t FoundCount;
+		uint64_t WeightsSum, ExpandedCount;
+
+		LoadTimes[ModeIndex] = (double)TimeToMs(LoadEndTime - StartTime);
+		SearchTimes[ModeIndex] = RunPathQueries(Search, Queries, FoundCount, WeightsSum, ExpandedCount);
+	}
+
+	L2Geodata::LargePageStats LargePages = L2Geodata::GetLargePageStats();
+
+	for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++)
+		cout << ModeNames[ModeIndex] << ": loaded for " << LoadTimes[ModeIndex] << " ms, " << Queries.size() << " queries for " << 
+			SearchTimes[ModeIndex] << " ms" << endl;
+
+	cout << "Large page backed size: " << LargePages.Size / (1024 * 1024) << " MB (" << LargePages.Fallbacks << " fallbacks)" << endl;
+}
+
+void L2GeodataBenchmark::CompareViews(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t ViewsCount, uint32_t QueriesCount)
+{
+	const uint32_t GATE_LENGTH = 16;
+
+	vector<pair<XMINT3, XMINT3>> Queries;
+	GenerateQueries(CenterX, CenterY, Radius, QueriesCount, Queries);
+
+	L2GeodataOverlay* BaseView = L2Geodata::GetActiveOverlay();
+
+	vector<L2GeodataOverlay*> Views;
+	uint64_t ViewsSize = 0;
+
+	for (uint32_t ViewIndex = 0; ViewIndex < ViewsCount; ViewIndex++) {
+
+		L2GeodataOverlay* View = new L2GeodataOverlay(BaseView);
+
+		int32_t GateX = CenterX - Radius / 2 + (int32_t)(ViewIndex % GATE_LENGTH) * L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+
+		for (uint32_t CellIndex = 0; CellIndex < GATE_LENGTH; CellIndex++)
+			View->SetNSWE(GateX, CenterY + (int32_t)CellIndex * L2Geodata::GEO_COORDS_IN_WORLD_COORDS, INT16_MAX, 0);
+
+		ViewsSize += View->GetMemoryUsage();
+
+		Views.push_back(View);
+	}
+
+	L2GeodataPathFind Search;
+
+	double Times[2];
+
+	for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++) {
+
+		LONGLONG StartTime = GetTime();
+
+		for (uint32_t QueryIndex = 0; QueryIndex < Queries.size(); QueryIndex++) {
+
+			vector<vector<XMINT3>> Path;
+			uint32_t Weight;
+
+			L2GeodataOverlay* View = ModeIndex == 1 && !Views.empty() ? Views[QueryIndex % Views.size()] : nullptr;
+
+			Search.FindPath(Queries[QueryIndex].first, Queries[QueryIndex].second, Path, Weight, NULL, View);
+		}
+
+		LONGLONG EndTime = GetTime();
+
+		Times[ModeIndex] = (double)TimeToMs(EndTime - StartTime);
+	}
+
+	for (L2GeodataOverlay* View : Views)
+		delete View;
+
+	cout << Views.size() << " views take " << ViewsSize / 1024 << " KB (" << (Views.empty() ? 0 : ViewsSize / Views.size()) << " bytes per view)" << endl;
+	cout << "Without view: " << Queries.size() << " queries for " << Times[0] << " ms, with views: " << Times[1] << " ms" << endl;
+}
+
+void L2GeodataBenchmark::CompareSpatialQueries(int32_t DenseX, int32_t DenseY, int32_t SparseX, int32_t SparseY, int32_t Radius,
+	uint32_t QueriesCount)
+{
+	const int32_t MAX_DISTANCE = 2048;
+	const int32_t MAX_HEIGHT_DIFF = 512;
+
+	const char* AreaNames[] = { "dense", "sparse" };
+	POINT Centers[] = { { DenseX, DenseY }, { SparseX, SparseY } };
+	const char* ModeNames[] = { "cell by cell", "block summaries" };
+
+	for (uint32_t AreaIndex = 0; AreaIndex < 2; AreaIndex++) {
+
+		mt19937 Random(12345);
+		uniform_int_distribution<int32_t> Offset(-Radius, Radius);
+		uniform_int_distribution<int32_t> Height(-4096, 4096);
+
+		// points in the air and under the ground too, nearest walkable cell is rarely right below
+		vector<XMINT3> Points;
+		for (uint32_t Index = 0; Index < QueriesCount; Index++)
+			Points.push_back({ Centers[AreaIndex].x + Offset(Random), Centers[AreaIndex].y + Offset(Random), Height(Random) });
+
+		double NearestTimes[2], RandomTimes[2];
+		uint32_t FoundCounts[2];
+		int64_t DistanceSums[2];
+
+		for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++) {
+
+			// without summaries every block is reported as walkable and its cells are checked one by one
+			if (ModeIndex == 0)
+				L2GeodataSpatial::FreeSummaries();
+			else
+				L2GeodataSpatial::BuildSummaries();
+
+			FoundCounts[ModeIndex] = 0;
+			DistanceSums[ModeIndex] = 0;
+
+			LONGLONG StartTime = GetTime();
+
+			for (XMINT3& Point : Points) {
+
+				XMINT3 Result;
+				if (L2GeodataSpatial::FindNearestWalkable(Point, MAX_DISTANCE, Result)) {
+
+					int64_t DX = Result.x - Point.x, DY = Result.y - Point.y, DZ = Result.z - Point.z;
+
+					FoundCounts[ModeIndex]++;
+					DistanceSums[ModeIndex] += DX * DX + DY * DY + DZ * DZ;
+				}
+			}
+
+			LONGLONG MiddleTime = GetTime();
+
+			mt19937 PointRandom(54321);
+			uint32_t RandomFoundCount = 0;
+
+			for (XMINT3& Point : Points) {
+
+				XMINT3 Result;
+				if (L2GeodataSpatial::FindRandomWalkable(Point, Radius, MAX_HEIGHT_DIFF, PointRandom, Result))
+					RandomFoundCount++;
+			}
+
+			LONGLONG EndTime = GetTime();
+
+			NearestTimes[ModeIndex] = (double)TimeToMs(MiddleTime - StartTime);
+			RandomTimes[ModeIndex] = (double)TimeToMs(EndTime - MiddleTime);
+
+			cout << AreaNames[AreaIndex] << ", " << ModeNames[ModeIndex] << ": " << QueriesCount << " nearest queries (" << FoundCounts[ModeIndex] <<
+				" found) for " << NearestTimes[ModeIndex] << " ms, random queries (" << RandomFoundCount << " found) for " << RandomTimes[ModeIndex] << " ms" << endl;
+		}
+
+		// nearest cell can differ between equally distant ones, distance can't
+		if (FoundCounts[0] != FoundCounts[1] || DistanceSums[0] != DistanceSums[1])
+			cout << "Nearest walkable results with summaries don't match cell by cell search" << endl;
+	}
+}
+
+void L2GeodataBenchmark::CompareOpenLists(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount)
+{
+	const char* ModeNames[] = { "sorted vector", "radix heap" };
+
+	vector<pair<XMINT3, XMINT3>> Queries;
+	GenerateQueries(CenterX, CenterY, Radius, QueriesCount, Queries);
+
+	double Times[2];
+	uint64_t ExpandedCounts[2];
+
+	for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++) {
+
+		L2GeodataPathFind Search;
+		Search.SetSortedOpenList(ModeIndex == 0);
+
+		uint32_t FoundCount;
+		uint64_t WeightsSum;
+
+		Times[ModeIndex] = RunPathQueries(Search, Queries, FoundCount, WeightsSum, ExpandedCounts[ModeIndex]);
+
+		cout << ModeNames[ModeIndex] << ": " << Queries.size() << " queries (" << FoundCount << " found, weights sum " << WeightsSum << ") for " <<
+			Times[ModeIndex] << " ms, " << ExpandedCounts[ModeIndex] << " points expanded, " <<
+			(Times[ModeIndex] > 0 ? (uint64_t)(ExpandedCounts[ModeIndex] * 1000.0 / Times[ModeIndex]) : 0) << " points per second" << endl;
+	}
+
+	// equal weights are taken in different order, so expanded counts and paths can differ a little
+	cout << "Radix heap / sorted vector FindPath time: " << (Times[0] > 0 ? Times[1] / Times[0] : 0.0) << endl;
+}
+
+void L2GeodataBenchmark::ComparePathFindService(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount)
+{
+	vector<pair<XMINT3, XMINT3>> Queries;
+	GenerateQueries(CenterX, CenterY, Radius, QueriesCount, Queries);
+
+	uint32_t MaxWorkersCount = thread::hardware_concurrency();
+	if (MaxWorkersCount == 0)
+		MaxWorkersCount = 1;
+
+	double SingleWorkerSpeed = 0;
+
+	for (uint32_t WorkersCount = 1; ; WorkersCount = min(WorkersCount * 2, MaxWorkersCount)) {
+
+		L2GeodataPathFindService Service(WorkersCount);
+
+		// first pass warms up search contexts of the workers (region buffer pools)
+		for (uint32_t Pass = 0; Pass < 2; Pass++) {
+
+			vector<future<PathFindResult>> Results;
+			Results.reserve(Queries.size());
+
+			LONGLONG StartTime = GetTime();
+
+			for (pair<XMINT3, XMINT3>& Query : Queries)
+				Results.push_back(Service.FindPath(Query.first, Query.second));
+
+			uint32_t FoundCount = 0, FailedCount = 0;
+			for (future<PathFindResult>& Result : Results) {
+				try {
+					if (Result.get().Found)
+						FoundCount++;
+				}
+				catch (runtime_error* Error) {
+					delete Error;
+					FailedCount++;
+				}
+			}
+
+			LONGLONG EndTime = GetTime();
+
+			if (Pass == 0)
+				continue;
+
+			double Time = (double)TimeToMs(EndTime - StartTime);
+			double Speed = Time > 0 ? Queries.size() * 1000.0 / Time : 0;
+
+			if (WorkersCount == 1)
+				SingleWorkerSpeed = Speed;
+
+			cout << WorkersCount << " workers: " << Queries.size() << " queries (" << FoundCount << " found, " << FailedCount << " failed) for " << Time << " ms, " <<
+				(uint64_t)Speed << " queries per second, speedup " << (SingleWorkerSpeed > 0 ? Speed / SingleWorkerSpeed : 0.0) << endl;
+		}
+
+		if (WorkersCount == MaxWorkersCount)
+			break;
+	}
+}
+
+void L2GeodataBenchmark::CompareHierarchicalPathFind(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount)
+{
+	L2GeodataHierarchicalPathFind::BuildGraph();
+
+	vector<pair<XMINT3, XMINT3>> Queries;
+	GenerateQueries(CenterX, CenterY, Radius, QueriesCount, Queries);
+
+	const char* ModeNames[] = { "flat A*", "hierarchical" };
+
+	L2GeodataPathFind FlatSearch;
+	L2GeodataHierarchicalPathFind HierarchicalSearch;
+
+	double Times[2], MaxTimes[2];
+	uint64_t WeightsSums[2];
+
+	for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++) {
+
+		uint32_t FoundCount = 0;
+
+		Times[ModeIndex] = 0;
+		MaxTimes[ModeIndex] = 0;
+		WeightsSums[ModeIndex] = 0;
+
+		for (pair<XMINT3, XMINT3>& Query : Queries) {
+
+			vector<vector<XMINT3>> Path;
+			uint32_t Weight;
+
+			LONGLONG StartTime = GetTime();
+
+			bool Found = ModeIndex == 0 ? FlatSearch.FindPath(Query.first, Query.second, Path, Weight) :
+				HierarchicalSearch.FindPath(Query.first, Query.second, Path, Weight);
+
+			LONGLONG EndTime = GetTime();
+
+			double Time = (double)TimeToMs(EndTime - StartTime);
+
+			Times[ModeIndex] += Time;
+			MaxTimes[ModeIndex] = max(MaxTimes[ModeIndex], Time);
+
+			if (Found) {
+				FoundCount++;
+				WeightsSums[ModeIndex] += Weight;
+			}
+		}
+
+		cout << ModeNames[ModeIndex] << ": " << Queries.size() << " queries (" << FoundCount << " found) for " << Times[ModeIndex] << " ms, " <<
+			(Queries.empty() ? 0.0 : Times[ModeIndex] / Queries.size()) << " ms average, " << MaxTimes[ModeIndex] << " ms max" << endl;
+	}
+
+	// hierarchical paths go through entrance nodes, so they are a little longer than optimal ones
+	cout << "Hierarchical / flat time: " << (Times[0] > 0 ? Times[1] / Times[0] : 0.0) << ", weight: " <<
+		(WeightsSums[0] > 0 ? (double)WeightsSums[1] / WeightsSums[0] : 0.0) << endl;
+}
+
+void L2GeodataBenchmark::CompareJumpPoints(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount)
+{
+	const char* ModeNames[] = { "cell by cell", "jump points" };
+
+	vector<pair<XMINT3, XMINT3>> Queries;
+	GenerateQueries(CenterX, CenterY, Radius, QueriesCount, Queries);
+
+	double Times[2];
+	uint64_t ExpandedCounts[2], WeightsSums[2];
+
+	for (uint32_t ModeIndex = 0; ModeIndex < 2; ModeIndex++) {
+
+		L2GeodataPathFind Search;
+		Search.SetJumpPointSearch(ModeIndex == 1);
+
+		uint32_t FoundCount;
+
+		Times[ModeIndex] = RunPathQueries(Search, Queries, FoundCount, WeightsSums[ModeIndex], ExpandedCounts[ModeIndex]);
+
+		cout << ModeNames[ModeIndex] << ": " << Queries.size() << " queries (" << FoundCount << " found, weights sum " << WeightsSums[ModeIndex] << ") for " <<
+			Times[ModeIndex] << " ms, " << ExpandedCounts[ModeIndex] << " points expanded" << endl;
+	}
+
+	// jumps keep optimal paths on uniform ground, weight ratio shows how far they are from cell by cell ones
+	cout << "Jump points / cell by cell time: " << (Times[0] > 0 ? Times[1] / Times[0] : 0.0) << ", expanded points: " <<
+		(ExpandedCounts[0] > 0 ? (double)ExpandedCounts[1] / ExpandedCounts[0] : 0.0) << ", weight: " <<
+		(WeightsSums[0] > 0 ? (double)WeightsSums[1] / WeightsSums[0] : 0.0) << endl;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+
+#include <vector>
+#include <DirectXMath.h>
+
+#include "L2Geodata.h"
+
+using namespace std;
+using namespace DirectX;
+
+class L2GeodataPathFind;
+
+class L2GeodataBenchmark {
+private:
+	static uint64_t GetDirectorySize(wstring Directory);
+	static double LoadDirectory(wstring Directory, GeoType Type, uint32_t RunsCount);
+	static void LoadWithLayout(GeoLayout Layout, wstring EasyGeoPath, wstring NWCPath);
+	static void GenerateQueries(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount, vector<pair<XMINT3, XMINT3>>& Queries);
+	// runs every query through Search, returns time in ms, Found / WeightsSum / Expanded are totals over the queries
+	static double RunPathQueries(L2GeodataPathFind& Search, vector<pair<XMINT3, XMINT3>>& Queries, uint32_t& FoundCount, uint64_t& WeightsSum,
+		uint64_t& ExpandedCount);
+public:
+	// loads both directories several times and prints best throughput of each loader
+	static void CompareLoaders(wstring PTSDirectory, wstring L2JDirectory, uint32_t RunsCount = 3);
+	// queries Size x Size geo cells starting from world point with per-cell GetSubBlocks and with batch API
+	static void CompareBatchQueries(int32_t WorldX, int32_t WorldY, uint32_t Size, uint32_t RunsCount = 10);
+	// runs the same FindPath queries (random, but fixed seed) with linear and Morton layouts,
+	// cache miss counts have to be taken with an external profiler (VTune, WPR) while it runs
+	static void CompareLayouts(wstring EasyGeoPath, wstring NWCPath, int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount = 50);
+	// steps from every layer of Size x Size geo cells into the next cell (where it has more than one layer)
+	// with GetDestLayerIndex and with plain linear layer scan, meant for multilayer-dense areas like towns and towers
+	static void CompareLayerSearch(int32_t WorldX, int32_t WorldY, uint32_t Size, uint32_t RunsCount = 10);
+	// runs caster / target pairs (ground points at most MaxDistance apart) through CanSee one by one and through CanSeeBatch,
+	// prints queries per second of a single thread
+	static void CompareLineOfSight(int32_t CenterX, int32_t CenterY, int32_t Radius, int32_t MaxDistance = 1000, uint32_t QueriesCount = 1000000);
+	// casts rays from high above random points down to ground up to Radius away (camera picks) with and without
+	// height pyramids, pyramids stay built afterwards
+	static void CompareRaycast(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount = 100000);
+	// converts EasyGeo into compressed archive, then loads both several times and prints
+	// compression ratio, best load times and archive decode throughput
+	static void CompareArchive(wstring EasyGeoPath, wstring ArchivePath, uint32_t RunsCount = 3);
+	// loads region files and NWC with regular and with large pages and runs the same FindPath queries on both,
+	// dTLB miss counts have to be taken with an external profiler while it runs, geodata stays loaded with large pages
+	static void CompareLargePages(wstring Directory, GeoType Type, wstring NWCPath, int32_t CenterX, int32_t CenterY, int32_t Radius, 
+		uint32_t QueriesCount = 50);
+	// creates instance views on top of current geodata, each one closing its own gate line near the center,
+	// prints memory taken per view and FindPath time without a view and with views used round-robin
+	static void CompareViews(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t ViewsCount = 1000, uint32_t QueriesCount = 50);
+	// runs nearest walkable and random walkable queries around a dense (town) and a sparse (mountains, water) area
+	// with and without block summaries, summaries stay built afterwards
+	static void CompareSpatialQueries(int32_t DenseX, int32_t DenseY, int32_t SparseX, int32_t SparseY, int32_t Radius = 1000,
+		uint32_t QueriesCount = 10000);
+	// runs the same FindPath queries with sorted vector and radix heap open lists, prints points expanded per second
+	static void CompareOpenLists(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount = 50);
+	// runs the same FindPath queries through the service with 1, 2, 4... workers up to hardware threads count,
+	// prints queries per second and speedup against a single worker
+	static void ComparePathFindService(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount = 2000);
+	// builds cluster graph and runs the same long FindPath queries (Radius should be several clusters, e.g. 32768)
+	// with flat and hierarchical search, prints average and worst latency and path weight ratio, graph stays built afterwards
+	static void CompareHierarchicalPathFind(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount = 20);
+	// runs the same FindPath queries with and without jump points, meant for open fields (plains, sea floor) where
+	// queries still need a search (scattered trees and rocks), straight unobstructed ones don't search at all
+	static void CompareJumpPoints(int32_t CenterX, int32_t CenterY, int32_t Radius, uint32_t QueriesCount = 50);
+};
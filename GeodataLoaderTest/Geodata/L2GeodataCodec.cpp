@@ -0,0 +1,630 @@
+#include "stdafx.h"
+
+#include "L2GeodataCodec.h"
+
+#include <iostream>
+#include <fstream>
+
+#include "TimeUtils.h"
+
+// streams
+
+void L2GeodataCodec::ByteWriter::WriteVarint(uint32_t Value)
+{
+	while (Value >= 0x80) {
+		Data.push_back((uint8_t)(Value | 0x80));
+		Value >>= 7;
+	}
+
+	Data.push_back((uint8_t)Value);
+}
+
+// zigzag, so small negative deltas stay short
+void L2GeodataCodec::ByteWriter::WriteSignedVarint(int32_t Value)
+{
+	WriteVarint(((uint32_t)Value << 1) ^ (uint32_t)(Value >> 31));
+}
+
+void L2GeodataCodec::ByteWriter::WriteUInt64(uint64_t Value)
+{
+	Data.insert(Data.end(), (uint8_t*)&Value, (uint8_t*)&Value + sizeof(Value));
+}
+
+void L2GeodataCodec::NibbleWriter::Write(uint8_t Nibble)
+{
+	if (HalfByte)
+		Data.back() |= (uint8_t)(Nibble << 4);
+	else
+		Data.push_back(Nibble & 0x0F);
+
+	HalfByte = !HalfByte;
+}
+
+uint32_t L2GeodataCodec::ByteReader::ReadVarint(void)
+{
+	uint32_t Value = 0;
+
+	for (uint32_t Shift = 0; Shift < 35; Shift += 7) {
+
+		if (Position >= End)
+			throw new runtime_error("Geo archive chunk is truncated");
+
+		uint8_t Byte = *Position++;
+
+		Value |= (uint32_t)(Byte & 0x7F) << Shift;
+		if ((Byte & 0x80) == 0)
+			return Value;
+	}
+
+	throw new runtime_error("Invalid varint in geo archive chunk");
+}
+
+int32_t L2GeodataCodec::ByteReader::ReadSignedVarint(void)
+{
+	uint32_t Value = ReadVarint();
+
+	return (int32_t)(Value >> 1) ^ -(int32_t)(Value & 1);
+}
+
+uint64_t L2GeodataCodec::ByteReader::ReadUInt64(void)
+{
+	if (End - Position < (ptrdiff_t)sizeof(uint64_t))
+		throw new runtime_error("Geo archive chunk is truncated");
+
+	uint64_t Value;
+	memcpy(&Value, Position, sizeof(Value));
+	Position += sizeof(Value);
+
+	return Value;
+}
+
+uint8_t L2GeodataCodec::NibbleReader::Read(void)
+{
+	if (Position >= End)
+		throw new runtime_error("Geo archive chunk is truncated");
+
+	uint8_t Nibble;
+
+	if (HalfByte) {
+		Nibble = *Position++ >> 4;
+	}
+	else
+		Nibble = *Position & 0x0F;
+
+	HalfByte = !HalfByte;
+
+	return Nibble;
+}
+
+// chunk layout (byte stream):
+//   block runs in region block order: varint (length - 1) << 2 | type, flat run is followed by height delta from previous flat run
+//   complex blocks: varint flag of empty cells (and 64-bit mask if set), then height delta of every non-empty cell,
+//     first cell against first cell of previous complex block, the rest against previous cell
+//   multilayer blocks: for every cell varint layers count (0 if cell is empty) and height deltas,
+//     first layer against first layer of previous cell, the rest against previous layer
+// nibble stream holds NSWE of flat runs, complex cells and layers in the same order
+
+void L2GeodataCodec::EncodeRegion(CodecTask& Task)
+{
+	typedef L2Geodata L2G;
+
+	const uint32_t BlocksCount = L2G::GEO_REGION_SIZE_IN_BLOCKS * L2G::GEO_REGION_SIZE_IN_BLOCKS;
+
+	L2G::GeoRegion* Region = Task.Region;
+	ByteWriter& Bytes = Task.Bytes;
+	NibbleWriter& Nibbles = Task.Nibbles;
+
+	uint32_t ComplexBlocksCount = 0, MultilayerBlocksCount = 0, LayersCount = 0;
+
+	// block runs
+
+	int32_t PrevFlatHeight = 0;
+
+	for (uint32_t BlockIndex = 0; BlockIndex < BlocksCount;) {
+
+		L2G::GeoBlock Block = Region->Blocks[BlockIndex];
+
+		uint32_t RunLength = 1;
+		while (BlockIndex + RunLength < BlocksCount) {
+
+			L2G::GeoBlock& NextBlock = Region->Blocks[BlockIndex + RunLength];
+			if (NextBlock.Type != Block.Type || (Block.Type == L2G::GEO_BLOCK_FLAT && NextBlock.Data != Block.Data))
+				break;
+
+			RunLength++;
+		}
+
+		Bytes.WriteVarint((RunLength - 1) << 2 | Block.Type);
+
+		switch (Block.Type) {
+		case L2G::GEO_BLOCK_FLAT:
+
+			Bytes.WriteSignedVarint(GetHeightField(Block.Data) - PrevFlatHeight);
+			Nibbles.Write(Block.Data & 0x0F);
+
+			PrevFlatHeight = GetHeightField(Block.Data);
+			break;
+		case L2G::GEO_BLOCK_COMPLEX:
+
+			ComplexBlocksCount += RunLength;
+			break;
+		case L2G::GEO_BLOCK_MULTILAYER:
+
+			MultilayerBlocksCount += RunLength;
+			break;
+		}
+
+		BlockIndex += RunLength;
+	}
+
+	// complex blocks
+
+	int32_t PrevBlockHeight = 0;
+
+	for (uint32_t BlockIndex = 0; BlockIndex < BlocksCount; BlockIndex++) {
+
+		L2G::GeoBlock Block = Region->Blocks[BlockIndex];
+		if (Block.Type != L2G::GEO_BLOCK_COMPLEX)
+			continue;
+
+		int16_t* Cells = &Region->GetComplexBlocks()[(uint16_t)Block.Data][0][0];
+
+		uint64_t EmptyMask = 0;
+		for (uint32_t CellIndex = 0; CellIndex < L2G::GEO_BLOCK_AREA_SIZE; CellIndex++)
+			if (Cells[CellIndex] == L2G::SPECIAL_SUBBLOCK_EMPTY)
+				EmptyMask |= 1ULL << CellIndex;
+
+		Bytes.WriteVarint(EmptyMask != 0);
+		if (EmptyMask != 0)
+			Bytes.WriteUInt64(EmptyMask);
+
+		int32_t PrevHeight = PrevBlockHeight;
+		bool IsFirst = true;
+
+		for (uint32_t CellIndex = 0; CellIndex < L2G::GEO_BLOCK_AREA_SIZE; CellIndex++) {
+
+			if (EmptyMask & (1ULL << CellIndex))
+				continue;
+
+			int32_t Height = GetHeightField(Cells[CellIndex]);
+
+			Bytes.WriteSignedVarint(Height - PrevHeight);
+			Nibbles.Write(Cells[CellIndex] & 0x0F);
+
+			PrevHeight = Height;
+
+			if (IsFirst) {
+				PrevBlockHeight = Height;
+				IsFirst = false;
+			}
+		}
+	}
+
+	// multilayer blocks
+
+	int16_t* Layers = Region->GetLayers();
+	int32_t PrevCellHeight = 0;
+
+	for (uint32_t BlockIndex = 0; BlockIndex < BlocksCount; BlockIndex++) {
+
+		L2G::GeoBlock Block = Region->Blocks[BlockIndex];
+		if (Block.Type != L2G::GEO_BLOCK_MULTILAYER)
+			continue;
+
+		int32_t* LayerIndices = &Region->GetMultilayerBlocks()[(uint16_t)Block.Data][0][0];
+
+		for (uint32_t CellIndex = 0; CellIndex < L2G::GEO_BLOCK_AREA_SIZE; CellIndex++) {
+
+			int32_t LayersIndex = LayerIndices[CellIndex];
+			if (LayersIndex == -1) {
+				Bytes.WriteVarint(0);
+				continue;
+			}
+
+			int16_t CellLayersCount = Layers[LayersIndex];
+			int16_t* CellLayers = &Layers[LayersIndex + 1];
+
+			Bytes.WriteVarint(CellLayersCount);
+			LayersCount += 1 + CellLayersCount;
+
+			int32_t PrevHeight = PrevCellHeight;
+
+			for (int16_t LayerIndex = 0; LayerIndex < CellLayersCount; LayerIndex++) {
+
+				int32_t Height = GetHeightField(CellLayers[LayerIndex]);
+
+				Bytes.WriteSignedVarint(Height - PrevHeight);
+				Nibbles.Write(CellLayers[LayerIndex] & 0x0F);
+
+				PrevHeight = Height;
+
+				if (LayerIndex == 0)
+					PrevCellHeight = Height;
+			}
+		}
+	}
+
+	ArchiveChunk& Chunk = Task.Chunk;
+	Chunk.RegionX = (uint16_t)Task.RegionX;
+	Chunk.RegionY = (uint16_t)Task.RegionY;
+	Chunk.Layout = Region->Layout;
+	Chunk.ComplexBlocksCount = ComplexBlocksCount;
+	Chunk.MultilayerBlocksCount = MultilayerBlocksCount;
+	Chunk.LayersCount = LayersCount;
+	Chunk.BytesSize = (uint32_t)Bytes.Data.size();
+	Chunk.NibblesSize = (uint32_t)Nibbles.Data.size();
+}
+
+// decodes straight into region blob, tables are filled in the order they were written, so no builder is needed
+L2Geodata::GeoRegion* L2GeodataCodec::DecodeRegion(const ArchiveChunk& Chunk, const uint8_t* Data)
+{
+	typedef L2Geodata L2G;
+
+	const uint32_t BlocksCount = L2G::GEO_REGION_SIZE_IN_BLOCKS * L2G::GEO_REGION_SIZE_IN_BLOCKS;
+
+	if (Chunk.Layout > GEO_LAYOUT_MORTON || Chunk.ComplexBlocksCount > BlocksCount || Chunk.MultilayerBlocksCount > BlocksCount)
+		throw new runtime_error("Invalid geo archive chunk");
+
+	uint64_t ComplexBlocksOffset = sizeof(L2G::GeoRegion);
+	uint64_t MultilayerBlocksOffset = ComplexBlocksOffset + (uint64_t)Chunk.ComplexBlocksCount * sizeof(L2G::ComplexBlock);
+	uint64_t LayersOffset = MultilayerBlocksOffset + (uint64_t)Chunk.MultilayerBlocksCount * sizeof(L2G::MultilayerBlock);
+	uint64_t Size = LayersOffset + (uint64_t)Chunk.LayersCount * sizeof(int16_t);
+
+	if (Size > UINT32_MAX)
+		throw new runtime_error("Geo region is too big");
+
+	L2G::GeoRegion* Region = (L2G::GeoRegion*)L2G::AllocateGeoMemory((size_t)Size);
+	if (!Region)
+		throw new runtime_error("Couldn't allocate geo region");
+
+	Region->Size = (uint32_t)Size;
+	Region->ComplexBlocksCount = Chunk.ComplexBlocksCount;
+	Region->MultilayerBlocksCount = Chunk.MultilayerBlocksCount;
+	Region->LayersCount = Chunk.LayersCount;
+	Region->ComplexBlocksOffset = (uint32_t)ComplexBlocksOffset;
+	Region->MultilayerBlocksOffset = (uint32_t)MultilayerBlocksOffset;
+	Region->LayersOffset = (uint32_t)LayersOffset;
+	Region->Layout = Chunk.Layout;
+
+	ByteReader Bytes = { Data, Data + Chunk.BytesSize };
+	NibbleReader Nibbles = { Data + Chunk.BytesSize, Data + Chunk.BytesSize + Chunk.NibblesSize, false };
+
+	try {
+		// block runs
+
+		uint32_t ComplexBlockIndex = 0, MultilayerBlockIndex = 0;
+		int32_t FlatHeight = 0;
+
+		for (uint32_t BlockIndex = 0; BlockIndex < BlocksCount;) {
+
+			uint32_t Run = Bytes.ReadVarint();
+			uint16_t Type = Run & 0x03;
+			uint32_t RunLength = (Run >> 2) + 1;
+
+			if (RunLength > BlocksCount - BlockIndex)
+				throw new runtime_error("Invalid block run in geo archive chunk");
+
+			L2G::GeoBlock Block = { Type, 0 };
+
+			if (Type == L2G::GEO_BLOCK_FLAT) {
+				FlatHeight += Bytes.ReadSignedVarint();
+				Block.Data = MakeSubBlock(FlatHeight, Nibbles.Read());
+			}
+
+			for (uint32_t Index = 0; Index < RunLength; Index++) {
+
+				if (Type == L2G::GEO_BLOCK_COMPLEX)
+					Block.Data = (int16_t)ComplexBlockIndex++;
+				else if (Type == L2G::GEO_BLOCK_MULTILAYER)
+					Block.Data = (int16_t)MultilayerBlockIndex++;
+
+				Region->Blocks[BlockIndex++] = Block;
+			}
+		}
+
+		if (ComplexBlockIndex != Chunk.ComplexBlocksCount || MultilayerBlockIndex != Chunk.MultilayerBlocksCount)
+			throw new runtime_error("Block counts mismatch in geo archive chunk");
+
+		// complex blocks
+
+		int16_t* Cells = (int16_t*)Region->GetComplexBlocks();
+		int32_t PrevBlockHeight = 0;
+
+		for (uint32_t Index = 0; Index < Chunk.ComplexBlocksCount; Index++, Cells += L2G::GEO_BLOCK_AREA_SIZE) {
+
+			uint64_t EmptyMask = Bytes.ReadVarint() ? Bytes.ReadUInt64() : 0;
+
+			int32_t Height = PrevBlockHeight;
+			bool IsFirst = true;
+
+			for (uint32_t CellIndex = 0; CellIndex < L2G::GEO_BLOCK_AREA_SIZE; CellIndex++) {
+
+				if (EmptyMask & (1ULL << CellIndex)) {
+					Cells[CellIndex] = L2G::SPECIAL_SUBBLOCK_EMPTY;
+					continue;
+				}
+
+				Height += Bytes.ReadSignedVarint();
+				Cells[CellIndex] = MakeSubBlock(Height, Nibbles.Read());
+
+				if (IsFirst) {
+					PrevBlockHeight = Height;
+					IsFirst = false;
+				}
+			}
+		}
+
+		// multilayer blocks
+
+		int32_t* LayerIndices = (int32_t*)Region->GetMultilayerBlocks();
+		int16_t* Layers = Region->GetLayers();
+		uint32_t LayersPosition = 0;
+		int32_t PrevCellHeight = 0;
+
+		for (uint32_t Index = 0; Index < Chunk.MultilayerBlocksCount * L2G::GEO_BLOCK_AREA_SIZE; Index++) {
+
+			uint32_t CellLayersCount = Bytes.ReadVarint();
+			if (CellLayersCount == 0) {
+				LayerIndices[Index] = -1;
+				continue;
+			}
+
+			if (CellLayersCount > L2G::LAYERS_PER_SUBBLOCK_LIMIT || 1 + CellLayersCount > Chunk.LayersCount - LayersPosition)
+				throw new runtime_error("Invalid layers count in geo archive chunk");
+
+			LayerIndices[Index] = (int32_t)LayersPosition;
+			Layers[LayersPosition++] = (int16_t)CellLayersCount;
+
+			int32_t Height = PrevCellHeight;
+
+			for (uint32_t LayerIndex = 0; LayerIndex < CellLayersCount; LayerIndex++) {
+
+				Height += Bytes.ReadSignedVarint();
+				Layers[LayersPosition++] = MakeSubBlock(Height, Nibbles.Read());
+
+				if (LayerIndex == 0)
+					PrevCellHeight = Height;
+			}
+		}
+
+		if (LayersPosition != Chunk.LayersCount)
+			throw new runtime_error("Layers count mismatch in geo archive chunk");
+	}
+	catch (runtime_error* Error) {
+		L2G::FreeGeoMemory(Region);
+		throw Error;
+	}
+
+	return Region;
+}
+
+// works
+
+void L2GeodataCodec::RunTasks(vector<CodecTask>& Tasks, PTP_WORK_CALLBACK Callback)
+{
+	vector<PTP_WORK> Works;
+	Works.reserve(Tasks.size());
+
+	for (size_t TaskIndex = 0; TaskIndex < Tasks.size(); TaskIndex++) {
+
+		PTP_WORK Work = CreateThreadpoolWork(Callback, (PVOID)&Tasks[TaskIndex], NULL);
+		if (Work == NULL) {
+			// submitted works still use Tasks, error is reported through the task once they're done
+			Tasks[TaskIndex].Error = new runtime_error("Couldn't create geo archive work");
+			break;
+		}
+
+		SubmitThreadpoolWork(Work);
+
+		Works.push_back(Work);
+	}
+
+	for (PTP_WORK Work : Works) {
+		WaitForThreadpoolWorkCallbacks(Work, false);
+		CloseThreadpoolWork(Work);
+	}
+}
+
+VOID L2GeodataCodec::EncodeWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	CodecTask* Task = (CodecTask*)Context;
+
+	try {
+		EncodeRegion(*Task);
+	}
+	catch (runtime_error* Error) {
+		Task->Error = Error;
+	}
+}
+
+VOID L2GeodataCodec::DecodeWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	CodecTask* Task = (CodecTask*)Context;
+
+	try {
+		Task->Region = DecodeRegion(Task->Chunk, Task->Data);
+
+		// archive keeps layout the region had when it was saved
+		if (Task->Region->Layout != L2Geodata::GetLayout()) {
+
+			L2Geodata::GeoRegionBuilder* Builder = new L2Geodata::GeoRegionBuilder(Task->Region);
+			L2Geodata::GeoRegion* Region = Builder->Build();
+			delete Builder;
+
+			L2Geodata::FreeGeoMemory(Task->Region);
+			Task->Region = Region;
+		}
+	}
+	catch (runtime_error* Error) {
+		Task->Error = Error;
+	}
+}
+
+// archive
+
+void L2GeodataCodec::SaveArchive(wstring FilePath)
+{
+	L2Geodata::ReaderGuard Guard;
+
+	LONGLONG StartTime = GetTime();
+
+	vector<CodecTask> Tasks;
+
+	for (uint32_t RegionX = 0; RegionX < L2Geodata::GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < L2Geodata::GEO_HEIGHT_IN_REGIONS; RegionY++) {
+
+			L2Geodata::GeoRegion* Region = L2Geodata::Regions[RegionX][RegionY];
+			if (!Region)
+				continue;
+
+			CodecTask Task = { };
+			Task.RegionX = RegionX;
+			Task.RegionY = RegionY;
+			Task.Region = Region;
+
+			Tasks.push_back(Task);
+		}
+
+	RunTasks(Tasks, EncodeWorkCallback);
+
+	for (CodecTask& Task : Tasks)
+		if (Task.Error) {
+			runtime_error* Error = Task.Error;
+
+			for (CodecTask& OtherTask : Tasks)
+				if (OtherTask.Error != Error)
+					delete OtherTask.Error;
+
+			throw Error;
+		}
+
+	ArchiveHeader Header = { };
+	Header.Magic = ARCHIVE_MAGIC;
+	Header.Version = ARCHIVE_VERSION;
+	Header.HeaderSize = sizeof(ArchiveHeader);
+	Header.ChunksCount = (uint32_t)Tasks.size();
+
+	uint64_t Offset = sizeof(ArchiveHeader) + Tasks.size() * sizeof(ArchiveChunk);
+	uint64_t RawSize = 0;
+
+	for (CodecTask& Task : Tasks) {
+
+		Task.Chunk.Offset = Offset;
+		Offset += Task.Chunk.BytesSize + Task.Chunk.NibblesSize;
+
+		RawSize += Task.Region->Size;
+	}
+
+	ofstream Stream(FilePath, ios::binary);
+
+	Stream.write((char *)&Header, sizeof(Header));
+
+	for (CodecTask& Task : Tasks)
+		Stream.write((char *)&Task.Chunk, sizeof(Task.Chunk));
+
+	for (CodecTask& Task : Tasks) {
+		Stream.write((char *)Task.Bytes.Data.data(), Task.Bytes.Data.size());
+		Stream.write((char *)Task.Nibbles.Data.data(), Task.Nibbles.Data.size());
+	}
+
+	if (Stream.fail())
+		throw new runtime_error("Couldn't save geo archive");
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Geo archive saved for " << TimeToMs(EndTime - StartTime) << " ms (" << Tasks.size() << " regions, " << RawSize / (1024 * 1024) << " MB -> " <<
+		Offset / (1024 * 1024) << " MB, ratio " << (Offset > 0 ? (double)RawSize / Offset : 0.0) << ")" << endl;
+}
+
+void L2GeodataCodec::LoadArchive(wstring FilePath)
+{
+	LONGLONG StartTime = GetTime();
+
+	ifstream Stream(FilePath, ios::binary | ios::ate);
+	if (!Stream.is_open())
+		throw new runtime_error("Couldn't open geo archive");
+
+	uint64_t FileSize = (uint64_t)Stream.tellg();
+	Stream.seekg(0, ios_base::beg);
+
+	vector<uint8_t> File((size_t)FileSize);
+	Stream.read((char *)File.data(), FileSize);
+
+	if (Stream.fail())
+		throw new runtime_error("Couldn't read geo archive");
+
+	ArchiveHeader* Header = (ArchiveHeader*)File.data();
+
+	if (FileSize < sizeof(ArchiveHeader) || Header->Magic != ARCHIVE_MAGIC || Header->Version != ARCHIVE_VERSION ||
+		Header->HeaderSize != sizeof(ArchiveHeader) || Header->ChunksCount > L2Geodata::GEO_REGIONS_COUNT ||
+		sizeof(ArchiveHeader) + (uint64_t)Header->ChunksCount * sizeof(ArchiveChunk) > FileSize)
+		throw new runtime_error("Invalid geo archive");
+
+	ArchiveChunk* Chunks = (ArchiveChunk*)(File.data() + sizeof(ArchiveHeader));
+
+	vector<CodecTask> Tasks(Header->ChunksCount);
+
+	for (uint32_t Index = 0; Index < Header->ChunksCount; Index++) {
+
+		ArchiveChunk& Chunk = Chunks[Index];
+
+		if (Chunk.RegionX >= L2Geodata::GEO_WIDTH_IN_REGIONS || Chunk.RegionY >= L2Geodata::GEO_HEIGHT_IN_REGIONS ||
+			Chunk.Offset > FileSize || (uint64_t)Chunk.BytesSize + Chunk.NibblesSize > FileSize - Chunk.Offset)
+			throw new runtime_error("Invalid geo archive chunk");
+
+		CodecTask& Task = Tasks[Index];
+		Task.RegionX = Chunk.RegionX;
+		Task.RegionY = Chunk.RegionY;
+		Task.Chunk = Chunk;
+		Task.Data = File.data() + Chunk.Offset;
+	}
+
+	LONGLONG DecodeStartTime = GetTime();
+
+	RunTasks(Tasks, DecodeWorkCallback);
+
+	LONGLONG DecodeEndTime = GetTime();
+
+	runtime_error* Error = nullptr;
+
+	// every chunk is checked before the first region is published, broken archive shouldn't leave a partial map
+	for (CodecTask& Task : Tasks) {
+
+		if (!Task.Error && Task.Region && (!L2Geodata::IsValidRegion(Task.Region, Task.Region->Size) ||
+			!L2Geodata::IsValidBlockTable(Task.Region)))
+			Task.Error = new runtime_error("Invalid region in geo archive");
+
+		if (Task.Error) {
+
+			if (!Error)
+				Error = Task.Error;
+			else
+				delete Task.Error;
+		}
+	}
+
+	if (Error) {
+		for (CodecTask& Task : Tasks)
+			if (Task.Region)
+				L2Geodata::FreeGeoMemory(Task.Region);
+
+		throw Error;
+	}
+
+	uint64_t RawSize = 0;
+
+	for (CodecTask& Task : Tasks) {
+
+		L2Geodata::SetRegion(Task.RegionX, Task.RegionY, Task.Region);
+
+		RawSize += Task.Region->Size;
+	}
+
+	LONGLONG EndTime = GetTime();
+
+	double DecodeTime = TimeToMs(DecodeEndTime - DecodeStartTime) / 1000.0;
+
+	cout << "Geo archive loaded for " << TimeToMs(EndTime - StartTime) << " ms (" << Tasks.size() << " regions, ratio " <<
+		(FileSize > 0 ? (double)RawSize / FileSize : 0.0) << ", decode " <<
+		(DecodeTime > 0 ? RawSize / (1024.0 * 1024.0 * 1024.0) / DecodeTime : 0.0) << " GB/s)" << endl;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "L2Geodata.h"
+
+using namespace std;
+
+// compressed geodata archive: every region is a separate chunk, so chunks are encoded and decoded in parallel.
+// Within a chunk flat blocks are run-length coded, heights are delta coded inside blocks (and between layers)
+// as zigzag varints and NSWE nibbles are bit-packed two per byte into a separate stream.
+class L2GeodataCodec {
+private:
+	const static uint32_t ARCHIVE_MAGIC = 'ZOEG'; // "GEOZ" in file
+	const static uint32_t ARCHIVE_VERSION = 1;
+
+#pragma pack(push,1)
+	struct ArchiveHeader {
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t HeaderSize;
+		uint32_t ChunksCount;
+	};
+
+	// directory entry, chunk data is byte stream followed by nibble stream
+	struct ArchiveChunk {
+		uint16_t RegionX, RegionY;
+		uint32_t Layout;
+		// sizes of decoded region tables, so region blob is allocated once
+		uint32_t ComplexBlocksCount, MultilayerBlocksCount, LayersCount;
+		uint32_t BytesSize, NibblesSize;
+		uint64_t Offset;
+	};
+#pragma pack(pop)
+
+	struct ByteWriter {
+		vector<uint8_t> Data;
+
+		void WriteVarint(uint32_t Value);
+		void WriteSignedVarint(int32_t Value);
+		void WriteUInt64(uint64_t Value);
+	};
+
+	struct NibbleWriter {
+		vector<uint8_t> Data;
+		bool HalfByte = false;
+
+		void Write(uint8_t Nibble);
+	};
+
+	// reads throw on overrun, so corrupted chunk can't read past its end
+	struct ByteReader {
+		const uint8_t *Position, *End;
+
+		uint32_t ReadVarint(void);
+		int32_t ReadSignedVarint(void);
+		uint64_t ReadUInt64(void);
+	};
+
+	struct NibbleReader {
+		const uint8_t *Position, *End;
+		bool HalfByte;
+
+		uint8_t Read(void);
+	};
+
+	struct CodecTask {
+		uint32_t RegionX, RegionY;
+		L2Geodata::GeoRegion* Region;
+
+		ArchiveChunk Chunk;
+		ByteWriter Bytes;
+		NibbleWriter Nibbles;
+		const uint8_t* Data;
+
+		runtime_error* Error;
+	};
+
+	L2GeodataCodec(void) { }
+
+	static inline int16_t GetHeightField(int16_t SubBlock) { return SubBlock >> 4; }
+	static inline int16_t MakeSubBlock(int32_t HeightField, uint8_t Nibble) { return (int16_t)((uint32_t)HeightField << 4 | Nibble); }
+
+	static void EncodeRegion(CodecTask& Task);
+	static L2Geodata::GeoRegion* DecodeRegion(const ArchiveChunk& Chunk, const uint8_t* Data);
+
+	static void RunTasks(vector<CodecTask>& Tasks, PTP_WORK_CALLBACK Callback);
+	static VOID NTAPI EncodeWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work);
+	static VOID NTAPI DecodeWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work);
+public:
+	// compresses every loaded region (only resident ones in lazy mode)
+	static void SaveArchive(wstring FilePath);
+	// decodes all chunks in parallel and publishes regions, prints compression ratio and decode throughput
+	static void LoadArchive(wstring FilePath);
+};
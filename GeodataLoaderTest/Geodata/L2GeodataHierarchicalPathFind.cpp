@@ -0,0 +1,526 @@
+#include "stdafx.h"
+
+#include "L2GeodataHierarchicalPathFind.h"
+
+#include <iostream>
+#include <algorithm>
+#include <tuple>
+
+#include "TimeUtils.h"
+
+vector<uint32_t> L2GeodataHierarchicalPathFind::ClusterFirstNodes;
+vector<L2GeodataHierarchicalPathFind::AbstractNode> L2GeodataHierarchicalPathFind::Nodes;
+vector<L2GeodataHierarchicalPathFind::AbstractEdge> L2GeodataHierarchicalPathFind::Edges;
+
+vector<vector<L2GeodataHierarchicalPathFind::BorderTransition>> L2GeodataHierarchicalPathFind::ColumnTransitions;
+vector<vector<L2GeodataHierarchicalPathFind::AbstractEdge>> L2GeodataHierarchicalPathFind::NodeEdges;
+
+static const POINT ClusterDirections[4] = {
+	{  1,  0 },
+	{ -1,  0 },
+	{  0,  1 },
+	{  0, -1 }
+};
+
+L2GeodataPathFind::PathFindPoint L2GeodataHierarchicalPathFind::GetPathFindPoint(uint32_t GeoX, uint32_t GeoY, int16_t LayerIndex, int16_t SubBlock)
+{
+	// map corner is a multiple of geo cell, so grid point of a geo cell is just shifted
+	return L2GeodataPathFind::PathFindPoint(
+		(int32_t)GeoX + L2Geodata::MAP_MIN_X / L2Geodata::GEO_COORDS_IN_WORLD_COORDS,
+		(int32_t)GeoY + L2Geodata::MAP_MIN_Y / L2Geodata::GEO_COORDS_IN_WORLD_COORDS,
+		LayerIndex, SubBlock);
+}
+
+XMINT3 L2GeodataHierarchicalPathFind::GetWorldPoint(AbstractNode& Node)
+{
+	int32_t WorldX, WorldY;
+	L2Geodata::GeoToWorld(Node.GeoX, Node.GeoY, &WorldX, &WorldY);
+
+	return { WorldX, WorldY, GET_GEO_HEIGHT(Node.SubBlock) };
+}
+
+// ClusterSearch
+
+L2GeodataHierarchicalPathFind::ClusterSearch::ClusterSearch(void)
+{
+	ClusterX = 0;
+	ClusterY = 0;
+
+	Costs.resize(CLUSTER_LAYERS_COUNT, UINT32_MAX);
+}
+
+#define GET_CLUSTER_LAYER_INDEX(LocalX, LocalY, LayerIndex) \
+(((LocalX) * CLUSTER_SIZE + (LocalY)) * L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT + (LayerIndex))
+
+void L2GeodataHierarchicalPathFind::ClusterSearch::Run(uint32_t GeoX, uint32_t GeoY, int16_t LayerIndex, bool Backward)
+{
+	ClusterX = GeoX / CLUSTER_SIZE;
+	ClusterY = GeoY / CLUSTER_SIZE;
+
+	uint32_t BaseX = ClusterX * CLUSTER_SIZE;
+	uint32_t BaseY = ClusterY * CLUSTER_SIZE;
+
+	fill(Costs.begin(), Costs.end(), UINT32_MAX);
+
+	uint32_t SourceIndex = GET_CLUSTER_LAYER_INDEX(GeoX - BaseX, GeoY - BaseY, LayerIndex);
+	Costs[SourceIndex] = 0;
+	Queue.push({ 0, SourceIndex });
+
+	while (!Queue.empty()) {
+
+		uint32_t Cost = Queue.top().first;
+		uint32_t Index = Queue.top().second;
+		Queue.pop();
+
+		if (Cost > Costs[Index])
+			continue;
+
+		int16_t CurrentLayerIndex = (int16_t)(Index % L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT);
+		uint32_t CurrentX = BaseX + Index / L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT / CLUSTER_SIZE;
+		uint32_t CurrentY = BaseY + Index / L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT % CLUSTER_SIZE;
+
+		int16_t LayersCount;
+		int16_t* Layers = L2Geodata::GetSubBlocksGeo(CurrentX, CurrentY, LayersCount);
+
+		L2GeodataPathFind::PathFindPoint Current = GetPathFindPoint(CurrentX, CurrentY, CurrentLayerIndex, Layers[CurrentLayerIndex]);
+
+		for (const POINT& Direction : ClusterDirections) {
+
+			int32_t LocalX = (int32_t)(CurrentX - BaseX) + Direction.x;
+			int32_t LocalY = (int32_t)(CurrentY - BaseY) + Direction.y;
+			if (LocalX < 0 || LocalY < 0 || LocalX >= CLUSTER_SIZE || LocalY >= CLUSTER_SIZE)
+				continue;
+
+			int16_t NeighborLayersCount;
+			int16_t* NeighborLayers = L2Geodata::GetSubBlocksGeo(BaseX + LocalX, BaseY + LocalY, NeighborLayersCount);
+
+			auto Relax = [&](int16_t NeighborLayerIndex, uint32_t StepCost) {
+
+				uint32_t NeighborIndex = GET_CLUSTER_LAYER_INDEX(LocalX, LocalY, NeighborLayerIndex);
+				if (Cost + StepCost < Costs[NeighborIndex]) {
+					Costs[NeighborIndex] = Cost + StepCost;
+					Queue.push({ Cost + StepCost, NeighborIndex });
+				}
+			};
+
+			if (!Backward) {
+
+				int16_t DestLayerIndex;
+				if (!L2Geodata::GetDestLayerIndex(Current.SubBlock, Direction.x, Direction.y, NeighborLayers, NeighborLayersCount, DestLayerIndex))
+					continue;
+
+				L2GeodataPathFind::PathFindPoint Neighbor = GetPathFindPoint(BaseX + LocalX, BaseY + LocalY, DestLayerIndex, NeighborLayers[DestLayerIndex]);
+
+				Relax(DestLayerIndex, L2GeodataPathFind::PathFindPoint::CalcWeight(false, Current, Neighbor));
+			}
+			else {
+				// every layer of the neighbor that steps onto the current one
+				for (int16_t NeighborLayerIndex = 0; NeighborLayerIndex < NeighborLayersCount; NeighborLayerIndex++) {
+
+					int16_t DestLayerIndex;
+					if (!L2Geodata::GetDestLayerIndex(NeighborLayers[NeighborLayerIndex], -Direction.x, -Direction.y, Layers, LayersCount, DestLayerIndex) ||
+						DestLayerIndex != CurrentLayerIndex)
+						continue;
+
+					L2GeodataPathFind::PathFindPoint Neighbor = GetPathFindPoint(BaseX + LocalX, BaseY + LocalY, NeighborLayerIndex, NeighborLayers[NeighborLayerIndex]);
+
+					Relax(NeighborLayerIndex, L2GeodataPathFind::PathFindPoint::CalcWeight(false, Neighbor, Current));
+				}
+			}
+		}
+	}
+}
+
+uint32_t L2GeodataHierarchicalPathFind::ClusterSearch::GetCost(uint32_t GeoX, uint32_t GeoY, int16_t LayerIndex)
+{
+	if (GeoX / CLUSTER_SIZE != ClusterX || GeoY / CLUSTER_SIZE != ClusterY)
+		return UINT32_MAX;
+
+	return Costs[GET_CLUSTER_LAYER_INDEX(GeoX % CLUSTER_SIZE, GeoY % CLUSTER_SIZE, LayerIndex)];
+}
+
+// graph
+
+void L2GeodataHierarchicalPathFind::FindBorderTransitions(uint32_t ClusterX, uint32_t ClusterY, int32_t StepX, int32_t StepY,
+	vector<BorderTransition>& Transitions)
+{
+	struct Entrance {
+		int32_t LastIndex;
+		vector<BorderTransition> Steps;
+	};
+
+	// last cells of the cluster in Step direction, border goes along the other axis
+	uint32_t BaseX = ClusterX * CLUSTER_SIZE + (StepX ? CLUSTER_SIZE - 1 : 0);
+	uint32_t BaseY = ClusterY * CLUSTER_SIZE + (StepY ? CLUSTER_SIZE - 1 : 0);
+
+	// from a border cell to the next one
+	int32_t AlongX = StepX ? 0 : 1;
+	int32_t AlongY = StepY ? 0 : 1;
+
+	for (uint32_t Way = 0; Way < 2; Way++) {
+
+		vector<Entrance> Entrances;
+
+		for (int32_t Index = 0; Index < CLUSTER_SIZE; Index++) {
+
+			uint32_t InnerX = BaseX + (StepX ? 0 : Index);
+			uint32_t InnerY = BaseY + (StepY ? 0 : Index);
+
+			// out of the cluster first, then back into it
+			uint32_t FromX = Way == 0 ? InnerX : InnerX + StepX;
+			uint32_t FromY = Way == 0 ? InnerY : InnerY + StepY;
+			uint32_t ToX = Way == 0 ? InnerX + StepX : InnerX;
+			uint32_t ToY = Way == 0 ? InnerY + StepY : InnerY;
+			int32_t DirectionX = Way == 0 ? StepX : -StepX;
+			int32_t DirectionY = Way == 0 ? StepY : -StepY;
+
+			int16_t FromLayersCount, ToLayersCount;
+			int16_t* FromLayers = L2Geodata::GetSubBlocksGeo(FromX, FromY, FromLayersCount);
+			int16_t* ToLayers = L2Geodata::GetSubBlocksGeo(ToX, ToY, ToLayersCount);
+
+			for (int16_t FromLayerIndex = 0; FromLayerIndex < FromLayersCount; FromLayerIndex++) {
+
+				int16_t ToLayerIndex;
+				if (!L2Geodata::GetDestLayerIndex(FromLayers[FromLayerIndex], DirectionX, DirectionY, ToLayers, ToLayersCount, ToLayerIndex))
+					continue;
+
+				L2GeodataPathFind::PathFindPoint From = GetPathFindPoint(FromX, FromY, FromLayerIndex, FromLayers[FromLayerIndex]);
+				L2GeodataPathFind::PathFindPoint To = GetPathFindPoint(ToX, ToY, ToLayerIndex, ToLayers[ToLayerIndex]);
+
+				BorderTransition Transition = {
+					(uint16_t)FromX, (uint16_t)FromY, FromLayerIndex, FromLayers[FromLayerIndex],
+					(uint16_t)ToX, (uint16_t)ToY, ToLayerIndex, ToLayers[ToLayerIndex],
+					L2GeodataPathFind::PathFindPoint::CalcWeight(false, From, To)
+				};
+
+				// continues entrance that ended on the previous cell at about the same height, if one can step between
+				// the two cells both ways along the border (otherwise a node of the run may be unreachable from its other end)
+				Entrance* Continued = nullptr;
+				for (Entrance& Open : Entrances)
+					if (Open.LastIndex == Index - 1 &&
+						abs(GET_GEO_HEIGHT(Open.Steps.back().FromSubBlock) - GET_GEO_HEIGHT(Transition.FromSubBlock)) <= ENTRANCE_HEIGHT_DIFF &&
+						IsBorderStep(Open.Steps.back(), Transition, AlongX, AlongY)) {
+						Continued = &Open;
+						break;
+					}
+
+				if (Continued) {
+					Continued->LastIndex = Index;
+					Continued->Steps.push_back(Transition);
+				}
+				else
+					Entrances.push_back({ Index, { Transition } });
+			}
+		}
+
+		for (Entrance& Open : Entrances) {
+
+			if (Open.Steps.size() >= LONG_ENTRANCE_SIZE) {
+				Transitions.push_back(Open.Steps.front());
+				Transitions.push_back(Open.Steps.back());
+			}
+			else
+				Transitions.push_back(Open.Steps[Open.Steps.size() / 2]);
+		}
+	}
+}
+
+bool L2GeodataHierarchicalPathFind::IsBorderStep(BorderTransition& Prev, BorderTransition& Next, int32_t AlongX, int32_t AlongY)
+{
+	int16_t PrevLayersCount, NextLayersCount;
+	int16_t* PrevLayers = L2Geodata::GetSubBlocksGeo(Prev.FromGeoX, Prev.FromGeoY, PrevLayersCount);
+	int16_t* NextLayers = L2Geodata::GetSubBlocksGeo(Next.FromGeoX, Next.FromGeoY, NextLayersCount);
+
+	int16_t LayerIndex;
+	if (!L2Geodata::GetDestLayerIndex(Prev.FromSubBlock, AlongX, AlongY, NextLayers, NextLayersCount, LayerIndex) ||
+		LayerIndex != Next.FromLayerIndex)
+		return false;
+
+	if (!L2Geodata::GetDestLayerIndex(Next.FromSubBlock, -AlongX, -AlongY, PrevLayers, PrevLayersCount, LayerIndex) ||
+		LayerIndex != Prev.FromLayerIndex)
+		return false;
+
+	return true;
+}
+
+uint32_t L2GeodataHierarchicalPathFind::FindNode(uint16_t GeoX, uint16_t GeoY, int16_t LayerIndex)
+{
+	uint32_t ClusterIndex = GetClusterIndex(GeoX, GeoY);
+
+	auto First = Nodes.begin() + ClusterFirstNodes[ClusterIndex];
+	auto Last = Nodes.begin() + ClusterFirstNodes[ClusterIndex + 1];
+
+	auto Found = lower_bound(First, Last, AbstractNode{ GeoX, GeoY, LayerIndex }, [](const AbstractNode& Node, const AbstractNode& Key) {
+		return make_tuple(Node.GeoX, Node.GeoY, Node.LayerIndex) < make_tuple(Key.GeoX, Key.GeoY, Key.LayerIndex);
+	});
+
+	if (Found == Last || Found->GeoX != GeoX || Found->GeoY != GeoY || Found->LayerIndex != LayerIndex)
+		return NO_NODE;
+
+	return (uint32_t)(Found - Nodes.begin());
+}
+
+bool L2GeodataHierarchicalPathFind::IsClusterResident(uint32_t ClusterX, uint32_t ClusterY)
+{
+	// region size is a multiple of cluster size, so cluster is inside of a single region
+	return L2Geodata::Regions[ClusterX * CLUSTER_SIZE / L2Geodata::GEO_REGION_SIZE][ClusterY * CLUSTER_SIZE / L2Geodata::GEO_REGION_SIZE].load() != nullptr;
+}
+
+void L2GeodataHierarchicalPathFind::FindColumnTransitions(uint32_t ClusterX)
+{
+	L2Geodata::ReaderGuard Guard;
+
+	for (uint32_t ClusterY = 0; ClusterY < CLUSTERS_HEIGHT; ClusterY++) {
+
+		// both sides of a border have to be resident, nodes are never made in other clusters,
+		// so inner paths of ConnectColumnClusters stay in resident regions too
+		if (!IsClusterResident(ClusterX, ClusterY))
+			continue;
+
+		if (ClusterX + 1 < CLUSTERS_WIDTH && IsClusterResident(ClusterX + 1, ClusterY))
+			FindBorderTransitions(ClusterX, ClusterY, 1, 0, ColumnTransitions[ClusterX]);
+
+		if (ClusterY + 1 < CLUSTERS_HEIGHT && IsClusterResident(ClusterX, ClusterY + 1))
+			FindBorderTransitions(ClusterX, ClusterY, 0, 1, ColumnTransitions[ClusterX]);
+	}
+}
+
+void L2GeodataHierarchicalPathFind::ConnectColumnClusters(uint32_t ClusterX)
+{
+	L2Geodata::ReaderGuard Guard;
+
+	ClusterSearch Search;
+
+	for (uint32_t ClusterY = 0; ClusterY < CLUSTERS_HEIGHT; ClusterY++) {
+
+		uint32_t ClusterIndex = ClusterX * CLUSTERS_HEIGHT + ClusterY;
+
+		// every node belongs to a single cluster, so its edges are written by a single work
+		for (uint32_t NodeIndex = ClusterFirstNodes[ClusterIndex]; NodeIndex < ClusterFirstNodes[ClusterIndex + 1]; NodeIndex++) {
+
+			AbstractNode& Node = Nodes[NodeIndex];
+
+			Search.Run(Node.GeoX, Node.GeoY, Node.LayerIndex, false);
+
+			for (uint32_t TargetIndex = ClusterFirstNodes[ClusterIndex]; TargetIndex < ClusterFirstNodes[ClusterIndex + 1]; TargetIndex++) {
+
+				if (TargetIndex == NodeIndex)
+					continue;
+
+				AbstractNode& Target = Nodes[TargetIndex];
+
+				uint32_t Cost = Search.GetCost(Target.GeoX, Target.GeoY, Target.LayerIndex);
+				if (Cost != UINT32_MAX)
+					NodeEdges[NodeIndex].push_back({ TargetIndex, Cost });
+			}
+		}
+	}
+}
+
+void L2GeodataHierarchicalPathFind::BuildGraph(void)
+{
+	LONGLONG StartTime = GetTime();
+
+	FreeGraph();
+
+	// entrances on every border
+	ColumnTransitions.resize(CLUSTERS_WIDTH);
+
+	L2Geodata::RunParallel(CLUSTERS_WIDTH, FindColumnTransitions);
+
+	// both ends of every transition are nodes, ordered by cluster and then by cell and layer
+	for (vector<BorderTransition>& Transitions : ColumnTransitions)
+		for (BorderTransition& Transition : Transitions) {
+			Nodes.push_back({ Transition.FromGeoX, Transition.FromGeoY, Transition.FromLayerIndex, Transition.FromSubBlock, 0, 0 });
+			Nodes.push_back({ Transition.ToGeoX, Transition.ToGeoY, Transition.ToLayerIndex, Transition.ToSubBlock, 0, 0 });
+		}
+
+	auto GetNodeOrder = [](const AbstractNode& Node) {
+		return make_tuple(GetClusterIndex(Node.GeoX, Node.GeoY), Node.GeoX, Node.GeoY, Node.LayerIndex);
+	};
+
+	sort(Nodes.begin(), Nodes.end(), [&](const AbstractNode& A, const AbstractNode& B) { return GetNodeOrder(A) < GetNodeOrder(B); });
+	Nodes.erase(unique(Nodes.begin(), Nodes.end(), [&](const AbstractNode& A, const AbstractNode& B) { return GetNodeOrder(A) == GetNodeOrder(B); }),
+		Nodes.end());
+
+	ClusterFirstNodes.assign(CLUSTERS_WIDTH * CLUSTERS_HEIGHT + 1, 0);
+	for (AbstractNode& Node : Nodes)
+		ClusterFirstNodes[GetClusterIndex(Node.GeoX, Node.GeoY) + 1]++;
+	for (uint32_t ClusterIndex = 0; ClusterIndex < CLUSTERS_WIDTH * CLUSTERS_HEIGHT; ClusterIndex++)
+		ClusterFirstNodes[ClusterIndex + 1] += ClusterFirstNodes[ClusterIndex];
+
+	NodeEdges.resize(Nodes.size());
+
+	for (vector<BorderTransition>& Transitions : ColumnTransitions)
+		for (BorderTransition& Transition : Transitions)
+			NodeEdges[FindNode(Transition.FromGeoX, Transition.FromGeoY, Transition.FromLayerIndex)].push_back({
+				FindNode(Transition.ToGeoX, Transition.ToGeoY, Transition.ToLayerIndex), Transition.Cost });
+
+	ColumnTransitions.clear();
+	ColumnTransitions.shrink_to_fit();
+
+	// paths between entrances inside of every cluster
+	L2Geodata::RunParallel(CLUSTERS_WIDTH, ConnectColumnClusters);
+
+	for (uint32_t NodeIndex = 0; NodeIndex < Nodes.size(); NodeIndex++) {
+
+		Nodes[NodeIndex].FirstEdge = (uint32_t)Edges.size();
+		Nodes[NodeIndex].EdgesCount = (uint32_t)NodeEdges[NodeIndex].size();
+
+		Edges.insert(Edges.end(), NodeEdges[NodeIndex].begin(), NodeEdges[NodeIndex].end());
+	}
+
+	NodeEdges.clear();
+	NodeEdges.shrink_to_fit();
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Cluster graph built for " << TimeToMs(EndTime - StartTime) << " ms (" << Nodes.size() << " nodes, " << Edges.size() << " edges, " <<
+		(Nodes.size() * sizeof(AbstractNode) + Edges.size() * sizeof(AbstractEdge) + ClusterFirstNodes.size() * sizeof(uint32_t)) / (1024 * 1024) << " MB)" << endl;
+}
+
+void L2GeodataHierarchicalPathFind::FreeGraph(void)
+{
+	ClusterFirstNodes.clear();
+	ClusterFirstNodes.shrink_to_fit();
+	Nodes.clear();
+	Nodes.shrink_to_fit();
+	Edges.clear();
+	Edges.shrink_to_fit();
+}
+
+// queries
+
+bool L2GeodataHierarchicalPathFind::FindRoute(L2GeodataPathFind::PathFindPoint& Finish, uint32_t StartCluster, uint32_t FinishCluster)
+{
+	// virtual node that is reached from nodes of finish cluster
+	const uint32_t FINISH_NODE = (uint32_t)Nodes.size();
+
+	RouteStates.clear();
+	RouteQueue = CostQueue();
+	Route.clear();
+
+	auto GetHeuristicWeight = [&](uint32_t NodeIndex) {
+
+		if (NodeIndex == FINISH_NODE)
+			return 0u;
+
+		AbstractNode& Node = Nodes[NodeIndex];
+		L2GeodataPathFind::PathFindPoint Point = GetPathFindPoint(Node.GeoX, Node.GeoY, Node.LayerIndex, Node.SubBlock);
+
+		return L2GeodataPathFind::PathFindPoint::CalcHeuristicWeight(Point, Finish);
+	};
+
+	auto Relax = [&](uint32_t NodeIndex, uint32_t Cost, uint32_t Prev) {
+
+		auto State = RouteStates.find(NodeIndex);
+		if (State != RouteStates.end() && State->second.Cost <= Cost)
+			return;
+
+		RouteStates[NodeIndex] = { Cost, Prev };
+		RouteQueue.push({ Cost + GetHeuristicWeight(NodeIndex), NodeIndex });
+	};
+
+	for (uint32_t NodeIndex = ClusterFirstNodes[StartCluster]; NodeIndex < ClusterFirstNodes[StartCluster + 1]; NodeIndex++) {
+
+		uint32_t Cost = StartSearch.GetCost(Nodes[NodeIndex].GeoX, Nodes[NodeIndex].GeoY, Nodes[NodeIndex].LayerIndex);
+		if (Cost != UINT32_MAX)
+			Relax(NodeIndex, Cost, NO_NODE);
+	}
+
+	while (!RouteQueue.empty()) {
+
+		uint32_t NodeIndex = RouteQueue.top().second;
+		uint32_t Estimate = RouteQueue.top().first;
+		RouteQueue.pop();
+
+		RouteState State = RouteStates[NodeIndex];
+		if (Estimate != State.Cost + GetHeuristicWeight(NodeIndex))
+			continue;
+
+		if (NodeIndex == FINISH_NODE) {
+
+			for (uint32_t RouteNode = State.Prev; RouteNode != NO_NODE; RouteNode = RouteStates[RouteNode].Prev)
+				Route.push_back(RouteNode);
+
+			reverse(Route.begin(), Route.end());
+
+			return true;
+		}
+
+		AbstractNode& Node = Nodes[NodeIndex];
+
+		if (GetClusterIndex(Node.GeoX, Node.GeoY) == FinishCluster) {
+
+			uint32_t Cost = FinishSearch.GetCost(Node.GeoX, Node.GeoY, Node.LayerIndex);
+			if (Cost != UINT32_MAX)
+				Relax(FINISH_NODE, State.Cost + Cost, NodeIndex);
+		}
+
+		for (uint32_t EdgeIndex = Node.FirstEdge; EdgeIndex < Node.FirstEdge + Node.EdgesCount; EdgeIndex++)
+			Relax(Edges[EdgeIndex].Target, State.Cost + Edges[EdgeIndex].Cost, NodeIndex);
+	}
+
+	return false;
+}
+
+bool L2GeodataHierarchicalPathFind::FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight, L2GeodataOverlay* View)
+{
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	Route.clear();
+
+	uint32_t StartGeoX, StartGeoY, FinishGeoX, FinishGeoY;
+	if (!L2Geodata::WorldToGeo(Start.x, Start.y, &StartGeoX, &StartGeoY) || !L2Geodata::WorldToGeo(Finish.x, Finish.y, &FinishGeoX, &FinishGeoY))
+		return false;
+
+	// short paths don't gain anything from the graph
+	if (Nodes.empty() || (abs((int32_t)(StartGeoX / CLUSTER_SIZE) - (int32_t)(FinishGeoX / CLUSTER_SIZE)) <= 1 &&
+		abs((int32_t)(StartGeoY / CLUSTER_SIZE) - (int32_t)(FinishGeoY / CLUSTER_SIZE)) <= 1))
+		return Search.FindPath(Start, Finish, Output, Weight, NULL, View);
+
+	int16_t StartSubBlock, StartLayerIndex, FinishSubBlock, FinishLayerIndex;
+	if (!L2Geodata::GetGroundSubBlock(Start.x, Start.y, Start.z, StartSubBlock, StartLayerIndex) ||
+		!L2Geodata::GetGroundSubBlock(Finish.x, Finish.y, Finish.z, FinishSubBlock, FinishLayerIndex))
+		return false;
+
+	StartSearch.Run(StartGeoX, StartGeoY, StartLayerIndex, false);
+	FinishSearch.Run(FinishGeoX, FinishGeoY, FinishLayerIndex, true);
+
+	L2GeodataPathFind::PathFindPoint FinishPoint = GetPathFindPoint(FinishGeoX, FinishGeoY, FinishLayerIndex, FinishSubBlock);
+
+	// graph is a coarse view (entrances are single cells of a border run), so no route there isn't a proof of no path
+	if (!FindRoute(FinishPoint, GetClusterIndex(StartGeoX, StartGeoY), GetClusterIndex(FinishGeoX, FinishGeoY))) {
+		Route.clear();
+		return Search.FindPath(Start, Finish, Output, Weight, NULL, View);
+	}
+
+	// refinement, flat search between consecutive route points stays inside of one cluster (or steps over a border)
+	Output.clear();
+	Weight = 0;
+
+	XMINT3 SegmentStart = Start;
+
+	for (uint32_t RouteIndex = 0; RouteIndex <= Route.size(); RouteIndex++) {
+
+		XMINT3 SegmentFinish = RouteIndex < Route.size() ? GetWorldPoint(Nodes[Route[RouteIndex]]) : Finish;
+
+		uint32_t SegmentWeight;
+		if (!Search.FindPath(SegmentStart, SegmentFinish, SegmentPath, SegmentWeight, NULL, View))
+			// graph doesn't know about cells closed after it was built
+			return Search.FindPath(Start, Finish, Output, Weight, NULL, View);
+
+		Output.insert(Output.end(), SegmentPath.begin(), SegmentPath.end());
+		Weight += SegmentWeight;
+
+		SegmentStart = SegmentFinish;
+	}
+
+	return true;
+}
+
+uint32_t L2GeodataHierarchicalPathFind::GetRouteNodesCount(void)
+{
+	return (uint32_t)Route.size();
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <functional>
+#include <DirectXMath.h>
+
+#include "L2Geodata.h"
+#include "L2GeodataPathFind.h"
+
+using namespace std;
+using namespace DirectX;
+
+// HPA* over geodata. Map is split into clusters of CLUSTER_SIZE x CLUSTER_SIZE geo cells, every run of cells where one can
+// step over a cluster border gets an entrance node on both sides. Runs are separate for each layer, so a bridge over
+// a river or floors of a tower are separate entrances. Graph has edges across borders and between entrances of the same
+// cluster, costs are the cheapest path inside the cluster by the same CalcWeight as FindPath.
+// Query searches the graph and then runs FindPath only between consecutive nodes of the chosen route.
+// Graph is built from geodata as seen at build time (static and world overlay), queries fall back to a flat search
+// if the graph has no route or a part of the route got closed since then.
+class L2GeodataHierarchicalPathFind {
+private:
+	const static int32_t CLUSTER_SIZE = 64;
+	const static uint32_t CLUSTERS_WIDTH = L2Geodata::GEO_WIDTH / CLUSTER_SIZE;
+	const static uint32_t CLUSTERS_HEIGHT = L2Geodata::GEO_HEIGHT / CLUSTER_SIZE;
+	const static uint32_t CLUSTER_LAYERS_COUNT = CLUSTER_SIZE * CLUSTER_SIZE * L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT;
+
+	// neighbouring border cells are the same entrance if their layers are this close (and one can step between them)
+	const static int32_t ENTRANCE_HEIGHT_DIFF = 2 * L2Geodata::MIN_LAYER_DIFF;
+	// longer entrance gets nodes at both ends instead of a single one in the middle
+	const static uint32_t LONG_ENTRANCE_SIZE = 16;
+
+	const static uint32_t NO_NODE = UINT32_MAX;
+
+	struct AbstractNode {
+		uint16_t GeoX, GeoY;
+		int16_t LayerIndex, SubBlock;
+		uint32_t FirstEdge, EdgesCount;
+	};
+
+	struct AbstractEdge {
+		uint32_t Target;
+		uint32_t Cost;
+	};
+
+	// step over cluster border from a cell layer to a cell layer of the next cluster
+	struct BorderTransition {
+		uint16_t FromGeoX, FromGeoY;
+		int16_t FromLayerIndex, FromSubBlock;
+		uint16_t ToGeoX, ToGeoY;
+		int16_t ToLayerIndex, ToSubBlock;
+		uint32_t Cost;
+	};
+
+	typedef priority_queue<pair<uint32_t, uint32_t>, vector<pair<uint32_t, uint32_t>>, greater<pair<uint32_t, uint32_t>>> CostQueue;
+
+	// Dijkstra over cell layers of a single cluster, buffers are reused between runs
+	struct ClusterSearch {
+		uint32_t ClusterX, ClusterY;
+
+		vector<uint32_t> Costs;
+		CostQueue Queue;
+
+		ClusterSearch(void);
+
+		// costs from the point (to the point with Backward) to every cell layer of its cluster, paths don't leave the cluster
+		void Run(uint32_t GeoX, uint32_t GeoY, int16_t LayerIndex, bool Backward);
+		// UINT32_MAX if cell layer can't be reached (or is outside of the cluster)
+		uint32_t GetCost(uint32_t GeoX, uint32_t GeoY, int16_t LayerIndex);
+	};
+
+	struct RouteState {
+		uint32_t Cost;
+		uint32_t Prev;
+	};
+
+	// nodes are ordered by cluster, nodes of a cluster are ClusterFirstNodes[Cluster] .. ClusterFirstNodes[Cluster + 1]
+	static vector<uint32_t> ClusterFirstNodes;
+	static vector<AbstractNode> Nodes;
+	static vector<AbstractEdge> Edges;
+
+	// build state, transitions are found per cluster column, edges are collected per node
+	static vector<vector<BorderTransition>> ColumnTransitions;
+	static vector<vector<AbstractEdge>> NodeEdges;
+
+	// query state
+	L2GeodataPathFind Search;
+	ClusterSearch StartSearch, FinishSearch;
+	unordered_map<uint32_t, RouteState> RouteStates;
+	CostQueue RouteQueue;
+	vector<uint32_t> Route;
+	vector<vector<XMINT3>> SegmentPath;
+
+	static inline uint32_t GetClusterIndex(uint32_t GeoX, uint32_t GeoY) {
+		return GeoX / CLUSTER_SIZE * CLUSTERS_HEIGHT + GeoY / CLUSTER_SIZE;
+	}
+
+	static L2GeodataPathFind::PathFindPoint GetPathFindPoint(uint32_t GeoX, uint32_t GeoY, int16_t LayerIndex, int16_t SubBlock);
+	static XMINT3 GetWorldPoint(AbstractNode& Node);
+
+	// transitions both ways over the border between cluster and the next one in Step direction (east or south)
+	static void FindBorderTransitions(uint32_t ClusterX, uint32_t ClusterY, int32_t StepX, int32_t StepY, vector<BorderTransition>& Transitions);
+	// both From cells of neighbouring transitions can step into each other (Prev is before Next along the border)
+	static bool IsBorderStep(BorderTransition& Prev, BorderTransition& Next, int32_t AlongX, int32_t AlongY);
+	static uint32_t FindNode(uint16_t GeoX, uint16_t GeoY, int16_t LayerIndex);
+
+	// region of the cluster is in memory, lookups of other clusters would page their regions in (lazy mode)
+	static bool IsClusterResident(uint32_t ClusterX, uint32_t ClusterY);
+
+	// build steps for a single cluster column, columns run in parallel
+	static void FindColumnTransitions(uint32_t ClusterX);
+	static void ConnectColumnClusters(uint32_t ClusterX);
+
+	// A* over the graph from nodes of start cluster to nodes of finish cluster, Route is nodes from start to finish
+	bool FindRoute(L2GeodataPathFind::PathFindPoint& Finish, uint32_t StartCluster, uint32_t FinishCluster);
+public:
+	// builds graph over loaded (resident in lazy mode) geodata in parallel, clusters of regions that aren't resident
+	// get no nodes and are found by flat search, NWC has to be loaded first, no queries may run while it's built
+	static void BuildGraph(void);
+	static void FreeGraph(void);
+
+	// same contract as L2GeodataPathFind::FindPath, points up to a cluster apart are found by flat search directly.
+	// Object keeps search buffers between queries, one object per thread
+	bool FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight, L2GeodataOverlay* View = nullptr);
+	// route nodes of the last query that went through the graph
+	uint32_t GetRouteNodesCount(void);
+};
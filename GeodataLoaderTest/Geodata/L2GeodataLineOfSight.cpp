@@ -0,0 +1,148 @@
+#include "stdafx.h"
+
+#include "L2GeodataLineOfSight.h"
+#include "L2GeodataRaycast.h"
+
+#include <cfloat>
+#include <cmath>
+
+bool L2GeodataLineOfSight::CanSeeInternal(XMINT3 From, XMINT3 To)
+{
+	uint32_t GeoX, GeoY, TargetGeoX, TargetGeoY;
+
+	if (!L2Geodata::WorldToGeo(From.x, From.y, &GeoX, &GeoY) || !L2Geodata::WorldToGeo(To.x, To.y, &TargetGeoX, &TargetGeoY))
+		return true;
+
+	// ray high above every layer (from a cliff, at a flying target) is answered by height pyramid without the cell walk
+	if (L2GeodataRaycast::IsRayAboveTerrain({ From.x, From.y, From.z + EYE_HEIGHT }, { To.x, To.y, To.z + EYE_HEIGHT }, WALL_HEIGHT))
+		return true;
+
+	// ray in geo cells, height goes linearly with ray parameter from 0 at caster to 1 at target
+	float StartX = (float)(From.x - L2Geodata::MAP_MIN_X) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	float StartY = (float)(From.y - L2Geodata::MAP_MIN_Y) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	float DeltaX = (float)(To.x - From.x) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	float DeltaY = (float)(To.y - From.y) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+
+	float StartZ = (float)(From.z + EYE_HEIGHT);
+	float DeltaZ = (float)(To.z - From.z);
+
+	int32_t StepX = DeltaX > 0 ? 1 : -1;
+	int32_t StepY = DeltaY > 0 ? 1 : -1;
+
+	int16_t DirectionX = StepX > 0 ? L2Geodata::EAST : L2Geodata::WEST;
+	int16_t DirectionY = StepY > 0 ? L2Geodata::SOUTH : L2Geodata::NORTH;
+
+	// ray parameter of the next cell border on each axis and distance between borders
+	float NextX = DeltaX != 0 ? (StepX > 0 ? GeoX + 1 - StartX : StartX - GeoX) / fabsf(DeltaX) : FLT_MAX;
+	float NextY = DeltaY != 0 ? (StepY > 0 ? GeoY + 1 - StartY : StartY - GeoY) / fabsf(DeltaY) : FLT_MAX;
+	float BorderStepX = DeltaX != 0 ? 1.0f / fabsf(DeltaX) : FLT_MAX;
+	float BorderStepY = DeltaY != 0 ? 1.0f / fabsf(DeltaY) : FLT_MAX;
+
+	// layer the ray goes above and the one over it in current cell, unknown where cell has no geodata
+	bool HasFloor = false, HasCeiling = false;
+	int16_t Floor = 0, Ceiling = 0;
+
+	int16_t LayersCount;
+	int16_t* Layers = L2Geodata::GetSubBlocksGeo(GeoX, GeoY, LayersCount);
+
+	int16_t LayerIndex = L2Geodata::CountLayersAbove(Layers, LayersCount, From.z + L2Geodata::MIN_LAYER_DIFF);
+	if (LayerIndex < LayersCount) {
+
+		HasFloor = true;
+		Floor = Layers[LayerIndex];
+
+		HasCeiling = LayerIndex > 0;
+		Ceiling = HasCeiling ? Layers[LayerIndex - 1] : 0;
+	}
+
+	uint32_t StepsCount = (uint32_t)(abs((int32_t)TargetGeoX - (int32_t)GeoX) + abs((int32_t)TargetGeoY - (int32_t)GeoY));
+
+	for (uint32_t Step = 0; Step < StepsCount; Step++) {
+
+		float T;
+		int16_t Direction;
+
+		if (NextX < NextY) {
+
+			T = NextX;
+			NextX += BorderStepX;
+
+			GeoX += StepX;
+			Direction = DirectionX;
+		}
+		else {
+
+			T = NextY;
+			NextY += BorderStepY;
+
+			GeoY += StepY;
+			Direction = DirectionY;
+		}
+
+		// float error can take the ray one cell past the target at the map edge
+		if (GeoX >= L2Geodata::GEO_WIDTH || GeoY >= L2Geodata::GEO_HEIGHT)
+			break;
+
+		int32_t Z = (int32_t)(StartZ + DeltaZ * (T < 1.0f ? T : 1.0f));
+
+		Layers = L2Geodata::GetSubBlocksGeo(GeoX, GeoY, LayersCount);
+		if (LayersCount == 0) {
+			HasFloor = false;
+			HasCeiling = false;
+			continue;
+		}
+
+		LayerIndex = L2Geodata::CountLayersAbove(Layers, LayersCount, Z + L2Geodata::MIN_LAYER_DIFF);
+
+		// ray is under every layer of the cell
+		if (LayerIndex == LayersCount)
+			return false;
+
+		int16_t NewFloor = Layers[LayerIndex];
+		bool NewHasCeiling = LayerIndex > 0;
+		int16_t NewCeiling = NewHasCeiling ? Layers[LayerIndex - 1] : 0;
+
+		if (HasFloor) {
+
+			int32_t FloorHeight = GET_GEO_HEIGHT(Floor);
+			int32_t NewFloorHeight = GET_GEO_HEIGHT(NewFloor);
+
+			// went up through the layer that was over the ray
+			if (HasCeiling && NewFloorHeight >= GET_GEO_HEIGHT(Ceiling) - L2Geodata::MIN_LAYER_DIFF)
+				return false;
+
+			// went down through the layer that was under the ray
+			if (NewHasCeiling && GET_GEO_HEIGHT(NewCeiling) <= FloorHeight + L2Geodata::MIN_LAYER_DIFF)
+				return false;
+
+			// height steps are handled above, closed edge on flat floor is a wall
+			if (!TEST_NSWE(GET_GEO_NSWE(Floor), Direction) && abs(NewFloorHeight - FloorHeight) <= L2Geodata::MIN_LAYER_DIFF &&
+				Z < (NewFloorHeight > FloorHeight ? NewFloorHeight : FloorHeight) + WALL_HEIGHT)
+				return false;
+		}
+
+		HasFloor = true;
+		Floor = NewFloor;
+		HasCeiling = NewHasCeiling;
+		Ceiling = NewCeiling;
+	}
+
+	return true;
+}
+
+bool L2GeodataLineOfSight::CanSee(XMINT3 From, XMINT3 To, L2GeodataOverlay* View)
+{
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	return CanSeeInternal(From, To);
+}
+
+void L2GeodataLineOfSight::CanSeeBatch(const XMINT3* From, const XMINT3* To, uint32_t Count, bool* Results, L2GeodataOverlay* View)
+{
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	for (uint32_t Index = 0; Index < Count; Index++)
+		Results[Index] = CanSeeInternal(From[Index], To[Index]);
+}
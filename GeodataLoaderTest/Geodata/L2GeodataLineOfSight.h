@@ -0,0 +1,30 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+#include "L2Geodata.h"
+
+using namespace std;
+using namespace DirectX;
+
+// Line of sight over layered geodata. The ray is walked cell by cell (2D grid traversal, height interpolated along the ray)
+// and at every cell it has to stay above one of the layers without passing through the layer above it,
+// edges closed by NSWE between cells of the same height are treated as thin walls.
+class L2GeodataLineOfSight {
+private:
+	// caster and target are seen at this height above their points
+	const static int32_t EYE_HEIGHT = 32;
+	// closed edge between cells of the same height blocks rays lower than this above the floor
+	const static int32_t WALL_HEIGHT = 2 * L2Geodata::MIN_LAYER_DIFF;
+
+	L2GeodataLineOfSight(void) { }
+
+	// caller holds ReaderGuard and overlay scope
+	static bool CanSeeInternal(XMINT3 From, XMINT3 To);
+public:
+	// points outside of the map or without geodata are not blocked,
+	// View as in L2Geodata::OverlayScope
+	static bool CanSee(XMINT3 From, XMINT3 To, L2GeodataOverlay* View = nullptr);
+	// fills caller owned Results of Count entries, reader guard and view are set up once for the whole batch
+	static void CanSeeBatch(const XMINT3* From, const XMINT3* To, uint32_t Count, bool* Results, L2GeodataOverlay* View = nullptr);
+};
@@ -9,6 +9,8 @@
 void L2GeodataModelGenerator::GenerateGeodataScene(int32_t WorldX, int32_t WorldY, uint32_t Width, uint32_t Height, 
 	float ScaleWorld, float ScaleWorldZ, GeodataVertex* VertexBuffer, uint32_t& VertexBufferSize, uint32_t* IndexBuffer, uint32_t& IndexBufferSize)
 {
+	L2Geodata::ReaderGuard Guard;
+
 	this->ScaleWorld = ScaleWorld;
 	this->ScaleWorldZ = ScaleWorldZ;
 
@@ -0,0 +1,258 @@
+#include "stdafx.h"
+
+#include "L2GeodataOverlay.h"
+
+L2GeodataOverlay::L2GeodataOverlay(L2GeodataOverlay* Parent)
+{
+	this->Parent = Parent;
+
+	Table = AllocateTable(INITIAL_TABLE_SIZE);
+
+	for (uint32_t RegionX = 0; RegionX < L2Geodata::GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < L2Geodata::GEO_HEIGHT_IN_REGIONS; RegionY++)
+			RegionHasBlocks[RegionX][RegionY] = false;
+
+	BlocksCount = 0;
+	CellsCount = 0;
+}
+
+L2GeodataOverlay::~L2GeodataOverlay(void)
+{
+	OverlayTable* Table = this->Table;
+
+	for (uint32_t Slot = 0; Slot <= Table->Mask; Slot++) {
+
+		OverlayBlock* Block = Table->Blocks[Slot];
+		if (!Block)
+			continue;
+
+		for (atomic<OverlayCell*>& CellSlot : Block->Cells)
+			free(CellSlot.load());
+
+		delete Block;
+	}
+
+	free(Table);
+}
+
+L2GeodataOverlay::OverlayTable* L2GeodataOverlay::AllocateTable(uint32_t Size)
+{
+	OverlayTable* Table = (OverlayTable*)malloc(sizeof(OverlayTable) + (Size - 1) * sizeof(atomic<OverlayBlock*>));
+	if (!Table)
+		throw new runtime_error("Couldn't allocate overlay table");
+
+	Table->Mask = Size - 1;
+	for (uint32_t Slot = 0; Slot < Size; Slot++)
+		Table->Blocks[Slot].store(nullptr, memory_order_relaxed);
+
+	return Table;
+}
+
+// creates block on the way, called under WriteLock
+atomic<L2GeodataOverlay::OverlayCell*>& L2GeodataOverlay::GetCellSlot(uint32_t GeoX, uint32_t GeoY)
+{
+	uint32_t CellIndex = GeoX % L2Geodata::GEO_BLOCK_SIZE * L2Geodata::GEO_BLOCK_SIZE + GeoY % L2Geodata::GEO_BLOCK_SIZE;
+
+	uint32_t Key = GetBlockKey(GeoX, GeoY);
+
+	OverlayTable* Table = this->Table;
+
+	uint32_t Slot = GetTableSlot(Key, Table->Mask);
+	for (;; Slot = (Slot + 1) & Table->Mask) {
+
+		OverlayBlock* Block = Table->Blocks[Slot];
+		if (!Block)
+			break;
+
+		if (Block->Key == Key)
+			return Block->Cells[CellIndex];
+	}
+
+	OverlayBlock* Block = new OverlayBlock();
+	Block->Key = Key;
+	for (atomic<OverlayCell*>& CellSlot : Block->Cells)
+		CellSlot.store(nullptr, memory_order_relaxed);
+
+	// table is kept at most half full so probe chains stay short
+	if ((BlocksCount + 1) * 2 > Table->Mask + 1) {
+
+		OverlayTable* NewTable = AllocateTable((Table->Mask + 1) * 2);
+
+		for (uint32_t OldSlot = 0; OldSlot <= Table->Mask; OldSlot++) {
+
+			OverlayBlock* OldBlock = Table->Blocks[OldSlot];
+			if (!OldBlock)
+				continue;
+
+			uint32_t NewSlot = GetTableSlot(OldBlock->Key, NewTable->Mask);
+			while (NewTable->Blocks[NewSlot].load(memory_order_relaxed))
+				NewSlot = (NewSlot + 1) & NewTable->Mask;
+
+			NewTable->Blocks[NewSlot].store(OldBlock, memory_order_relaxed);
+		}
+
+		this->Table.store(NewTable, memory_order_release);
+		L2Geodata::RetireMemory(Table);
+
+		Table = NewTable;
+
+		Slot = GetTableSlot(Key, Table->Mask);
+		while (Table->Blocks[Slot].load(memory_order_relaxed))
+			Slot = (Slot + 1) & Table->Mask;
+	}
+
+	// flag goes first, so reader that finds the block also sees the region as overridden
+	RegionHasBlocks[GeoX / L2Geodata::GEO_REGION_SIZE][GeoY / L2Geodata::GEO_REGION_SIZE].store(true, memory_order_release);
+
+	Table->Blocks[Slot].store(Block, memory_order_release);
+	BlocksCount++;
+
+	return Block->Cells[CellIndex];
+}
+
+// cell record holds only its own layers
+static inline size_t GetOverlayCellSize(int16_t Count)
+{
+	return sizeof(int16_t) * (1 + Count);
+}
+
+// publishes new cell (or nullptr), readers that still see the old one are waited out by L2Geodata epochs
+void L2GeodataOverlay::ReplaceCell(uint32_t GeoX, uint32_t GeoY, OverlayCell* Cell)
+{
+	OverlayCell* OldCell = GetCellSlot(GeoX, GeoY).exchange(Cell, memory_order_acq_rel);
+
+	if (OldCell)
+		CellsCount--;
+	if (Cell)
+		CellsCount++;
+
+	L2Geodata::RetireMemory(OldCell);
+}
+
+void L2GeodataOverlay::SetSubBlocks(int32_t WorldX, int32_t WorldY, int16_t Count, const int16_t* Layers)
+{
+	if (Count < 0 || Count > L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT)
+		throw new runtime_error("Invalid overlay layers count");
+
+	for (int16_t Index = 1; Index < Count; Index++)
+		if (GET_GEO_HEIGHT(Layers[Index - 1]) <= GET_GEO_HEIGHT(Layers[Index]))
+			throw new runtime_error("Overlay layers required to be sorted");
+
+	uint32_t GeoX, GeoY;
+	if (!L2Geodata::WorldToGeo(WorldX, WorldY, &GeoX, &GeoY))
+		throw new runtime_error("Overlay cell is outside of the map");
+
+	OverlayCell* Cell = (OverlayCell*)malloc(GetOverlayCellSize(Count));
+	if (!Cell)
+		throw new runtime_error("Couldn't allocate overlay cell");
+
+	Cell->Count = Count;
+	memcpy(Cell->Layers, Layers, Count * sizeof(int16_t));
+
+	lock_guard<mutex> Lock(WriteLock);
+
+	ReplaceCell(GeoX, GeoY, Cell);
+}
+
+bool L2GeodataOverlay::SetNSWE(int32_t WorldX, int32_t WorldY, int32_t WorldZ, int16_t NSWE)
+{
+	uint32_t GeoX, GeoY;
+	if (!L2Geodata::WorldToGeo(WorldX, WorldY, &GeoX, &GeoY))
+		throw new runtime_error("Overlay cell is outside of the map");
+
+	L2Geodata::ReaderGuard Guard;
+
+	lock_guard<mutex> Lock(WriteLock);
+
+	int16_t* Layers;
+	int16_t Count;
+
+	if (!FindSubBlocks(GeoX, GeoY, Layers, Count))
+		Layers = L2Geodata::GetStaticSubBlocks(GeoX, GeoY, Count);
+
+	if (Count == 0)
+		return false;
+
+	int16_t ClosestLayerIndex = 0;
+
+	for (int16_t LayerIndex = 1; LayerIndex < Count; LayerIndex++)
+		if (abs(GET_GEO_HEIGHT(Layers[LayerIndex]) - WorldZ) < abs(GET_GEO_HEIGHT(Layers[ClosestLayerIndex]) - WorldZ))
+			ClosestLayerIndex = LayerIndex;
+
+	OverlayCell* Cell = (OverlayCell*)malloc(GetOverlayCellSize(Count));
+	if (!Cell)
+		throw new runtime_error("Couldn't allocate overlay cell");
+
+	Cell->Count = Count;
+	memcpy(Cell->Layers, Layers, Count * sizeof(int16_t));
+
+	Cell->Layers[ClosestLayerIndex] = (int16_t)((Cell->Layers[ClosestLayerIndex] & 0xFFF0) | (NSWE & 0x0F));
+
+	ReplaceCell(GeoX, GeoY, Cell);
+
+	return true;
+}
+
+void L2GeodataOverlay::ResetSubBlocks(int32_t WorldX, int32_t WorldY)
+{
+	uint32_t GeoX, GeoY;
+	if (!L2Geodata::WorldToGeo(WorldX, WorldY, &GeoX, &GeoY))
+		return;
+
+	lock_guard<mutex> Lock(WriteLock);
+
+	ReplaceCell(GeoX, GeoY, nullptr);
+}
+
+// blocks stay allocated, they are cheap to keep and likely to be reused by the same doors
+void L2GeodataOverlay::Clear(void)
+{
+	lock_guard<mutex> Lock(WriteLock);
+
+	OverlayTable* Table = this->Table;
+
+	for (uint32_t Slot = 0; Slot <= Table->Mask; Slot++) {
+
+		OverlayBlock* Block = Table->Blocks[Slot];
+		if (!Block)
+			continue;
+
+		for (atomic<OverlayCell*>& CellSlot : Block->Cells)
+			L2Geodata::RetireMemory(CellSlot.exchange(nullptr, memory_order_acq_rel));
+	}
+
+	CellsCount = 0;
+}
+
+uint32_t L2GeodataOverlay::GetCellsCount(void)
+{
+	lock_guard<mutex> Lock(WriteLock);
+
+	return CellsCount;
+}
+
+uint64_t L2GeodataOverlay::GetMemoryUsage(void)
+{
+	lock_guard<mutex> Lock(WriteLock);
+
+	OverlayTable* Table = this->Table;
+
+	uint64_t Size = sizeof(L2GeodataOverlay) + sizeof(OverlayTable) + Table->Mask * sizeof(atomic<OverlayBlock*>) +
+		(uint64_t)BlocksCount * sizeof(OverlayBlock);
+
+	for (uint32_t Slot = 0; Slot <= Table->Mask; Slot++) {
+
+		OverlayBlock* Block = Table->Blocks[Slot];
+		if (!Block)
+			continue;
+
+		for (atomic<OverlayCell*>& CellSlot : Block->Cells) {
+
+			OverlayCell* Cell = CellSlot;
+			if (Cell)
+				Size += GetOverlayCellSize(Cell->Count);
+		}
+	}
+
+	return Size;
+}
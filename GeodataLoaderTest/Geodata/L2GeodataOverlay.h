@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "L2Geodata.h"
+
+using namespace std;
+
+// Runtime override of geodata cells (doors, gates, siege fences) that never touches static regions.
+// Overridden blocks are kept in a small open-addressing table keyed by block, every overridden cell is a separate
+// copy-on-write record, so changing a cell costs one small allocation and readers never wait for writers.
+// Overlay can have a parent (e.g. instance overlay on top of world overlay), cells of the child win,
+// so an instance view costs only its own blocks, not a copy of the world.
+class L2GeodataOverlay {
+private:
+	struct OverlayCell {
+		int16_t Count;
+		int16_t Layers[L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT];
+	};
+
+	struct OverlayBlock {
+		uint32_t Key;
+		atomic<OverlayCell*> Cells[L2Geodata::GEO_BLOCK_AREA_SIZE];
+	};
+
+	// blocks are only added while overlay lives, so a slot goes from nullptr to a block once,
+	// table that became too small is copied and the old one is retired through L2Geodata epochs
+	struct OverlayTable {
+		uint32_t Mask;
+		atomic<OverlayBlock*> Blocks[1];
+	};
+
+	const static uint32_t INITIAL_TABLE_SIZE = 16;
+
+	L2GeodataOverlay* Parent;
+
+	atomic<OverlayTable*> Table;
+	// set once region gets its first block, lets region-wide caches of static geodata (height pyramid) be trusted elsewhere
+	atomic<bool> RegionHasBlocks[L2Geodata::GEO_WIDTH_IN_REGIONS][L2Geodata::GEO_HEIGHT_IN_REGIONS];
+	mutex WriteLock;
+	uint32_t BlocksCount, CellsCount;
+
+	static inline uint32_t GetBlockKey(uint32_t GeoX, uint32_t GeoY) {
+		return (GeoX / L2Geodata::GEO_BLOCK_SIZE) << 16 | (GeoY / L2Geodata::GEO_BLOCK_SIZE);
+	}
+
+	static inline uint32_t GetTableSlot(uint32_t Key, uint32_t Mask) {
+		return (Key * 0x9E3779B1) >> 16 & Mask;
+	}
+
+	static OverlayTable* AllocateTable(uint32_t Size);
+
+	atomic<OverlayCell*>& GetCellSlot(uint32_t GeoX, uint32_t GeoY);
+	void ReplaceCell(uint32_t GeoX, uint32_t GeoY, OverlayCell* Cell);
+public:
+	L2GeodataOverlay(L2GeodataOverlay* Parent = nullptr);
+	// no reader may use the overlay anymore
+	~L2GeodataOverlay(void);
+
+	// true if cell is overridden here or in a parent, Layers is nullptr (and Count 0) for cell overridden as empty
+	inline bool FindSubBlocks(uint32_t GeoX, uint32_t GeoY, int16_t*& Layers, int16_t& Count) {
+
+		uint32_t Key = GetBlockKey(GeoX, GeoY);
+		uint32_t CellIndex = GeoX % L2Geodata::GEO_BLOCK_SIZE * L2Geodata::GEO_BLOCK_SIZE + GeoY % L2Geodata::GEO_BLOCK_SIZE;
+
+		for (L2GeodataOverlay* Overlay = this; Overlay; Overlay = Overlay->Parent) {
+
+			OverlayTable* Table = Overlay->Table.load(memory_order_acquire);
+
+			for (uint32_t Slot = GetTableSlot(Key, Table->Mask);; Slot = (Slot + 1) & Table->Mask) {
+
+				OverlayBlock* Block = Table->Blocks[Slot].load(memory_order_acquire);
+				if (!Block)
+					break;
+
+				if (Block->Key != Key)
+					continue;
+
+				OverlayCell* Cell = Block->Cells[CellIndex].load(memory_order_acquire);
+				if (!Cell)
+					break;
+
+				Count = Cell->Count;
+				Layers = Cell->Count > 0 ? Cell->Layers : nullptr;
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// true if region has overridden cells here or in a parent
+	inline bool HasRegionCells(uint32_t RegionX, uint32_t RegionY) {
+
+		for (L2GeodataOverlay* Overlay = this; Overlay; Overlay = Overlay->Parent)
+			if (Overlay->RegionHasBlocks[RegionX][RegionY].load(memory_order_acquire))
+				return true;
+
+		return false;
+	}
+
+	// replaces all layers of the cell, layers are sorted by height descending, Count 0 makes cell empty
+	void SetSubBlocks(int32_t WorldX, int32_t WorldY, int16_t Count, const int16_t* Layers);
+	// replaces NSWE of the layer closest to WorldZ, the rest of the cell stays as it is seen through this overlay,
+	// returns false if there is no layer in that cell
+	bool SetNSWE(int32_t WorldX, int32_t WorldY, int32_t WorldZ, int16_t NSWE);
+	// cell is seen as in parent overlay (or static geodata) again
+	void ResetSubBlocks(int32_t WorldX, int32_t WorldY);
+	void Clear(void);
+
+	uint32_t GetCellsCount(void);
+	// memory owned by this overlay itself, parents are not counted
+	uint64_t GetMemoryUsage(void);
+};
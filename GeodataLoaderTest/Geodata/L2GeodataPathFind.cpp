@@ -1,6 +1,7 @@
 #include "stdafx.h"
 
 #include "L2GeodataPathFind.h"
+#include "L2GeodataOverlay.h"
 
 #include "TimeUtils.h"
 
@@ -39,23 +40,31 @@ L2GeodataPathFind::RegionBuffer* L2GeodataPathFind::GetRegion(POINT RegionPoint)
 	if (LastRegion != NULL && Equals(LastRegionPoint, RegionPoint))
 		return LastRegion;
 
-	for (RegionBuffer* Region : Regions) {
+	int32_t GridX = RegionPoint.x + REGION_GRID_WIDTH / 2;
+	int32_t GridY = RegionPoint.y + REGION_GRID_HEIGHT / 2;
+	if (GridX < 0 || GridY < 0 || GridX >= REGION_GRID_WIDTH || GridY >= REGION_GRID_HEIGHT)
+		throw new runtime_error("Region is out of region grid");
 
-		if (Equals(Region->RegionPoint, RegionPoint)) {
+	RegionGridSlot& Slot = RegionGrid[GridX * REGION_GRID_HEIGHT + GridY];
 
-			LastRegion = Region;
-			LastRegionPoint = RegionPoint;
+	if (Slot.SearchIndex != SearchIndex) {
 
-			return LastRegion;
-		}
-	}
+		// pool grows only until it has as many regions as the largest search needed
+		if (UsedRegionsCount == RegionsPool.size()) {
 
-	RegionBuffer* NewRegion = (RegionBuffer*)calloc(1, sizeof(RegionBuffer));
-	NewRegion->RegionPoint = RegionPoint;
+			RegionBuffer* NewRegion = (RegionBuffer*)calloc(1, sizeof(RegionBuffer));
+			if (!NewRegion)
+				throw new runtime_error("Couldn't allocate region buffer");
 
-	Regions.push_back(NewRegion);
+			RegionsPool.push_back(NewRegion);
+		}
 
-	LastRegion = NewRegion;
+		Slot.Region = RegionsPool[UsedRegionsCount++];
+		Slot.Region->Reset(RegionPoint);
+		Slot.SearchIndex = SearchIndex;
+	}
+
+	LastRegion = Slot.Region;
 	LastRegionPoint = RegionPoint;
 
 	return LastRegion;
@@ -84,17 +93,6 @@ void L2GeodataPathFind::SetPointEntry(PathFindPoint& Point, RegionBufferEntry En
 	Region->SetPointEntry({ RegionRasePoint.x, RegionRasePoint.y, Point.LayerIndex }, Entry);
 }
 
-L2GeodataPathFind::PathFindPoint L2GeodataPathFind::ExtractPointWithLowestWeight(void)
-{
-	auto Iterator = prev(PointsToCheck.end());
-
-	PathFindPoint Point = *Iterator;
-
-	PointsToCheck.erase(Iterator);
-
-	return Point;
-}
-
 bool L2GeodataPathFind::GetNextLinePoint(PathFindPoint& PrevPoint, POINT& Direction, PathFindPoint& NextPoint, bool IsDiagonal)
 {
 	if (Direction.x == 0 || Direction.y == 0) {
@@ -150,6 +148,62 @@ bool L2GeodataPathFind::GetNextLinePoint(PathFindPoint& PrevPoint, POINT& Direct
 	return false;
 }
 
+bool L2GeodataPathFind::WalkLine(PathFindPoint& Start, POINT Finish, PathFindPoint& Last, vector<XMINT3>* LinePoints)
+{
+	int32_t PixelsCount = max(abs(Finish.x - Start.GridX), abs(Finish.y - Start.GridY));
+
+	Last = Start;
+	Last.Weight = 0;
+
+	if (LinePoints)
+		LinePoints->push_back(Last.GetWorldPoint());
+
+	for (int32_t Counter = 1; Counter <= PixelsCount; Counter++) {
+
+		int32_t GridX = (int32_t)round(Start.GridX + (Finish.x - Start.GridX) * Counter / (float)PixelsCount);
+		int32_t GridY = (int32_t)round(Start.GridY + (Finish.y - Start.GridY) * Counter / (float)PixelsCount);
+
+		POINT Direction = { GridX - Last.GridX, GridY - Last.GridY };
+
+		PathFindPoint NextPoint;
+		if (!GetNextLinePoint(Last, Direction, NextPoint, false))
+			return false;
+
+		NextPoint.Weight += Last.Weight;
+		Last = NextPoint;
+
+		if (LinePoints)
+			LinePoints->push_back(Last.GetWorldPoint());
+	}
+
+	return true;
+}
+
+bool L2GeodataPathFind::CanMoveTo(XMINT3 Start, XMINT3 Finish, int32_t& FinishZ, L2GeodataOverlay* View)
+{
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	POINT StartPoint = ToGrid({ Start.x, Start.y });
+	POINT FinishPoint = ToGrid({ Finish.x, Finish.y });
+
+	POINT StartWorldPoint = ToWorld(StartPoint);
+
+	int16_t SubBlock, LayerIndex;
+	if (!L2Geodata::GetGroundSubBlock(StartWorldPoint.x, StartWorldPoint.y, Start.z, SubBlock, LayerIndex))
+		return false;
+
+	PathFindPoint PathStart(StartPoint.x, StartPoint.y, LayerIndex, SubBlock);
+
+	PathFindPoint Last;
+	if (!WalkLine(PathStart, FinishPoint, Last, nullptr))
+		return false;
+
+	FinishZ = GET_GEO_HEIGHT(Last.SubBlock);
+
+	return true;
+}
+
 bool L2GeodataPathFind::ConstructLineBetweenPoints(PathFindPoint& Start, PathFindPoint& Finish, vector<XMINT3>& LinePoints, float WeightThreshold)
 {
 	int32_t PixelsCount = max(abs(Finish.GridX - Start.GridX), abs(Finish.GridY - Start.GridY));
@@ -199,7 +253,6 @@ uint32_t L2GeodataPathFind::ApplyLinearApproximation(vector<PathFindPoint>& Path
 		throw new runtime_error("Invalid points count as input in linear approximation");
 
 	PathFindPoint* PrevLineLastPoint = NULL;
-	vector<XMINT3> PrevLinePoints;
 	bool HavePrevLine = false;
 
 	Points.clear();
@@ -211,8 +264,8 @@ uint32_t L2GeodataPathFind::ApplyLinearApproximation(vector<PathFindPoint>& Path
 
 		PathFindPoint* NextPoint = &Path[Index];
 
-		vector<XMINT3> CurrentLinePoints;
-		bool CanConstructALine = ConstructLineBetweenPoints(*CurrentPoint, *NextPoint, CurrentLinePoints, 0.9f);
+		LinePoints.clear();
+		bool CanConstructALine = ConstructLineBetweenPoints(*CurrentPoint, *NextPoint, LinePoints, 0.9f);
 		if (!CanConstructALine) {
 
 			if (!HavePrevLine)
@@ -224,7 +277,8 @@ uint32_t L2GeodataPathFind::ApplyLinearApproximation(vector<PathFindPoint>& Path
 			HavePrevLine = false;
 		}
 		else {
-			PrevLinePoints = CurrentLinePoints;
+			// swap keeps capacity of both scratch vectors
+			PrevLinePoints.swap(LinePoints);
 
 			PrevLineLastPoint = NextPoint;
 			HavePrevLine = true;
@@ -269,6 +323,79 @@ static const POINT ReversedDirections[4] = {
 	{  0,  1 }
 };
 
+bool L2GeodataPathFind::IsUniformCell(int32_t GridX, int32_t GridY, int16_t Height, uint32_t NeighborsWeight, int16_t& SubBlock)
+{
+	POINT WorldPoint = ToWorld({ GridX, GridY });
+
+	int16_t LayersCount;
+	int16_t* Layers = L2Geodata::GetSubBlocks(WorldPoint.x, WorldPoint.y, LayersCount);
+
+	if (LayersCount != 1 || GET_GEO_NSWE(Layers[0]) != L2Geodata::NSWE_ALL || GET_GEO_HEIGHT(Layers[0]) != Height)
+		return false;
+
+	PathFindPoint Point(GridX, GridY, 0, Layers[0]);
+
+	uint32_t CellNeighborsWeight;
+	if (!PathFindPoint::GetCachedNeighborsWeight(Point, CellNeighborsWeight) || CellNeighborsWeight != NeighborsWeight)
+		return false;
+
+	SubBlock = Layers[0];
+
+	return true;
+}
+
+L2GeodataPathFind::PathFindPoint L2GeodataPathFind::JumpFrom(PathFindPoint& First, uint8_t DirectionIndex, PathFindPoint& Finish)
+{
+	POINT Direction = Directions[DirectionIndex];
+	POINT Side = { Direction.y, Direction.x };
+
+	int16_t Height = GET_GEO_HEIGHT(First.SubBlock);
+
+	// no jumping where weights aren't cached (overridden cells, stale regions), checking uniformity there
+	// would calculate weights of every probed cell
+	uint32_t NeighborsWeight;
+	if (!PathFindPoint::GetCachedNeighborsWeight(First, NeighborsWeight))
+		return First;
+
+	int16_t SubBlock;
+
+	// first cell is checked with its back and side neighbors, after that every step adds only cells not seen yet:
+	// the forward one (the next cell itself) and two side ones of the next cell, its back is the current cell
+	if (!IsUniformCell(First.GridX, First.GridY, Height, NeighborsWeight, SubBlock) ||
+		!IsUniformCell(First.GridX - Direction.x, First.GridY - Direction.y, Height, NeighborsWeight, SubBlock) ||
+		!IsUniformCell(First.GridX + Side.x, First.GridY + Side.y, Height, NeighborsWeight, SubBlock) ||
+		!IsUniformCell(First.GridX - Side.x, First.GridY - Side.y, Height, NeighborsWeight, SubBlock))
+		return First;
+
+	PathFindPoint Current = First;
+
+	// path turns to the finish in its row or column, so cells there have to be expanded
+	while (Current.GridX != Finish.GridX && Current.GridY != Finish.GridY) {
+
+		// uniform forward neighbor makes current cell open field
+		POINT NextPoint = AddPoint({ Current.GridX, Current.GridY }, Direction);
+		if (!IsUniformCell(NextPoint.x, NextPoint.y, Height, NeighborsWeight, SubBlock))
+			break;
+
+		PathFindPoint Next(NextPoint.x, NextPoint.y, 0, SubBlock);
+		if (IsPointChecked(Next))
+			break;
+
+		Next.CalcAllWeights(false, Current, Finish);
+
+		// skipped cells still get their entries, so trace back goes through them cell by cell
+		SetPointEntry(Next, { true, DirectionIndex, (uint8_t)Current.LayerIndex });
+
+		Current = Next;
+
+		if (!IsUniformCell(Current.GridX + Side.x, Current.GridY + Side.y, Height, NeighborsWeight, SubBlock) ||
+			!IsUniformCell(Current.GridX - Side.x, Current.GridY - Side.y, Height, NeighborsWeight, SubBlock))
+			break;
+	}
+
+	return Current;
+}
+
 void L2GeodataPathFind::TraceBack(PathFindPoint& Finish, PathFindPoint& Start, vector<PathFindPoint>& Output)
 {
 	Output.clear();
@@ -315,17 +442,76 @@ void L2GeodataPathFind::RecalculateWeights(vector<PathFindPoint>& Path)
 	}
 }
 
-bool L2GeodataPathFind::FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight, DebugCallbackFunc DebugCallback)
+L2GeodataPathFind::L2GeodataPathFind(void)
+{
+	DebugCallback = NULL;
+
+	UsedRegionsCount = 0;
+	SearchIndex = 0;
+
+	RegionGrid.resize(REGION_GRID_WIDTH * REGION_GRID_HEIGHT, { NULL, 0 });
+
+	LastRegion = NULL;
+
+	ExpandedPointsCount = 0;
+
+	IsJumpPointSearch = false;
+}
+
+L2GeodataPathFind::~L2GeodataPathFind(void)
+{
+	for (RegionBuffer* Region : RegionsPool)
+		free(Region);
+}
+
+bool L2GeodataPathFind::FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight, DebugCallbackFunc DebugCallback,
+	L2GeodataOverlay* View)
 {
 	this->DebugCallback = DebugCallback;
 
-	PointsToCheck.clear();
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	// guard keeps a region replaced by ReloadRegion alive, but search would read it and the new one both,
+	// so search that saw a reload (odd version is a reload in the middle of its swap) starts over
+	for (;;) {
+
+		uint64_t Version = L2Geodata::GetReloadVersion();
+
+		bool Found;
+
+		try {
+			Found = RunSearch(Start, Finish, Output, Weight);
+		}
+		catch (runtime_error* Error) {
+			if (Version % 2 == 0 && L2Geodata::GetReloadVersion() == Version)
+				throw Error;
+
+			delete Error;
+			continue;
+		}
+
+		if (Version % 2 == 0 && L2Geodata::GetReloadVersion() == Version)
+			return Found;
+	}
+}
+
+bool L2GeodataPathFind::RunSearch(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight)
+{
+	PointsToCheck.Clear();
 	CheckedPoints.clear();
 
-	// TODO free buffers at the end
-	for (RegionBuffer* Region : Regions)
-		free(Region);
-	Regions.clear();
+	ExpandedPointsCount = 0;
+
+	// regions of the previous search go back to the pool, their slots become stale with the new search index
+	UsedRegionsCount = 0;
+	LastRegion = NULL;
+
+	// index 0 is never current, so after wrap every slot is stale again
+	if (++SearchIndex == 0) {
+		fill(RegionGrid.begin(), RegionGrid.end(), RegionGridSlot{ NULL, 0 });
+		SearchIndex = 1;
+	}
 
 	POINT StartPoint = ToGrid({ Start.x, Start.y });
 	POINT FinishPoint = ToGrid({ Finish.x, Finish.y });
@@ -337,9 +523,28 @@ bool L2GeodataPathFind::FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMIN
 	PathFindPoint PathFinish(FinishPoint.x, FinishPoint.y, Finish.z);
 	PathStart.CalcAllWeights(false, PathStart, PathFinish);
 
-	cout << "Start to finish heuristic weight: " << PathStart.HeuristicWeight << endl;
+	// most requests are short and unobstructed, then straight line is the path and search (with its region buffers) is skipped
+	PathFindPoint LineFinish;
+	LinePoints.clear();
+	if (WalkLine(PathStart, FinishPoint, LineFinish, &LinePoints) && LineFinish.LayerIndex == PathFinish.LayerIndex) {
+
+		Output.clear();
+		Output.push_back(LinePoints);
+
+		// same scale as RecalculateWeights gives the searched path: start point weight plus straight steps only,
+		// line takes a diagonal as two half diagonal steps
+		uint32_t DiagonalsCount = 0;
+		for (size_t Index = 1; Index < LinePoints.size(); Index++)
+			if (LinePoints[Index].x != LinePoints[Index - 1].x && LinePoints[Index].y != LinePoints[Index - 1].y)
+				DiagonalsCount++;
 
-	PointsToCheck.push_back(PathStart);
+		Weight = PathFindPoint::CalcWeight(false, PathStart, LineFinish) + LineFinish.Weight + 
+			DiagonalsCount * 2 * (STRAIGHT_WEIGHT - DIAGONAL_HALF_WEIGHT);
+
+		return true;
+	}
+
+	PointsToCheck.Push(PathStart);
 	SetPointEntry(PathStart, { true, 0, 0 });
 
 	DoDebugCallback();
@@ -349,13 +554,13 @@ bool L2GeodataPathFind::FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMIN
 
 	uint32_t CheckedPointsIndex = 0;
 
-	while (!PointsToCheck.empty()) {
+	while (!PointsToCheck.IsEmpty()) {
 
-		PathFindPoint Point = ExtractPointWithLowestWeight();
+		PathFindPoint Point = PointsToCheck.Pop();
+		ExpandedPointsCount++;
 
 		if (Point == PathFinish) {
 
-			vector<PathFindPoint> Path;
 			TraceBack(Point, PathStart, Path);
 
 			RecalculateWeights(Path);
@@ -399,11 +604,12 @@ bool L2GeodataPathFind::FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMIN
 
 					Neighbour.CalcAllWeights(IsDiagonal, Point, PathFinish);
 
-					auto InsertionPoint = lower_bound(PointsToCheck.begin(), PointsToCheck.end(), Neighbour);
+					SetPointEntry(Neighbour, { true, DirectionIndex, (uint8_t)Point.LayerIndex });
 
-					PointsToCheck.insert(InsertionPoint, Neighbour);
+					if (IsJumpPointSearch)
+						Neighbour = JumpFrom(Neighbour, DirectionIndex, PathFinish);
 
-					SetPointEntry(Neighbour, { true, DirectionIndex, (uint8_t)Point.LayerIndex });
+					PointsToCheck.Push(Neighbour);
 				}
 			}
 		}
@@ -412,7 +618,7 @@ bool L2GeodataPathFind::FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMIN
 		if (DebugCounter == NextDebugCounter) {
 			DoDebugCallback();
 
-			NextDebugCounter += PointsToCheck.size() * 3 + 1;
+			NextDebugCounter += PointsToCheck.Size * 3 + 1;
 		}
 
 		// DoDebugCallback();
@@ -425,8 +631,9 @@ vector<XMINT3> L2GeodataPathFind::GetPointsToCheck(void)
 {
 	vector<XMINT3> Result;
 
-	for (PathFindPoint& Point : PointsToCheck)
-		Result.push_back(Point.GetWorldPoint());
+	for (vector<PathFindPoint>& Bucket : PointsToCheck.Buckets)
+		for (PathFindPoint& Point : Bucket)
+			Result.push_back(Point.GetWorldPoint());
 
 	return Result;
 }
@@ -437,6 +644,22 @@ vector<XMINT3> L2GeodataPathFind::GetCheckedPoints(void)
 	return Result;
 }
 
+uint64_t L2GeodataPathFind::GetExpandedPointsCount(void)
+{
+	return ExpandedPointsCount;
+}
+
+void L2GeodataPathFind::SetSortedOpenList(bool IsSorted)
+{
+	PointsToCheck.Clear();
+	PointsToCheck.IsSorted = IsSorted;
+}
+
+void L2GeodataPathFind::SetJumpPointSearch(bool IsEnabled)
+{
+	IsJumpPointSearch = IsEnabled;
+}
+
 const static int NWC_GENEREATION_TASK_COUNT = 120;
 const static int WIDTH_PER_TASK = (L2Geodata::GEO_WIDTH + NWC_GENEREATION_TASK_COUNT - 1) / NWC_GENEREATION_TASK_COUNT;
 
@@ -444,6 +667,8 @@ VOID L2GeodataPathFind::GenerateNeighborWeightCacheWorkCallback(PTP_CALLBACK_INS
 {
 	int WorkNum = (int)(SIZE_T)Context;
 
+	L2Geodata::ReaderGuard Guard;
+
 	uint32_t StartX = WorkNum * WIDTH_PER_TASK;
 	uint32_t EndX = min(StartX + WIDTH_PER_TASK, L2Geodata::GEO_WIDTH) - 1;
 
@@ -483,6 +708,8 @@ void L2GeodataPathFind::GenerateNeighborWeightCache(void)
 
 	LONGLONG StartTime = GetTime();
 
+	L2Geodata::AllocateNWCRegions();
+
 	PTP_WORK Works[NWC_GENEREATION_TASK_COUNT];
 
 	for (int WorkNum = 0; WorkNum < NWC_GENEREATION_TASK_COUNT; WorkNum++) {
@@ -683,24 +910,46 @@ POINT L2GeodataPathFind::Offset;
 
 #define USE_NWC true
 
-uint32_t L2GeodataPathFind::PathFindPoint::GetNeighborsWeight(PathFindPoint& StartPoint)
+bool L2GeodataPathFind::PathFindPoint::GetCachedNeighborsWeight(PathFindPoint& StartPoint, uint32_t& Weight)
 {
-	uint32_t Weight;
-	
-	if (USE_NWC) {
-		POINT World = ToWorld({ StartPoint.GridX, StartPoint.GridY });
+	if (!USE_NWC)
+		return false;
 
-		uint8_t WeightsCount;
-		uint8_t* Weights = L2Geodata::GetNeighborWeights(World.x, World.y, WeightsCount);
+	POINT World = ToWorld({ StartPoint.GridX, StartPoint.GridY });
 
-		if (StartPoint.LayerIndex >= WeightsCount)
-			throw new runtime_error("Layer index out of bound (NWC)");
+	// NWC is built from static geodata, so its layers don't match cells overridden by doors or instance views
+	L2GeodataOverlay* Overlay = L2Geodata::GetActiveOverlay();
+	if (Overlay) {
+		uint32_t GeoX, GeoY;
+		int16_t* OverlayLayers;
+		int16_t OverlayLayersCount;
 
-		Weight = Weights[StartPoint.LayerIndex];
+		if (L2Geodata::WorldToGeo(World.x, World.y, &GeoX, &GeoY) &&
+			Overlay->FindSubBlocks(GeoX, GeoY, OverlayLayers, OverlayLayersCount))
+			return false;
 	}
-	else {
+
+	uint8_t WeightsCount;
+	uint8_t* Weights = L2Geodata::GetNeighborWeights(World.x, World.y, WeightsCount);
+
+	// cache has no weights for the cell (e.g. its region was reloaded after cache was built)
+	if (Weights == nullptr)
+		return false;
+
+	if (StartPoint.LayerIndex >= WeightsCount)
+		throw new runtime_error("Layer index out of bound (NWC)");
+
+	Weight = Weights[StartPoint.LayerIndex];
+
+	return true;
+}
+
+uint32_t L2GeodataPathFind::PathFindPoint::GetNeighborsWeight(PathFindPoint& StartPoint)
+{
+	uint32_t Weight;
+
+	if (!GetCachedNeighborsWeight(StartPoint, Weight))
 		Weight = CalcNeighborsWeight(StartPoint);
-	}
 
 	return Weight;
 
@@ -780,11 +1029,32 @@ Point.z * REGION_SIZE * REGION_SIZE + \
 Point.x * REGION_SIZE + \
 Point.y
 
+void L2GeodataPathFind::RegionBuffer::Reset(POINT RegionPoint)
+{
+	this->RegionPoint = RegionPoint;
+
+	// generation 0 is never current, so after wrap every column is stale again
+	if (++Generation == 0) {
+		memset(ColumnGenerations, 0, sizeof(ColumnGenerations));
+		Generation = 1;
+	}
+}
+
 void L2GeodataPathFind::RegionBuffer::SetPointEntry(XMINT3 Point, RegionBufferEntry Entry)
 {
 	if (Point.x < 0 || Point.y < 0 || Point.z < 0 || Point.x >= REGION_SIZE || Point.y >= REGION_SIZE || Point.z >= L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT)
 		throw new runtime_error("RegionBuffer out of bound");
 
+	uint32_t ColumnIndex = Point.x * REGION_SIZE + Point.y;
+
+	if (ColumnGenerations[ColumnIndex] != Generation) {
+
+		for (uint32_t LayerIndex = 0; LayerIndex < L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT; LayerIndex++)
+			Data[LayerIndex * REGION_SIZE * REGION_SIZE + ColumnIndex] = {};
+
+		ColumnGenerations[ColumnIndex] = Generation;
+	}
+
 	uint32_t Index = GET_REGION_INDEX;
 
 	Data[Index] = Entry;
@@ -795,6 +1065,9 @@ L2GeodataPathFind::RegionBufferEntry L2GeodataPathFind::RegionBuffer::GetPointEn
 	if (Point.x < 0 || Point.y < 0 || Point.z < 0 || Point.x >= REGION_SIZE || Point.y >= REGION_SIZE || Point.z >= L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT)
 		throw new runtime_error("RegionBuffer out of bound");
 
+	if (ColumnGenerations[Point.x * REGION_SIZE + Point.y] != Generation)
+		return {};
+
 	uint32_t Index = GET_REGION_INDEX;
 
 	return Data[Index];
@@ -852,4 +1125,79 @@ bool L2GeodataPathFind::NeighborsRegionQueue::Pop(uint8_t& X, uint8_t& Y, uint8_
 	CurrentPopIndex++;
 
 	return true;
-}
\ No newline at end of file
+}
+
+// OpenList
+
+L2GeodataPathFind::OpenList::OpenList(void)
+{
+	IsSorted = false;
+
+	Clear();
+}
+
+void L2GeodataPathFind::OpenList::Clear(void)
+{
+	// buckets keep their capacity for the next search
+	for (vector<PathFindPoint>& Bucket : Buckets)
+		Bucket.clear();
+
+	LastKey = 0;
+	Size = 0;
+}
+
+uint32_t L2GeodataPathFind::OpenList::GetBucketIndex(uint32_t Key)
+{
+	if (Key <= LastKey)
+		return 0;
+
+	unsigned long Bit;
+	_BitScanReverse(&Bit, Key ^ LastKey);
+
+	return Bit + 1;
+}
+
+void L2GeodataPathFind::OpenList::Push(PathFindPoint& Point)
+{
+	Size++;
+
+	if (IsSorted) {
+		// descending by weight, lowest is at the back
+		auto InsertionPoint = lower_bound(Buckets[0].begin(), Buckets[0].end(), Point);
+
+		Buckets[0].insert(InsertionPoint, Point);
+		return;
+	}
+
+	Buckets[GetBucketIndex(Point.HeuristicWeight)].push_back(Point);
+}
+
+L2GeodataPathFind::PathFindPoint L2GeodataPathFind::OpenList::Pop(void)
+{
+	if (!IsSorted && Buckets[0].empty()) {
+
+		uint32_t BucketIndex = 1;
+		while (Buckets[BucketIndex].empty())
+			BucketIndex++;
+
+		vector<PathFindPoint>& Bucket = Buckets[BucketIndex];
+
+		LastKey = UINT32_MAX;
+		for (PathFindPoint& Point : Bucket)
+			if (Point.HeuristicWeight < LastKey)
+				LastKey = Point.HeuristicWeight;
+
+		// every key of the bucket shares higher bits with the new minimum, so they all go to lower buckets
+		for (PathFindPoint& Point : Bucket)
+			Buckets[GetBucketIndex(Point.HeuristicWeight)].push_back(Point);
+
+		Bucket.clear();
+	}
+
+	PathFindPoint Point = Buckets[0].back();
+	Buckets[0].pop_back();
+
+	Size--;
+
+	return Point;
+}
@@ -37,16 +37,33 @@ private:
 	};
 #pragma pack(pop)
 
+	// regions are pooled between searches, entries of a column (all layers of a grid point) belong to the current search
+	// only if column has generation of the region, so region is cleared by generation increment and columns are zeroed
+	// lazily on first write
 	struct RegionBuffer {
 
 		POINT RegionPoint;
 
+		uint8_t Generation;
+		uint8_t ColumnGenerations[REGION_SIZE * REGION_SIZE];
+
 		RegionBufferEntry Data[REGION_SIZE * REGION_SIZE * L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT];
 
+		void Reset(POINT RegionPoint);
 		void SetPointEntry(XMINT3 Point, RegionBufferEntry Entry);
 		RegionBufferEntry GetPointEntry(XMINT3 Point);
 	};
 
+	// region points are relative to search midpoint, so grid of this size covers the whole map from any midpoint
+	const static int REGION_GRID_WIDTH = 2 * (L2Geodata::GEO_WIDTH / REGION_SIZE + 2);
+	const static int REGION_GRID_HEIGHT = 2 * (L2Geodata::GEO_HEIGHT / REGION_SIZE + 2);
+
+	// slot is taken by the current search only if it has current search index
+	struct RegionGridSlot {
+		RegionBuffer* Region;
+		uint32_t SearchIndex;
+	};
+
 	struct NeighborsRegionBuffer {
 		uint8_t Data[(NEIGHBORS_REGION_SIZE * NEIGHBORS_REGION_SIZE + 7) / 8];
 
@@ -70,6 +87,7 @@ private:
 	};
 
 public:
+	// noise offset for weight experiments, searches only read it, so it's set before any search starts
 	static POINT Offset;
 
 	struct PathFindPoint {
@@ -107,20 +125,58 @@ public:
 
 		static uint32_t CalcNeighborsWeight(PathFindPoint& StartPoint);
 		static uint32_t GetNeighborsWeight(PathFindPoint& StartPoint);
+		// weight from NWC only, false if the cell is overridden by the overlay or cache has nothing for it
+		static bool GetCachedNeighborsWeight(PathFindPoint& StartPoint, uint32_t& Weight);
 	};
 private:
 
+	// monotone radix heap by HeuristicWeight, point goes to the bucket of the highest bit where its key differs from the last
+	// extracted key, so push is O(1) and a point moves down at most 32 times before it's extracted.
+	// Heuristic isn't consistent everywhere, keys below the last extracted one are taken as equal to it.
+	// Sorted mode is the former sorted vector (O(n) insert), kept as reference for benchmarks
+	struct OpenList {
+
+		const static int BUCKETS_COUNT = 33;
+
+		vector<PathFindPoint> Buckets[BUCKETS_COUNT];
+		uint32_t LastKey;
+		size_t Size;
+
+		bool IsSorted;
+
+		OpenList(void);
+		void Clear(void);
+		void Push(PathFindPoint& Point);
+		PathFindPoint Pop(void);
+		inline bool IsEmpty(void) { return Size == 0; }
+
+		uint32_t GetBucketIndex(uint32_t Key);
+	};
+
 	DebugCallbackFunc DebugCallback;
 
-	vector<RegionBuffer*> Regions;
+	// search context, everything here is reused by the next search on this object, so steady-state search doesn't allocate
+	vector<RegionBuffer*> RegionsPool;
+	uint32_t UsedRegionsCount;
+
+	vector<RegionGridSlot> RegionGrid;
+	uint32_t SearchIndex;
+
 	POINT RegionOffset;
 
 	RegionBuffer* LastRegion;
 	POINT LastRegionPoint;
 
-	vector<PathFindPoint> PointsToCheck;
+	OpenList PointsToCheck;
 	vector<XMINT3> CheckedPoints;
 
+	vector<PathFindPoint> Path;
+	vector<XMINT3> LinePoints, PrevLinePoints;
+
+	uint64_t ExpandedPointsCount;
+
+	bool IsJumpPointSearch;
+
 	static POINT ToGrid(POINT World);
 	static POINT ToWorld(POINT Grid);
 
@@ -130,26 +186,58 @@ private:
 	RegionBufferEntry GetPointEntry(PathFindPoint& Point);
 	void SetPointEntry(PathFindPoint& Point, RegionBufferEntry Entry);
 
-	PathFindPoint ExtractPointWithLowestWeight(void);
+	// single layer cell open to every side with given height and neighbors weight (taken from NWC, cells without cached
+	// weight are never uniform, so jumping doesn't run flood fills), SubBlock is its only layer
+	static bool IsUniformCell(int32_t GridX, int32_t GridY, int16_t Height, uint32_t NeighborsWeight, int16_t& SubBlock);
+	// goes on from First (just reached in Direction) while cells are open field (cell and its four neighbors are uniform,
+	// so every step through it costs the same), returns the cell where it stopped: next to a wall, layer change or
+	// different weight, in finish row or column, or before a checked cell
+	PathFindPoint JumpFrom(PathFindPoint& First, uint8_t DirectionIndex, PathFindPoint& Finish);
 
 	void TraceBack(PathFindPoint& Finish, PathFindPoint& Start, vector<PathFindPoint>& Path);
 	void RecalculateWeights(vector<PathFindPoint>& Path);
 
-	bool GetNextLinePoint(PathFindPoint& PrevPoint, POINT& Direction, PathFindPoint& NextPoint, bool IsDiagonal);
+	static bool GetNextLinePoint(PathFindPoint& PrevPoint, POINT& Direction, PathFindPoint& NextPoint, bool IsDiagonal);
+	// steps from Start to Finish grid point along straight line, Last is the point where the walk ended (with summed weight)
+	static bool WalkLine(PathFindPoint& Start, POINT Finish, PathFindPoint& Last, vector<XMINT3>* LinePoints);
 	bool ConstructLineBetweenPoints(PathFindPoint& Start, PathFindPoint& Finish, vector<XMINT3>& LinePoints, float WeightThreshold);
 	uint32_t ApplyLinearApproximation(vector<PathFindPoint>& Path, vector<vector<XMINT3>>& Points);
 	uint32_t GetPathAsSingleLine(vector<PathFindPoint>& Path, vector<vector<XMINT3>>& Points);
 
 	void DoDebugCallback(void);
 
+	// single search over geodata as it is now, FindPath repeats it if a region was reloaded meanwhile
+	bool RunSearch(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight);
+
 	static VOID NTAPI GenerateNeighborWeightCacheWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work);
 
 
 public:
-	bool FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight, DebugCallbackFunc DebugCallback = NULL);
+	L2GeodataPathFind(void);
+	~L2GeodataPathFind(void);
+
+	// search object owns pooled region buffers (6.8 MB each), it's meant to be kept and reused, not copied
+	L2GeodataPathFind(const L2GeodataPathFind&) = delete;
+	L2GeodataPathFind& operator=(const L2GeodataPathFind&) = delete;
+
+	// View as in L2Geodata::OverlayScope
+	bool FindPath(XMINT3 Start, XMINT3 Finish, vector<vector<XMINT3>>& Output, uint32_t& Weight, DebugCallbackFunc DebugCallback = NULL,
+		L2GeodataOverlay* View = nullptr);
+
+	// walks straight segment with the same rules as path search, FinishZ is height of the layer it ends on,
+	// doesn't need a search object (or its region buffers)
+	static bool CanMoveTo(XMINT3 Start, XMINT3 Finish, int32_t& FinishZ, L2GeodataOverlay* View = nullptr);
 
 	vector<XMINT3> GetPointsToCheck(void);
 	vector<XMINT3> GetCheckedPoints(void);
 
+	// points taken from open list by the last FindPath
+	uint64_t GetExpandedPointsCount(void);
+	// sorted vector open list instead of radix heap, for benchmarks
+	void SetSortedOpenList(bool IsSorted);
+	// JPS-style jumps over open field (flat single layer NSWE_ALL cells with equal NWC weight), only jump ends are
+	// expanded there, cells near walls, layer changes and weight changes are expanded one by one as usual
+	void SetJumpPointSearch(bool IsEnabled);
+
 	static void GenerateNeighborWeightCache(void);
 };
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "stdafx.h"
+
+#include "L2GeodataPathFindService.h"
+#include "L2GeodataPathFind.h"
+
+L2GeodataPathFindService::L2GeodataPathFindService(uint32_t WorkersCount)
+{
+	if (WorkersCount == 0)
+		WorkersCount = thread::hardware_concurrency();
+	if (WorkersCount == 0)
+		WorkersCount = 1;
+
+	IsStopping = false;
+
+	for (uint32_t WorkerIndex = 0; WorkerIndex < WorkersCount; WorkerIndex++)
+		Workers.push_back(thread(&L2GeodataPathFindService::WorkerLoop, this));
+}
+
+L2GeodataPathFindService::~L2GeodataPathFindService(void)
+{
+	{
+		lock_guard<mutex> Lock(QueueLock);
+		IsStopping = true;
+	}
+
+	QueueCondition.notify_all();
+
+	for (thread& Worker : Workers)
+		Worker.join();
+}
+
+void L2GeodataPathFindService::Enqueue(PathFindQuery&& Query)
+{
+	{
+		lock_guard<mutex> Lock(QueueLock);
+		Queue.push_back(move(Query));
+	}
+
+	QueueCondition.notify_one();
+}
+
+future<PathFindResult> L2GeodataPathFindService::FindPath(XMINT3 Start, XMINT3 Finish, L2GeodataOverlay* View)
+{
+	PathFindQuery Query;
+	Query.Start = Start;
+	Query.Finish = Finish;
+	Query.View = View;
+
+	future<PathFindResult> Result = Query.Promise.get_future();
+
+	Enqueue(move(Query));
+
+	return Result;
+}
+
+void L2GeodataPathFindService::FindPath(XMINT3 Start, XMINT3 Finish, PathFindResultCallback Callback, L2GeodataOverlay* View)
+{
+	PathFindQuery Query;
+	Query.Start = Start;
+	Query.Finish = Finish;
+	Query.View = View;
+	Query.Callback = move(Callback);
+
+	Enqueue(move(Query));
+}
+
+void L2GeodataPathFindService::WorkerLoop(void)
+{
+	// search context of this worker, its buffers are reused by every query the worker takes
+	L2GeodataPathFind Search;
+
+	for (;;) {
+
+		PathFindQuery Query;
+
+		{
+			unique_lock<mutex> Lock(QueueLock);
+			QueueCondition.wait(Lock, [this] { return IsStopping || !Queue.empty(); });
+
+			if (Queue.empty())
+				return;
+
+			Query = move(Queue.front());
+			Queue.pop_front();
+		}
+
+		PathFindResult Result;
+
+		// any error (broken query, out of memory) goes to the caller, it shouldn't take the worker down
+		try {
+			Result.Found = Search.FindPath(Query.Start, Query.Finish, Result.Path, Result.Weight, NULL, Query.View);
+		}
+		catch (...) {
+			Result.Error = current_exception();
+
+			Result.Found = false;
+			Result.Path.clear();
+		}
+
+		if (!Result.Found)
+			Result.Weight = 0;
+
+		if (!Query.Callback) {
+			if (Result.Error)
+				Query.Promise.set_exception(Result.Error);
+			else
+				Query.Promise.set_value(move(Result));
+
+			continue;
+		}
+
+		try {
+			Query.Callback(Result);
+		}
+		catch (runtime_error* Error) {
+			delete Error;
+		}
+		catch (...) {
+		}
+	}
+}
+
+uint32_t L2GeodataPathFindService::GetWorkersCount(void)
+{
+	return (uint32_t)Workers.size();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <DirectXMath.h>
+
+#include "L2Geodata.h"
+
+using namespace std;
+using namespace DirectX;
+
+struct PathFindResult {
+	bool Found;
+	vector<vector<XMINT3>> Path;
+	uint32_t Weight;
+	// set when the query failed (search threw), Found is false then, rethrow_exception gives the original error
+	exception_ptr Error;
+};
+
+typedef function<void(PathFindResult& Result)> PathFindResultCallback;
+
+// Path queries from any thread, answered by a fixed set of workers. Every worker keeps its own L2GeodataPathFind
+// (pooled region buffers, open list), so workers share only the queue and read-only geodata and scale with cores.
+class L2GeodataPathFindService {
+private:
+	struct PathFindQuery {
+		XMINT3 Start, Finish;
+		L2GeodataOverlay* View;
+
+		// either promise of the future returned to caller or callback
+		promise<PathFindResult> Promise;
+		PathFindResultCallback Callback;
+	};
+
+	vector<thread> Workers;
+
+	mutex QueueLock;
+	condition_variable QueueCondition;
+	deque<PathFindQuery> Queue;
+	bool IsStopping;
+
+	void Enqueue(PathFindQuery&& Query);
+	void WorkerLoop(void);
+public:
+	// WorkersCount 0 is one worker per hardware thread
+	L2GeodataPathFindService(uint32_t WorkersCount = 0);
+	// queries that are already queued are finished first
+	~L2GeodataPathFindService(void);
+
+	L2GeodataPathFindService(const L2GeodataPathFindService&) = delete;
+	L2GeodataPathFindService& operator=(const L2GeodataPathFindService&) = delete;
+
+	// View (if any) has to live until the query is answered, get() rethrows the error of a failed query
+	future<PathFindResult> FindPath(XMINT3 Start, XMINT3 Finish, L2GeodataOverlay* View = nullptr);
+	// Callback is called on a worker thread, failed query comes with Error set,
+	// anything Callback throws is dropped so the worker stays alive
+	void FindPath(XMINT3 Start, XMINT3 Finish, PathFindResultCallback Callback, L2GeodataOverlay* View = nullptr);
+
+	uint32_t GetWorkersCount(void);
+};
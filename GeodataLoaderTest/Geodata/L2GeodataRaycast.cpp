@@ -0,0 +1,297 @@
+#include "stdafx.h"
+
+#include "L2GeodataRaycast.h"
+#include "L2GeodataOverlay.h"
+
+#include <iostream>
+#include <cfloat>
+#include <cmath>
+
+#include "TimeUtils.h"
+
+atomic<L2GeodataRaycast::RegionPyramid*> L2GeodataRaycast::Pyramids[L2Geodata::GEO_WIDTH_IN_REGIONS][L2Geodata::GEO_HEIGHT_IN_REGIONS];
+
+// ray
+
+L2GeodataRaycast::Ray L2GeodataRaycast::MakeRay(XMINT3 From, XMINT3 To)
+{
+	Ray Result;
+
+	Result.StartX = (double)(From.x - L2Geodata::MAP_MIN_X) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	Result.StartY = (double)(From.y - L2Geodata::MAP_MIN_Y) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	Result.StartZ = From.z;
+
+	Result.DeltaX = (double)(To.x - From.x) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	Result.DeltaY = (double)(To.y - From.y) / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	Result.DeltaZ = To.z - From.z;
+
+	return Result;
+}
+
+void L2GeodataRaycast::Ray::GetCell(double T, int32_t& GeoX, int32_t& GeoY) const
+{
+	const double NUDGE = 1e-6;
+
+	double X = StartX + DeltaX * T;
+	double Y = StartY + DeltaY * T;
+
+	GeoX = (int32_t)floor(X + (DeltaX > 0 ? NUDGE : DeltaX < 0 ? -NUDGE : 0));
+	GeoY = (int32_t)floor(Y + (DeltaY > 0 ? NUDGE : DeltaY < 0 ? -NUDGE : 0));
+}
+
+double L2GeodataRaycast::Ray::GetNodeExit(int32_t GeoX, int32_t GeoY, uint32_t Shift) const
+{
+	int32_t NodeX = GeoX >> Shift << Shift;
+	int32_t NodeY = GeoY >> Shift << Shift;
+
+	double ExitX = DeltaX > 0 ? (NodeX + (1 << Shift) - StartX) / DeltaX : DeltaX < 0 ? (NodeX - StartX) / DeltaX : DBL_MAX;
+	double ExitY = DeltaY > 0 ? (NodeY + (1 << Shift) - StartY) / DeltaY : DeltaY < 0 ? (NodeY - StartY) / DeltaY : DBL_MAX;
+
+	return ExitX < ExitY ? ExitX : ExitY;
+}
+
+double L2GeodataRaycast::SkipEmptyNodes(const Ray& Segment, int32_t GeoX, int32_t GeoY, double T, int32_t Margin, bool BelowAllowed,
+	L2GeodataOverlay* Overlay)
+{
+	uint32_t RegionX = GeoX / L2Geodata::GEO_REGION_SIZE;
+	uint32_t RegionY = GeoY / L2Geodata::GEO_REGION_SIZE;
+
+	if (Overlay && Overlay->HasRegionCells(RegionX, RegionY))
+		return T;
+
+	RegionPyramid* Pyramid = Pyramids[RegionX][RegionY].load(memory_order_acquire);
+	if (!Pyramid)
+		return T;
+
+	uint32_t BlockX = GeoX % L2Geodata::GEO_REGION_SIZE >> BLOCK_SIZE_SHIFT;
+	uint32_t BlockY = GeoY % L2Geodata::GEO_REGION_SIZE >> BLOCK_SIZE_SHIFT;
+
+	double StartZ = Segment.GetZ(T);
+
+	// from the whole region down to a block, the first node that ray passes by is the largest one
+	for (int32_t Level = LEVELS_COUNT - 1; Level >= 0; Level--) {
+
+		HeightRange& Node = Pyramid->Nodes[GetLevelOffset(Level) + (BlockX >> Level) * GetLevelSize(Level) + (BlockY >> Level)];
+
+		double Exit = Segment.GetNodeExit(GeoX, GeoY, BLOCK_SIZE_SHIFT + Level);
+		double EndZ = Segment.GetZ(Exit < 1.0 ? Exit : 1.0);
+
+		double LowZ = StartZ < EndZ ? StartZ : EndZ;
+		double HighZ = StartZ < EndZ ? EndZ : StartZ;
+
+		if (Node.Min > Node.Max || LowZ > Node.Max + Margin || BelowAllowed && HighZ < Node.Min - Margin)
+			return Exit > T ? Exit : T;
+	}
+
+	return T;
+}
+
+// pyramid
+
+void L2GeodataRaycast::BuildPyramid(uint32_t RegionX, uint32_t RegionY)
+{
+	RegionPyramid* Pyramid = (RegionPyramid*)malloc(sizeof(RegionPyramid));
+	if (!Pyramid)
+		throw new runtime_error("Couldn't allocate height pyramid");
+
+	{
+		L2Geodata::ReaderGuard Guard;
+
+		for (uint32_t BlockX = 0; BlockX < L2Geodata::GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+			for (uint32_t BlockY = 0; BlockY < L2Geodata::GEO_REGION_SIZE_IN_BLOCKS; BlockY++) {
+
+				HeightRange Range = { INT16_MAX, INT16_MIN };
+
+				for (uint32_t SubBlockX = 0; SubBlockX < L2Geodata::GEO_BLOCK_SIZE; SubBlockX++)
+					for (uint32_t SubBlockY = 0; SubBlockY < L2Geodata::GEO_BLOCK_SIZE; SubBlockY++) {
+
+						uint32_t GeoX = RegionX * L2Geodata::GEO_REGION_SIZE + BlockX * L2Geodata::GEO_BLOCK_SIZE + SubBlockX;
+						uint32_t GeoY = RegionY * L2Geodata::GEO_REGION_SIZE + BlockY * L2Geodata::GEO_BLOCK_SIZE + SubBlockY;
+
+						int16_t LayersCount;
+						int16_t* Layers = L2Geodata::GetStaticSubBlocks(GeoX, GeoY, LayersCount);
+						if (LayersCount == 0)
+							continue;
+
+						// layers are sorted by height descending
+						int16_t Max = GET_GEO_HEIGHT(Layers[0]);
+						int16_t Min = GET_GEO_HEIGHT(Layers[LayersCount - 1]);
+
+						if (Max > Range.Max)
+							Range.Max = Max;
+						if (Min < Range.Min)
+							Range.Min = Min;
+					}
+
+				Pyramid->Nodes[BlockX * L2Geodata::GEO_REGION_SIZE_IN_BLOCKS + BlockY] = Range;
+			}
+	}
+
+	for (uint32_t Level = 1; Level < LEVELS_COUNT; Level++) {
+
+		uint32_t Size = GetLevelSize(Level);
+
+		HeightRange* Nodes = &Pyramid->Nodes[GetLevelOffset(Level)];
+		HeightRange* Children = &Pyramid->Nodes[GetLevelOffset(Level - 1)];
+
+		for (uint32_t NodeX = 0; NodeX < Size; NodeX++)
+			for (uint32_t NodeY = 0; NodeY < Size; NodeY++) {
+
+				HeightRange Range = { INT16_MAX, INT16_MIN };
+
+				for (uint32_t ChildX = NodeX * 2; ChildX < NodeX * 2 + 2; ChildX++)
+					for (uint32_t ChildY = NodeY * 2; ChildY < NodeY * 2 + 2; ChildY++) {
+
+						HeightRange& Child = Children[ChildX * Size * 2 + ChildY];
+
+						if (Child.Max > Range.Max)
+							Range.Max = Child.Max;
+						if (Child.Min < Range.Min)
+							Range.Min = Child.Min;
+					}
+
+				Nodes[NodeX * Size + NodeY] = Range;
+			}
+	}
+
+	L2Geodata::RetireMemory(Pyramids[RegionX][RegionY].exchange(Pyramid, memory_order_acq_rel));
+}
+
+void L2GeodataRaycast::BuildPyramids(void)
+{
+	LONGLONG StartTime = GetTime();
+
+	vector<uint32_t> RegionIndices;
+
+	for (uint32_t RegionX = 0; RegionX < L2Geodata::GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < L2Geodata::GEO_HEIGHT_IN_REGIONS; RegionY++)
+			if (L2Geodata::Regions[RegionX][RegionY].load())
+				RegionIndices.push_back(RegionX * L2Geodata::GEO_HEIGHT_IN_REGIONS + RegionY);
+
+	L2Geodata::RunParallel((uint32_t)RegionIndices.size(), [&RegionIndices](uint32_t Index) {
+		BuildPyramid(RegionIndices[Index] / L2Geodata::GEO_HEIGHT_IN_REGIONS, RegionIndices[Index] % L2Geodata::GEO_HEIGHT_IN_REGIONS);
+	});
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Height pyramids built for " << TimeToMs(EndTime - StartTime) << " ms (" << RegionIndices.size() << " regions, " <<
+		RegionIndices.size() * sizeof(RegionPyramid) / (1024 * 1024) << " MB)" << endl;
+}
+
+void L2GeodataRaycast::FreePyramids(void)
+{
+	for (uint32_t RegionX = 0; RegionX < L2Geodata::GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < L2Geodata::GEO_HEIGHT_IN_REGIONS; RegionY++)
+			FreePyramid(RegionX, RegionY);
+}
+
+void L2GeodataRaycast::FreePyramid(uint32_t RegionX, uint32_t RegionY)
+{
+	L2Geodata::RetireMemory(Pyramids[RegionX][RegionY].exchange(nullptr, memory_order_acq_rel));
+}
+
+// queries
+
+bool L2GeodataRaycast::Raycast(XMINT3 From, XMINT3 To, XMINT3& Hit, L2GeodataOverlay* View)
+{
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	L2GeodataOverlay* Overlay = L2Geodata::GetActiveOverlay();
+
+	Ray Segment = MakeRay(From, To);
+
+	double T = 0;
+
+	while (T < 1.0) {
+
+		int32_t GeoX, GeoY;
+		Segment.GetCell(T, GeoX, GeoY);
+
+		if (GeoX < 0 || GeoX >= (int32_t)L2Geodata::GEO_WIDTH || GeoY < 0 || GeoY >= (int32_t)L2Geodata::GEO_HEIGHT)
+			return false;
+
+		double Skipped = SkipEmptyNodes(Segment, GeoX, GeoY, T, 0, true, Overlay);
+		if (Skipped > T) {
+			T = Skipped;
+			continue;
+		}
+
+		double Exit = Segment.GetNodeExit(GeoX, GeoY, 0);
+		if (Exit > 1.0)
+			Exit = 1.0;
+
+		int16_t LayersCount;
+		int16_t* Layers = L2Geodata::GetSubBlocksGeo(GeoX, GeoY, LayersCount);
+
+		double StartZ = Segment.GetZ(T);
+		double EndZ = Segment.GetZ(Exit);
+
+		// going down ray hits the highest layer under it, going up - the lowest layer over it
+		bool HasHit = false;
+		int16_t HitHeight = 0;
+
+		if (StartZ >= EndZ) {
+
+			int16_t LayerIndex = L2Geodata::CountLayersAbove(Layers, LayersCount, (int32_t)floor(StartZ));
+			if (LayerIndex < LayersCount && GET_GEO_HEIGHT(Layers[LayerIndex]) >= EndZ) {
+				HasHit = true;
+				HitHeight = GET_GEO_HEIGHT(Layers[LayerIndex]);
+			}
+		}
+		else {
+
+			int16_t LayersAbove = L2Geodata::CountLayersAbove(Layers, LayersCount, (int32_t)ceil(StartZ) - 1);
+			if (LayersAbove > 0 && GET_GEO_HEIGHT(Layers[LayersAbove - 1]) <= EndZ) {
+				HasHit = true;
+				HitHeight = GET_GEO_HEIGHT(Layers[LayersAbove - 1]);
+			}
+		}
+
+		if (HasHit) {
+
+			double HitT = Segment.DeltaZ != 0 ? (HitHeight - Segment.StartZ) / Segment.DeltaZ : T;
+			if (HitT < T)
+				HitT = T;
+			if (HitT > Exit)
+				HitT = Exit;
+
+			Hit.x = L2Geodata::MAP_MIN_X + (int32_t)floor((Segment.StartX + Segment.DeltaX * HitT) * L2Geodata::GEO_COORDS_IN_WORLD_COORDS);
+			Hit.y = L2Geodata::MAP_MIN_Y + (int32_t)floor((Segment.StartY + Segment.DeltaY * HitT) * L2Geodata::GEO_COORDS_IN_WORLD_COORDS);
+			Hit.z = HitHeight;
+
+			return true;
+		}
+
+		// exit can't be behind T, but float error on a cell corner must not stall the walk
+		T = Exit > T ? Exit : T + 1e-9;
+	}
+
+	return false;
+}
+
+bool L2GeodataRaycast::IsRayAboveTerrain(XMINT3 From, XMINT3 To, int32_t Margin)
+{
+	L2GeodataOverlay* Overlay = L2Geodata::GetActiveOverlay();
+
+	Ray Segment = MakeRay(From, To);
+
+	double T = 0;
+
+	while (T < 1.0) {
+
+		int32_t GeoX, GeoY;
+		Segment.GetCell(T, GeoX, GeoY);
+
+		if (GeoX < 0 || GeoX >= (int32_t)L2Geodata::GEO_WIDTH || GeoY < 0 || GeoY >= (int32_t)L2Geodata::GEO_HEIGHT)
+			return false;
+
+		double Skipped = SkipEmptyNodes(Segment, GeoX, GeoY, T, Margin, false, Overlay);
+		if (Skipped <= T)
+			return false;
+
+		T = Skipped;
+	}
+
+	return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <DirectXMath.h>
+
+#include "L2Geodata.h"
+
+using namespace std;
+using namespace DirectX;
+
+// Min/max height pyramid over static geodata and ray queries that use it to skip space without layers.
+// Level 0 node is a geo block, every next level doubles node size up to the whole region. Ray can't cross any layer
+// of a node if it stays above node maximum (or below node minimum) over the node, so the largest such node around
+// the ray is skipped at once and only cells close to the terrain are tested one by one.
+// Regions with overlay cells are always walked by cells, pyramid knows only static layers.
+class L2GeodataRaycast {
+private:
+	// GEO_REGION_SIZE_IN_BLOCKS is 2^8, so there are 9 levels from a block to the region
+	const static uint32_t LEVELS_COUNT = 9;
+	const static uint32_t NODES_COUNT = ((1 << 2 * LEVELS_COUNT) - 1) / 3;
+	const static uint32_t BLOCK_SIZE_SHIFT = 3;
+
+	// Min > Max for node without layers
+	struct HeightRange {
+		int16_t Min, Max;
+	};
+
+	// levels go one after another, nodes of level are stored X major like blocks in linear layout
+	struct RegionPyramid {
+		HeightRange Nodes[NODES_COUNT];
+	};
+
+	// XY in geo cells, Z in world coordinates, parameter goes from 0 at start to 1 at the end
+	struct Ray {
+		double StartX, StartY, StartZ;
+		double DeltaX, DeltaY, DeltaZ;
+
+		inline double GetZ(double T) const { return StartZ + DeltaZ * T; }
+		// cell that ray enters at T, nudged along the ray so a cell border counts as the next cell
+		void GetCell(double T, int32_t& GeoX, int32_t& GeoY) const;
+		// parameter where ray leaves square node of 2^Shift cells that contains the cell
+		double GetNodeExit(int32_t GeoX, int32_t GeoY, uint32_t Shift) const;
+	};
+
+	static atomic<RegionPyramid*> Pyramids[L2Geodata::GEO_WIDTH_IN_REGIONS][L2Geodata::GEO_HEIGHT_IN_REGIONS];
+
+	L2GeodataRaycast(void) { }
+
+	static inline uint32_t GetLevelOffset(uint32_t Level) { return ((1 << 2 * LEVELS_COUNT) - (1 << 2 * (LEVELS_COUNT - Level))) / 3; }
+	static inline uint32_t GetLevelSize(uint32_t Level) { return L2Geodata::GEO_REGION_SIZE_IN_BLOCKS >> Level; }
+
+	static Ray MakeRay(XMINT3 From, XMINT3 To);
+
+	// parameter where ray leaves the largest skippable node around the cell, T if there is none,
+	// Margin widens node height range, BelowAllowed lets ray pass under the terrain too
+	static double SkipEmptyNodes(const Ray& Segment, int32_t GeoX, int32_t GeoY, double T, int32_t Margin, bool BelowAllowed,
+		L2GeodataOverlay* Overlay);
+
+	static void BuildPyramid(uint32_t RegionX, uint32_t RegionY);
+public:
+	// builds pyramids of all loaded (resident in lazy mode) regions in parallel, pyramid of a reloaded or edited region
+	// is dropped, call again to get it back
+	static void BuildPyramids(void);
+	// raycasts walk every cell afterwards, old pyramids are freed once readers that could see them are gone
+	static void FreePyramids(void);
+	// pyramid of a region that got other content (reload, edit), raycasts walk its cells until it's built again
+	static void FreePyramid(uint32_t RegionX, uint32_t RegionY);
+
+	// first layer hit by the segment (from above or from below), Hit is on the layer
+	// View as in L2Geodata::OverlayScope
+	static bool Raycast(XMINT3 From, XMINT3 To, XMINT3& Hit, L2GeodataOverlay* View = nullptr);
+	// true if segment stays higher than Margin above every layer, answered by pyramid nodes only, so false just means
+	// that cells have to be checked. Caller holds ReaderGuard, active overlay is taken into account
+	static bool IsRayAboveTerrain(XMINT3 From, XMINT3 To, int32_t Margin);
+};
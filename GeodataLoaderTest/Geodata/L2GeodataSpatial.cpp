@@ -0,0 +1,403 @@
+#include "stdafx.h"
+
+#include "L2GeodataSpatial.h"
+#include "L2GeodataPathFind.h"
+#include "L2GeodataOverlay.h"
+
+#include <iostream>
+#include <bitset>
+
+#include "TimeUtils.h"
+
+atomic<L2GeodataSpatial::RegionSummary*> L2GeodataSpatial::Summaries[L2Geodata::GEO_WIDTH_IN_REGIONS][L2Geodata::GEO_HEIGHT_IN_REGIONS];
+
+// summaries
+
+void L2GeodataSpatial::BuildSummary(uint32_t RegionX, uint32_t RegionY)
+{
+	RegionSummary* Summary = (RegionSummary*)malloc(sizeof(RegionSummary));
+	if (!Summary)
+		throw new runtime_error("Couldn't allocate walkable summary");
+
+	L2Geodata::ReaderGuard Guard;
+
+	for (uint32_t BlockX = 0; BlockX < L2Geodata::GEO_REGION_SIZE_IN_BLOCKS; BlockX++)
+		for (uint32_t BlockY = 0; BlockY < L2Geodata::GEO_REGION_SIZE_IN_BLOCKS; BlockY++) {
+
+			BlockSummary Block = { 0, INT16_MAX, INT16_MIN };
+
+			for (uint32_t SubBlockX = 0; SubBlockX < L2Geodata::GEO_BLOCK_SIZE; SubBlockX++)
+				for (uint32_t SubBlockY = 0; SubBlockY < L2Geodata::GEO_BLOCK_SIZE; SubBlockY++) {
+
+					uint32_t GeoX = RegionX * L2Geodata::GEO_REGION_SIZE + BlockX * L2Geodata::GEO_BLOCK_SIZE + SubBlockX;
+					uint32_t GeoY = RegionY * L2Geodata::GEO_REGION_SIZE + BlockY * L2Geodata::GEO_BLOCK_SIZE + SubBlockY;
+
+					int16_t LayersCount;
+					int16_t* Layers = L2Geodata::GetStaticSubBlocks(GeoX, GeoY, LayersCount);
+
+					for (int16_t LayerIndex = 0; LayerIndex < LayersCount; LayerIndex++) {
+
+						if (GET_GEO_NSWE(Layers[LayerIndex]) == L2Geodata::NSWE_NONE)
+							continue;
+
+						int16_t Height = GET_GEO_HEIGHT(Layers[LayerIndex]);
+
+						Block.WalkableMask |= 1ull << (SubBlockX * L2Geodata::GEO_BLOCK_SIZE + SubBlockY);
+
+						if (Height < Block.MinHeight)
+							Block.MinHeight = Height;
+						if (Height > Block.MaxHeight)
+							Block.MaxHeight = Height;
+					}
+				}
+
+			Summary->Blocks[BlockX * L2Geodata::GEO_REGION_SIZE_IN_BLOCKS + BlockY] = Block;
+		}
+
+	L2Geodata::RetireMemory(Summaries[RegionX][RegionY].exchange(Summary, memory_order_acq_rel));
+}
+
+void L2GeodataSpatial::BuildSummaries(void)
+{
+	LONGLONG StartTime = GetTime();
+
+	vector<uint32_t> RegionIndices;
+
+	for (uint32_t RegionX = 0; RegionX < L2Geodata::GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < L2Geodata::GEO_HEIGHT_IN_REGIONS; RegionY++)
+			if (L2Geodata::Regions[RegionX][RegionY].load())
+				RegionIndices.push_back(RegionX * L2Geodata::GEO_HEIGHT_IN_REGIONS + RegionY);
+
+	L2Geodata::RunParallel((uint32_t)RegionIndices.size(), [&RegionIndices](uint32_t Index) {
+		BuildSummary(RegionIndices[Index] / L2Geodata::GEO_HEIGHT_IN_REGIONS, RegionIndices[Index] % L2Geodata::GEO_HEIGHT_IN_REGIONS);
+	});
+
+	LONGLONG EndTime = GetTime();
+
+	cout << "Walkable summaries built for " << TimeToMs(EndTime - StartTime) << " ms (" << RegionIndices.size() << " regions, " <<
+		RegionIndices.size() * sizeof(RegionSummary) / (1024 * 1024) << " MB)" << endl;
+}
+
+void L2GeodataSpatial::FreeSummaries(void)
+{
+	for (uint32_t RegionX = 0; RegionX < L2Geodata::GEO_WIDTH_IN_REGIONS; RegionX++)
+		for (uint32_t RegionY = 0; RegionY < L2Geodata::GEO_HEIGHT_IN_REGIONS; RegionY++)
+			FreeSummary(RegionX, RegionY);
+}
+
+void L2GeodataSpatial::FreeSummary(uint32_t RegionX, uint32_t RegionY)
+{
+	L2Geodata::RetireMemory(Summaries[RegionX][RegionY].exchange(nullptr, memory_order_acq_rel));
+}
+
+L2GeodataSpatial::BlockSummary L2GeodataSpatial::GetBlockSummary(uint32_t BlockX, uint32_t BlockY)
+{
+	uint32_t RegionX = BlockX / L2Geodata::GEO_REGION_SIZE_IN_BLOCKS;
+	uint32_t RegionY = BlockY / L2Geodata::GEO_REGION_SIZE_IN_BLOCKS;
+
+	// summary is built from static layers, overlay may open cells or move them in height anywhere in its regions
+	L2GeodataOverlay* Overlay = L2Geodata::GetActiveOverlay();
+	if (Overlay && Overlay->HasRegionCells(RegionX, RegionY))
+		return { UINT64_MAX, INT16_MIN, INT16_MAX };
+
+	RegionSummary* Summary = Summaries[RegionX][RegionY].load(memory_order_acquire);
+	if (!Summary)
+		return { UINT64_MAX, INT16_MIN, INT16_MAX };
+
+	return Summary->Blocks[BlockX % L2Geodata::GEO_REGION_SIZE_IN_BLOCKS * L2Geodata::GEO_REGION_SIZE_IN_BLOCKS + BlockY % L2Geodata::GEO_REGION_SIZE_IN_BLOCKS];
+}
+
+uint32_t L2GeodataSpatial::GetLowestBit(uint64_t Mask)
+{
+	unsigned long Bit;
+
+	if (_BitScanForward(&Bit, (unsigned long)Mask))
+		return Bit;
+
+	_BitScanForward(&Bit, (unsigned long)(Mask >> 32));
+	return Bit + 32;
+}
+
+// layers
+
+bool L2GeodataSpatial::GetClosestWalkableLayer(uint32_t GeoX, uint32_t GeoY, int32_t Height, int32_t MaxHeightDiff, int16_t& LayerHeight)
+{
+	int16_t LayersCount;
+	int16_t* Layers = L2Geodata::GetSubBlocksGeo(GeoX, GeoY, LayersCount);
+
+	// layers above Height go up from Below - 1, layers at or below go down from Below
+	int16_t Below = L2Geodata::CountLayersAbove(Layers, LayersCount, Height);
+
+	int32_t BestDiff = MaxHeightDiff + 1;
+
+	for (int16_t LayerIndex = Below - 1; LayerIndex >= 0; LayerIndex--)
+		if (GET_GEO_NSWE(Layers[LayerIndex]) != L2Geodata::NSWE_NONE) {
+
+			int32_t Diff = GET_GEO_HEIGHT(Layers[LayerIndex]) - Height;
+			if (Diff < BestDiff) {
+				BestDiff = Diff;
+				LayerHeight = GET_GEO_HEIGHT(Layers[LayerIndex]);
+			}
+			break;
+		}
+
+	for (int16_t LayerIndex = Below; LayerIndex < LayersCount; LayerIndex++)
+		if (GET_GEO_NSWE(Layers[LayerIndex]) != L2Geodata::NSWE_NONE) {
+
+			int32_t Diff = Height - GET_GEO_HEIGHT(Layers[LayerIndex]);
+			if (Diff < BestDiff) {
+				BestDiff = Diff;
+				LayerHeight = GET_GEO_HEIGHT(Layers[LayerIndex]);
+			}
+			break;
+		}
+
+	return BestDiff <= MaxHeightDiff;
+}
+
+bool L2GeodataSpatial::GetRandomWalkableLayer(uint32_t GeoX, uint32_t GeoY, int32_t Height, int32_t MaxHeightDiff, mt19937& Random,
+	int16_t& LayerHeight)
+{
+	int16_t LayersCount;
+	int16_t* Layers = L2Geodata::GetSubBlocksGeo(GeoX, GeoY, LayersCount);
+
+	int16_t First = L2Geodata::CountLayersAbove(Layers, LayersCount, Height + MaxHeightDiff);
+	int16_t Last = L2Geodata::CountLayersAbove(Layers, LayersCount, Height - MaxHeightDiff - 1);
+
+	int16_t Candidates[L2Geodata::LAYERS_PER_SUBBLOCK_LIMIT];
+	uint32_t CandidatesCount = 0;
+
+	for (int16_t LayerIndex = First; LayerIndex < Last; LayerIndex++)
+		if (GET_GEO_NSWE(Layers[LayerIndex]) != L2Geodata::NSWE_NONE)
+			Candidates[CandidatesCount++] = GET_GEO_HEIGHT(Layers[LayerIndex]);
+
+	if (CandidatesCount == 0)
+		return false;
+
+	LayerHeight = Candidates[uniform_int_distribution<uint32_t>(0, CandidatesCount - 1)(Random)];
+
+	return true;
+}
+
+// queries
+
+bool L2GeodataSpatial::FindNearestWalkable(XMINT3 Point, int32_t MaxDistance, XMINT3& Result, L2GeodataOverlay* View)
+{
+	const int64_t CELL_SIZE = L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+	const int32_t BLOCK_SIZE = L2Geodata::GEO_BLOCK_SIZE;
+
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	uint32_t GeoX, GeoY;
+	if (!L2Geodata::WorldToGeo(Point.x, Point.y, &GeoX, &GeoY))
+		return false;
+
+	int64_t BestDistance = (int64_t)MaxDistance * MaxDistance + 1;
+	uint32_t BestGeoX = 0, BestGeoY = 0;
+	int16_t BestHeight = 0;
+
+	auto CheckBlock = [&](int32_t BlockX, int32_t BlockY) {
+
+		if (BlockX < 0 || BlockY < 0 || BlockX >= (int32_t)(L2Geodata::GEO_WIDTH / BLOCK_SIZE) || BlockY >= (int32_t)(L2Geodata::GEO_HEIGHT / BLOCK_SIZE))
+			return;
+
+		BlockSummary Block = GetBlockSummary(BlockX, BlockY);
+		if (Block.WalkableMask == 0)
+			return;
+
+		// lower bound of distance to any walkable layer of the block
+		int64_t DX = max(max(BlockX * BLOCK_SIZE - (int32_t)GeoX, (int32_t)GeoX - (BlockX * BLOCK_SIZE + BLOCK_SIZE - 1)), 0) * CELL_SIZE;
+		int64_t DY = max(max(BlockY * BLOCK_SIZE - (int32_t)GeoY, (int32_t)GeoY - (BlockY * BLOCK_SIZE + BLOCK_SIZE - 1)), 0) * CELL_SIZE;
+		int64_t DZ = max(max((int32_t)Block.MinHeight - Point.z, Point.z - (int32_t)Block.MaxHeight), 0);
+
+		if (DX * DX + DY * DY + DZ * DZ >= BestDistance)
+			return;
+
+		for (uint64_t Mask = Block.WalkableMask; Mask; Mask &= Mask - 1) {
+
+			uint32_t Bit = GetLowestBit(Mask);
+
+			uint32_t CellX = BlockX * BLOCK_SIZE + Bit / BLOCK_SIZE;
+			uint32_t CellY = BlockY * BLOCK_SIZE + Bit % BLOCK_SIZE;
+
+			int64_t CellDX = ((int64_t)CellX - GeoX) * CELL_SIZE;
+			int64_t CellDY = ((int64_t)CellY - GeoY) * CELL_SIZE;
+
+			int64_t HorizontalDistance = CellDX * CellDX + CellDY * CellDY;
+			if (HorizontalDistance >= BestDistance)
+				continue;
+
+			int32_t MaxHeightDiff = (int32_t)sqrt((double)(BestDistance - HorizontalDistance));
+
+			int16_t LayerHeight;
+			if (!GetClosestWalkableLayer(CellX, CellY, Point.z, MaxHeightDiff, LayerHeight))
+				continue;
+
+			int64_t CellDZ = LayerHeight - Point.z;
+
+			int64_t Distance = HorizontalDistance + CellDZ * CellDZ;
+			if (Distance < BestDistance) {
+				BestDistance = Distance;
+				BestGeoX = CellX;
+				BestGeoY = CellY;
+				BestHeight = LayerHeight;
+			}
+		}
+	};
+
+	int32_t CenterBlockX = GeoX / BLOCK_SIZE;
+	int32_t CenterBlockY = GeoY / BLOCK_SIZE;
+
+	int32_t RingsCount = MaxDistance / (BLOCK_SIZE * (int32_t)CELL_SIZE) + 1;
+
+	// blocks ring by ring around the point, ring can't have anything closer than (Ring - 1) blocks
+	for (int32_t Ring = 0; Ring <= RingsCount; Ring++) {
+
+		int64_t RingDistance = (int64_t)max(Ring - 1, 0) * BLOCK_SIZE * CELL_SIZE;
+		if (RingDistance * RingDistance >= BestDistance)
+			break;
+
+		if (Ring == 0) {
+			CheckBlock(CenterBlockX, CenterBlockY);
+			continue;
+		}
+
+		for (int32_t Offset = -Ring; Offset <= Ring; Offset++) {
+			CheckBlock(CenterBlockX + Offset, CenterBlockY - Ring);
+			CheckBlock(CenterBlockX + Offset, CenterBlockY + Ring);
+		}
+
+		for (int32_t Offset = -Ring + 1; Offset <= Ring - 1; Offset++) {
+			CheckBlock(CenterBlockX - Ring, CenterBlockY + Offset);
+			CheckBlock(CenterBlockX + Ring, CenterBlockY + Offset);
+		}
+	}
+
+	if (BestDistance > (int64_t)MaxDistance * MaxDistance)
+		return false;
+
+	int32_t WorldX, WorldY;
+	L2Geodata::GeoToWorld(BestGeoX, BestGeoY, &WorldX, &WorldY);
+
+	Result = { WorldX, WorldY, BestHeight };
+
+	return true;
+}
+
+bool L2GeodataSpatial::AcceptRandomPoint(XMINT3 Center, uint32_t GeoX, uint32_t GeoY, int32_t MaxHeightDiff, bool StraightPathRequired,
+	mt19937& Random, XMINT3& Result)
+{
+	int16_t LayerHeight;
+	if (!GetRandomWalkableLayer(GeoX, GeoY, Center.z, MaxHeightDiff, Random, LayerHeight))
+		return false;
+
+	int32_t WorldX, WorldY;
+	L2Geodata::GeoToWorld(GeoX, GeoY, &WorldX, &WorldY);
+
+	XMINT3 Point = { WorldX, WorldY, LayerHeight };
+
+	if (StraightPathRequired) {
+
+		int32_t FinishZ;
+		if (!L2GeodataPathFind::CanMoveTo(Center, Point, FinishZ) || FinishZ != LayerHeight)
+			return false;
+	}
+
+	Result = Point;
+
+	return true;
+}
+
+bool L2GeodataSpatial::FindRandomWalkable(XMINT3 Center, int32_t Radius, int32_t MaxHeightDiff, mt19937& Random, XMINT3& Result,
+	bool StraightPathRequired, L2GeodataOverlay* View)
+{
+	const int32_t BLOCK_SIZE = L2Geodata::GEO_BLOCK_SIZE;
+
+	L2Geodata::ReaderGuard Guard;
+	L2Geodata::OverlayScope Scope(View);
+
+	uint32_t GeoX, GeoY;
+	if (!L2Geodata::WorldToGeo(Center.x, Center.y, &GeoX, &GeoY))
+		return false;
+
+	int32_t RadiusInCells = Radius / L2Geodata::GEO_COORDS_IN_WORLD_COORDS;
+
+	auto IsInside = [&](int32_t CellX, int32_t CellY) {
+
+		int32_t DX = CellX - (int32_t)GeoX;
+		int32_t DY = CellY - (int32_t)GeoY;
+
+		return CellX >= 0 && CellY >= 0 && CellX < (int32_t)L2Geodata::GEO_WIDTH && CellY < (int32_t)L2Geodata::GEO_HEIGHT &&
+			DX * DX + DY * DY <= RadiusInCells * RadiusInCells;
+	};
+
+	// uniform points of the disk, accepted ones are uniform over its walkable cells, dense areas end here
+	uniform_int_distribution<int32_t> Offset(-RadiusInCells, RadiusInCells);
+
+	for (uint32_t Attempt = 0; Attempt < RANDOM_ATTEMPTS_COUNT; Attempt++) {
+
+		int32_t CellX = (int32_t)GeoX + Offset(Random);
+		int32_t CellY = (int32_t)GeoY + Offset(Random);
+
+		if (!IsInside(CellX, CellY))
+			continue;
+
+		BlockSummary Block = GetBlockSummary(CellX / BLOCK_SIZE, CellY / BLOCK_SIZE);
+		if ((Block.WalkableMask >> (CellX % BLOCK_SIZE * BLOCK_SIZE + CellY % BLOCK_SIZE) & 1) == 0)
+			continue;
+
+		if (AcceptRandomPoint(Center, CellX, CellY, MaxHeightDiff, StraightPathRequired, Random, Result))
+			return true;
+	}
+
+	// sparse area, block is picked by its walkable cells count and cell is picked within block, so it stays uniform
+	vector<pair<uint32_t, uint32_t>> Blocks;
+	vector<uint32_t> Weights;
+
+	int32_t FirstBlockX = max((int32_t)GeoX - RadiusInCells, 0) / BLOCK_SIZE;
+	int32_t FirstBlockY = max((int32_t)GeoY - RadiusInCells, 0) / BLOCK_SIZE;
+	int32_t LastBlockX = min((int32_t)GeoX + RadiusInCells, (int32_t)L2Geodata::GEO_WIDTH - 1) / BLOCK_SIZE;
+	int32_t LastBlockY = min((int32_t)GeoY + RadiusInCells, (int32_t)L2Geodata::GEO_HEIGHT - 1) / BLOCK_SIZE;
+
+	for (int32_t BlockX = FirstBlockX; BlockX <= LastBlockX; BlockX++)
+		for (int32_t BlockY = FirstBlockY; BlockY <= LastBlockY; BlockY++) {
+
+			BlockSummary Block = GetBlockSummary(BlockX, BlockY);
+			if (Block.WalkableMask == 0 || Block.MaxHeight < Center.z - MaxHeightDiff || Block.MinHeight > Center.z + MaxHeightDiff)
+				continue;
+
+			Blocks.push_back({ BlockX, BlockY });
+			Weights.push_back((uint32_t)bitset<64>(Block.WalkableMask).count());
+		}
+
+	if (Blocks.empty())
+		return false;
+
+	discrete_distribution<uint32_t> BlockDistribution(Weights.begin(), Weights.end());
+
+	for (uint32_t Attempt = 0; Attempt < RANDOM_BLOCK_ATTEMPTS_COUNT; Attempt++) {
+
+		pair<uint32_t, uint32_t>& BlockPoint = Blocks[BlockDistribution(Random)];
+
+		uint64_t Mask = GetBlockSummary(BlockPoint.first, BlockPoint.second).WalkableMask;
+
+		// n-th set bit of the mask
+		uint32_t BitNumber = uniform_int_distribution<uint32_t>(0, (uint32_t)bitset<64>(Mask).count() - 1)(Random);
+		for (uint32_t Index = 0; Index < BitNumber; Index++)
+			Mask &= Mask - 1;
+
+		uint32_t Bit = GetLowestBit(Mask);
+
+		int32_t CellX = BlockPoint.first * BLOCK_SIZE + Bit / BLOCK_SIZE;
+		int32_t CellY = BlockPoint.second * BLOCK_SIZE + Bit % BLOCK_SIZE;
+
+		if (!IsInside(CellX, CellY))
+			continue;
+
+		if (AcceptRandomPoint(Center, CellX, CellY, MaxHeightDiff, StraightPathRequired, Random, Result))
+			return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <random>
+#include <DirectXMath.h>
+
+#include "L2Geodata.h"
+
+using namespace std;
+using namespace DirectX;
+
+// Spatial queries over walkable cells (cells with a layer that has any NSWE direction open).
+// Every block has a summary of which cells are walkable and height range of their walkable layers, so queries
+// skip empty blocks (and blocks at the wrong height) by a single check and look at actual layers only for candidates.
+// Summaries are built from static geodata, so regions where the active overlay has cells are scanned without them,
+// candidates are always checked against layers as seen through active overlay.
+class L2GeodataSpatial {
+private:
+	// attempts of plain rejection sampling before candidate blocks are collected, enough for dense areas
+	const static uint32_t RANDOM_ATTEMPTS_COUNT = 32;
+	const static uint32_t RANDOM_BLOCK_ATTEMPTS_COUNT = 64;
+
+	struct BlockSummary {
+		// bit SubBlockX * GEO_BLOCK_SIZE + SubBlockY
+		uint64_t WalkableMask;
+		int16_t MinHeight, MaxHeight;
+	};
+
+	struct RegionSummary {
+		BlockSummary Blocks[L2Geodata::GEO_REGION_SIZE_IN_BLOCKS * L2Geodata::GEO_REGION_SIZE_IN_BLOCKS];
+	};
+
+	static atomic<RegionSummary*> Summaries[L2Geodata::GEO_WIDTH_IN_REGIONS][L2Geodata::GEO_HEIGHT_IN_REGIONS];
+
+	L2GeodataSpatial(void) { }
+
+	// blocks of regions without summary (or with cells of the active overlay) are reported as fully walkable at any height,
+	// so they are checked cell by cell
+	static BlockSummary GetBlockSummary(uint32_t BlockX, uint32_t BlockY);
+	// index of the lowest set bit of non-zero mask, by 32-bit halves so it works in Win32 builds too
+	static uint32_t GetLowestBit(uint64_t Mask);
+	// walkable layer of the cell closest to Height (only within MaxHeightDiff), false if there is none
+	static bool GetClosestWalkableLayer(uint32_t GeoX, uint32_t GeoY, int32_t Height, int32_t MaxHeightDiff, int16_t& LayerHeight);
+	// random walkable layer of the cell within MaxHeightDiff of Height
+	static bool GetRandomWalkableLayer(uint32_t GeoX, uint32_t GeoY, int32_t Height, int32_t MaxHeightDiff, mt19937& Random,
+		int16_t& LayerHeight);
+	static bool AcceptRandomPoint(XMINT3 Center, uint32_t GeoX, uint32_t GeoY, int32_t MaxHeightDiff, bool StraightPathRequired,
+		mt19937& Random, XMINT3& Result);
+
+	static void BuildSummary(uint32_t RegionX, uint32_t RegionY);
+public:
+	// one summary per loaded region (resident one in lazy mode), built in parallel
+	static void BuildSummaries(void);
+	static void FreeSummaries(void);
+	// summary of a region that got other content (reload, edit), its blocks are scanned cell by cell until it's built again
+	static void FreeSummary(uint32_t RegionX, uint32_t RegionY);
+
+	// walkable layer closest to Point (horizontal distance between cells, height difference between layer and Point),
+	// Result is the cell corner on that layer.
+	// View as in L2Geodata::OverlayScope
+	static bool FindNearestWalkable(XMINT3 Point, int32_t MaxDistance, XMINT3& Result, L2GeodataOverlay* View = nullptr);
+	// uniformly random walkable cell within Radius of Center, on a layer within MaxHeightDiff of Center height.
+	// With StraightPathRequired the point also has to be reachable from Center by CanMoveTo, full reachability needs FindPath
+	static bool FindRandomWalkable(XMINT3 Center, int32_t Radius, int32_t MaxHeightDiff, mt19937& Random, XMINT3& Result,
+		bool StraightPathRequired = false, L2GeodataOverlay* View = nullptr);
+};
@@ -8,6 +8,8 @@
 
 #include "GeodataLoaderTest.h"
 #include "Geodata\L2Geodata.h"
+#include "Geodata\L2GeodataBenchmark.h"
+#include "Geodata\L2GeodataRaycast.h"
 #include "Forms\Geo3DViewForm.h"
 
 void OpenConsole(void) {
@@ -26,15 +28,38 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
 
 	InitTime();
 
+	// L2Geodata::EnableLargePages();
 	L2Geodata::Init();
 	// L2Geodata::Load(L"..\\data\\pts", GeoType::PTS);
+	// L2Geodata::Load(L"..\\data\\l2j", GeoType::L2J);
+	// L2GeodataBenchmark::CompareLoaders(L"..\\data\\pts", L"..\\data\\l2j");
 	// L2Geodata::SaveEasyGeo(L"..\\data\\easygeo.bin");
+	// L2Geodata::ConvertLegacyEasyGeo(L"..\\data\\easygeo_legacy.bin", L"..\\data\\easygeo.bin");
 
 	L2Geodata::LoadEasyGeo(L"..\\data\\easygeo.bin");
+	// L2Geodata::SetupLazyEasyGeo(L"..\\data\\easygeo.bin", 512 * 1024 * 1024);
+	// L2Geodata::PublishSharedGeo(L"Local\\L2Geodata");
+	// L2Geodata::AttachSharedGeo(L"Local\\L2Geodata");
+	// L2Geodata::PrefaultRegions();
+	// L2GeodataRaycast::BuildPyramids();
+	// L2GeodataSpatial::BuildSummaries();
+	// L2GeodataBenchmark::CompareBatchQueries(82000, 148000, 2048);
+	// L2GeodataBenchmark::CompareLayerSearch(82000, 148000, 1024);
+	// L2GeodataBenchmark::CompareLineOfSight(82000, 148000, 8192);
+	// L2GeodataBenchmark::CompareRaycast(82000, 148000, 8192);
+	// L2GeodataBenchmark::CompareSpatialQueries(82000, 148000, 120000, 60000);
+	// L2GeodataBenchmark::CompareLayouts(L"..\\data\\easygeo.bin", L"..\\data\\nwc_cache.bin", 82000, 148000, 8192);
+	// L2GeodataBenchmark::CompareArchive(L"..\\data\\easygeo.bin", L"..\\data\\easygeo.geoz");
+	// L2GeodataBenchmark::CompareLargePages(L"..\\data\\pts", GeoType::PTS, L"..\\data\\nwc_cache.bin", 82000, 148000, 8192);
 
 	// L2GeodataPathFind::GenerateNeighborWeightCache();
 	// L2Geodata::SaveNeighborWeightCache(L"..\\data\\nwc_cache.bin");
 	L2Geodata::LoadNeighborWeightCache(L"..\\data\\nwc_cache.bin");
+	// L2GeodataBenchmark::CompareViews(82000, 148000, 8192);
+	// L2GeodataBenchmark::CompareOpenLists(82000, 148000, 8192);
+	// L2GeodataBenchmark::ComparePathFindService(82000, 148000, 8192);
+	// L2GeodataBenchmark::CompareHierarchicalPathFind(82000, 148000, 32768);
+	// L2GeodataBenchmark::CompareJumpPoints(82000, 148000, 8192);
 
 	Geo3DViewForm::GetInstance().Init(1280, 960, L"Geo3DView", L"Geodata 3D View", hInstance);
 	Geo3DViewForm::GetInstance().Show();